@@ -9,6 +9,7 @@
 #include "platform/nowide.h"
 
 #include "include/parser.h"
+#include "audio.h"
 #include "macro.h"
 #include "log.h"
 #include "utils.h"
@@ -144,6 +145,11 @@ fail:
 }
 
 
+// block size for AAC muxing, must be larger than PLZJ_ADTS_MAX_FRAME_LEN
+#define PLZJ_AAC_BSIZE (1024 * 1024)
+static_assert(PLZJ_AAC_BSIZE >= PLZJ_ADTS_MAX_FRAME_LEN);
+
+
 struct PlzjAudioAAC {
   struct PlzjWAVEFORMATEX wav_spec;
   uint32_t sample_pre_chunk;
@@ -412,22 +418,66 @@ static int _Plzj_extract_audio_aac (
     goto fail_out;
   }
 
+  // access units are only a few hundred bytes each, so read the data region in
+  // large blocks and mux whole blocks of ADTS frames at once
+  unsigned char *inbuf = malloc(2 * PLZJ_AAC_BSIZE);
+  if_fail (inbuf != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail_buf;
+  }
+  unsigned char *outbuf = inbuf + PLZJ_AAC_BSIZE;
+
+  size_t data_remain = 0;
+  for (uint32_t i = 0; i < aac.stream_data_sizes_cnt; i++) {
+    data_remain += aac.stream_data_sizes[i];
+  }
+
+  size_t in_start = 0;
+  size_t in_end = 0;
+  size_t out_len = 0;
   for (uint32_t i = 0; i < aac.stream_data_sizes_cnt; i++) {
     uint32_t stream_data_size = aac.stream_data_sizes[i];
 
-    unsigned char header[PLZJ_ADTS_HEADER_LEN];
-    PlzjAudioAAC_frame_header(&aac, header, stream_data_size);
-    if_fail (fwrite(header, sizeof(header), 1, out) == 1) {
+    if (in_end - in_start < stream_data_size) {
+      memmove(inbuf, inbuf + in_start, in_end - in_start);
+      in_end -= in_start;
+      in_start = 0;
+
+      size_t chunk_size = min(PLZJ_AAC_BSIZE - in_end, data_remain);
+      if_fail (fread(inbuf + in_end, chunk_size, 1, file) == 1) {
+        ret = ERR_STD(fread);
+        goto fail;
+      }
+      in_end += chunk_size;
+      data_remain -= chunk_size;
+    }
+
+    if (out_len + PLZJ_ADTS_HEADER_LEN + stream_data_size > PLZJ_AAC_BSIZE) {
+      if_fail (fwrite(outbuf, out_len, 1, out) == 1) {
+        ret = ERR_STD(fwrite);
+        goto fail;
+      }
+      out_len = 0;
+    }
+
+    PlzjAudioAAC_frame_header(&aac, outbuf + out_len, stream_data_size);
+    out_len += PLZJ_ADTS_HEADER_LEN;
+    memcpy(outbuf + out_len, inbuf + in_start, stream_data_size);
+    out_len += stream_data_size;
+    in_start += stream_data_size;
+  }
+
+  if (out_len > 0) {
+    if_fail (fwrite(outbuf, out_len, 1, out) == 1) {
       ret = ERR_STD(fwrite);
       goto fail;
     }
-
-    ret = copy(out, file, stream_data_size, 0);
-    goto_if_fail (ret == 0) fail;
   }
 
   ret = 0;
 fail:
+  free(inbuf);
+fail_buf:
   fclose(out);
 fail_out:
   PlzjAudioAAC_destroy(&aac);
@@ -435,6 +485,487 @@ fail_out:
 }
 
 
+/******** packet source ********/
+
+#define PLZJ_AUDIO_TRACK_BSIZE (1024 * 1024)
+/// PCM is sliced into packets of 1 / x seconds
+#define PLZJ_AUDIO_TRACK_SLICES_PER_SEC 10
+/// WAV header must be found within this size
+#define PLZJ_AUDIO_WAV_HEADER_MAX_SIZE (64 * 1024)
+#define PLZJ_AUDIO_ZLIB_BSIZE (4096 * 32)
+static_assert(PLZJ_AUDIO_ZLIB_BSIZE >= PLZJ_AUDIO_WAV_ZLIB_CHUNK_MAX_SIZE);
+
+
+__attribute_artificial__ __attribute_const__
+static inline uint64_t plzj_units_to_ns (uint64_t units, uint32_t rate) {
+  return units / rate * 1000000000 + units % rate * 1000000000 / rate;
+}
+
+
+static int PlzjAudioTrack_fetch (
+    struct PlzjAudioTrack *track, off_t offset, size_t size,
+    const unsigned char **datap) {
+  if (offset < track->buf_offset || offset + (off_t) size >
+      track->buf_offset + (off_t) track->buf_len) {
+    if (size > track->buf_cap) {
+      size_t cap = max(size, PLZJ_AUDIO_TRACK_BSIZE);
+      unsigned char *buf = realloc(track->buf, cap);
+      return_if_fail (buf != NULL) ERR_STD(realloc);
+      track->buf = buf;
+      track->buf_cap = cap;
+    }
+
+    track->buf_len = 0;
+    return_if_fail (fseeko(track->file, offset, SEEK_SET) == 0)
+      ERR_STD(fseeko);
+    size_t len = fread(track->buf, 1, track->buf_cap, track->file);
+    return_if_fail (len >= size) ERR_STD(fread);
+    track->buf_offset = offset;
+    track->buf_len = len;
+  }
+
+  *datap = track->buf + (offset - track->buf_offset);
+  return 0;
+}
+
+
+static int PlzjAudioPacket_init (void *elm, void *userdata) {
+  *(struct PlzjAudioPacket *) elm = *(const struct PlzjAudioPacket *) userdata;
+  return 0;
+}
+
+
+static int PlzjAudioTrack_add_packet (
+    struct PlzjAudioTrack *track, off_t offset, uint32_t size) {
+  struct PlzjAudioPacket packet = {offset, size};
+  return array_new(
+    &track->packets, &track->packets_cnt, sizeof(packet),
+    PlzjAudioPacket_init, &packet);
+}
+
+
+static int PlzjAudioTrack_add_slices (
+    struct PlzjAudioTrack *track, off_t offset, size_t size,
+    uint16_t block_align) {
+  size_t slice = track->bytes_per_sec / PLZJ_AUDIO_TRACK_SLICES_PER_SEC;
+  if (block_align > 0) {
+    slice -= slice % block_align;
+    slice = max(slice, block_align);
+  }
+  if (slice == 0) {
+    slice = 4096;
+  }
+
+  for (size_t done = 0; done < size; done += slice) {
+    return_with_nonzero (PlzjAudioTrack_add_packet(
+      track, offset + done, min(slice, size - done)));
+  }
+  return_if_fail (track->packets_cnt > 0) 1;
+  return 0;
+}
+
+
+static int PlzjAudioTrack_set_format (
+    struct PlzjAudioTrack *track, const void *fmt, size_t fmt_len) {
+  return_if_fail (fmt_len >= 16) ERR(PL_EFORMAT);
+
+  struct PlzjWAVEFORMATEX spec = {0};
+  memcpy(&spec, fmt, min(fmt_len, sizeof(spec)));
+
+  track->sampling_freq = le32toh(spec.nSamplesPerSec);
+  track->channels = le16toh(spec.nChannels);
+  track->bytes_per_sec = le32toh(spec.nAvgBytesPerSec);
+  return_if_fail (track->sampling_freq > 0 && track->bytes_per_sec > 0)
+    ERR(PL_EFORMAT);
+
+  switch (le16toh(spec.wFormatTag)) {
+    case 1:
+      track->codec_id = "A_PCM/INT/LIT";
+      track->bit_depth = le16toh(spec.wBitsPerSample);
+      return 0;
+    case 3:
+      track->codec_id = "A_PCM/FLOAT/IEEE";
+      track->bit_depth = le16toh(spec.wBitsPerSample);
+      return 0;
+  }
+
+  // anything else goes through the ACM compatibility mode, which wants the
+  // whole WAVEFORMATEX
+  size_t private_len = max(fmt_len, sizeof(spec));
+  track->codec_private = calloc(1, private_len);
+  return_if_fail (track->codec_private != NULL) ERR_STD(calloc);
+  memcpy(track->codec_private, fmt, fmt_len);
+  track->codec_private_len = private_len;
+  track->codec_id = "A_MS/ACM";
+  return 0;
+}
+
+
+static int plzj_wav_find (
+    const unsigned char *buf, size_t len, size_t *fmt_offp, size_t *fmt_lenp,
+    size_t *data_offp, size_t *data_lenp) {
+  return_if_fail (
+    len >= 12 && memcmp(buf, "RIFF", 4) == 0 &&
+    memcmp(buf + 8, "WAVE", 4) == 0) ERR(PL_EFORMAT);
+
+  bool fmt_found = false;
+  for (size_t off = 12; off + 8 <= len; ) {
+    uint32_t chunk_len = le32toh(*(const uint32_t *) (buf + off + 4));
+    if (memcmp(buf + off, "fmt ", 4) == 0) {
+      return_if_fail (off + 8 + chunk_len <= len) ERR(PL_EFORMAT);
+      *fmt_offp = off + 8;
+      *fmt_lenp = chunk_len;
+      fmt_found = true;
+    } else if (memcmp(buf + off, "data", 4) == 0) {
+      return_if_fail (fmt_found) ERR(PL_EFORMAT);
+      *data_offp = off + 8;
+      *data_lenp = chunk_len;
+      return 0;
+    }
+    off += 8 + (size_t) chunk_len + (chunk_len & 1);
+  }
+
+  return ERR(PL_EFORMAT);
+}
+
+
+static int PlzjAudioTrack_init_wav (struct PlzjAudioTrack *track) {
+  uint32_t len_h;
+  return_if_fail (fread(&len_h, sizeof(len_h), 1, track->file) == 1)
+    ERR_STD(fread);
+  uint32_t len = le32toh(len_h);
+  off_t offset = ftello(track->file);
+  return_if_fail (offset != -1) ERR_STD(ftello);
+
+  size_t header_len = min(len, PLZJ_AUDIO_WAV_HEADER_MAX_SIZE);
+  const unsigned char *header;
+  return_with_nonzero (PlzjAudioTrack_fetch(
+    track, offset, header_len, &header));
+
+  size_t fmt_off;
+  size_t fmt_len;
+  size_t data_off;
+  size_t data_len;
+  return_with_nonzero (plzj_wav_find(
+    header, header_len, &fmt_off, &fmt_len, &data_off, &data_len));
+  return_with_nonzero (PlzjAudioTrack_set_format(
+    track, header + fmt_off, fmt_len));
+
+  const struct PlzjWAVEFORMATEX *spec = (const void *) (header + fmt_off);
+  return PlzjAudioTrack_add_slices(
+    track, offset + data_off, min(data_len, len - data_off),
+    le16toh(spec->nBlockAlign));
+}
+
+
+static int PlzjAudioTrack_init_wav_zlib (struct PlzjAudioTrack *track) {
+  struct PlzjLxeAudioWavZlib audio;
+  return_if_fail (fread(&audio, sizeof(audio), 1, track->file) == 1)
+    ERR_STD(fread);
+
+  for (uint32_t i = 0; i < le32toh(audio.chunks_cnt); i++) {
+    uint32_t len_h;
+    return_if_fail (fread(&len_h, sizeof(len_h), 1, track->file) == 1)
+      ERR_STD(fread);
+    uint32_t len = le32toh(len_h);
+    off_t offset = ftello(track->file);
+    return_if_fail (offset != -1) ERR_STD(ftello);
+
+    return_with_nonzero (PlzjAudioTrack_add_packet(track, offset, len));
+    return_if_fail (fseeko(track->file, len, SEEK_CUR) == 0) ERR_STD(fseeko);
+  }
+  return_if_fail (track->packets_cnt > 0) 1;
+
+  track->zbuf = malloc(PLZJ_AUDIO_ZLIB_BSIZE);
+  return_if_fail (track->zbuf != NULL) ERR_STD(malloc);
+
+  // WAV header is in the first chunk
+  const unsigned char *data;
+  return_with_nonzero (PlzjAudioTrack_fetch(
+    track, track->packets[0].offset, track->packets[0].size, &data));
+  uLongf header_len = PLZJ_AUDIO_ZLIB_BSIZE;
+  int res = uncompress(
+    track->zbuf, &header_len, data, track->packets[0].size);
+  return_if_fail (res == Z_OK) ERR_ZLIB(uncompress, res);
+
+  size_t fmt_off;
+  size_t fmt_len;
+  size_t data_off;
+  size_t data_len;
+  return_with_nonzero (plzj_wav_find(
+    track->zbuf, header_len, &fmt_off, &fmt_len, &data_off, &data_len));
+  return_with_nonzero (PlzjAudioTrack_set_format(
+    track, track->zbuf + fmt_off, fmt_len));
+
+  track->zlib = true;
+  track->zlib_skip = data_off;
+  return 0;
+}
+
+
+struct PlzjMpaFrame {
+  unsigned int layer;
+  uint32_t sampling_freq;
+  uint16_t channels;
+  uint32_t samples;
+  uint32_t size;
+};
+
+
+// http://www.mp3-tech.org/programmer/frame_header.html
+static bool plzj_mpa_frame_parse (
+    const unsigned char *h, struct PlzjMpaFrame *frame) {
+  static const uint16_t bitrate_table[2][3][16] = {
+    {
+      {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+      {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+      {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+    }, {
+      {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+      {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+      {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+    }
+  };
+  static const uint32_t sampling_freq_table[3] = {44100, 48000, 32000};
+
+  return_if_fail (h[0] == 0xff && BIT_FIELD(h[1], 5, 3) == 7) false;
+  unsigned int version = BIT_FIELD(h[1], 3, 2);
+  unsigned int layer_idx = BIT_FIELD(h[1], 1, 2);
+  unsigned int bitrate_idx = BIT_FIELD(h[2], 4, 4);
+  unsigned int sampling_freq_idx = BIT_FIELD(h[2], 2, 2);
+  return_if_fail (version != 1 && layer_idx != 0) false;
+  return_if_fail (bitrate_idx != 0 && bitrate_idx != 15) false;
+  return_if_fail (sampling_freq_idx != 3) false;
+
+  bool mpeg1 = version == 3;
+  frame->layer = 4 - layer_idx;
+  frame->sampling_freq =
+    sampling_freq_table[sampling_freq_idx] >> (mpeg1 ? 0 : version == 2 ? 1 : 2);
+  frame->channels = BIT_FIELD(h[3], 6, 2) == 3 ? 1 : 2;
+
+  uint32_t bitrate =
+    bitrate_table[!mpeg1][frame->layer - 1][bitrate_idx] * 1000;
+  unsigned int padding = BIT_FIELD(h[2], 1, 1);
+  if (frame->layer == 1) {
+    frame->samples = 384;
+    frame->size = (12 * bitrate / frame->sampling_freq + padding) * 4;
+  } else {
+    frame->samples = frame->layer == 3 && !mpeg1 ? 576 : 1152;
+    frame->size =
+      frame->samples / 8 * bitrate / frame->sampling_freq + padding;
+  }
+  return frame->size > 4;
+}
+
+
+static int PlzjAudioTrack_init_mp3 (struct PlzjAudioTrack *track) {
+  struct PlzjLxeAudioMP3 audio;
+  return_if_fail (fread(&audio, sizeof(audio), 1, track->file) == 1)
+    ERR_STD(fread);
+  return_if_fail (fseeko(
+    track->file, 4 * ((off_t) le32toh(audio.offsets_cnt) + 1), SEEK_CUR
+  ) == 0) ERR_STD(fseeko);
+
+  uint32_t len_h;
+  return_if_fail (fread(&len_h, sizeof(len_h), 1, track->file) == 1)
+    ERR_STD(fread);
+  uint32_t len = le32toh(len_h);
+  off_t offset = ftello(track->file);
+  return_if_fail (offset != -1) ERR_STD(ftello);
+
+  // split stream into frames, so each block is decodable on its own
+  struct PlzjMpaFrame first = {0};
+  size_t skipped = 0;
+  for (size_t pos = 0; pos + 4 <= len; ) {
+    const unsigned char *h;
+    return_with_nonzero (PlzjAudioTrack_fetch(track, offset + pos, 4, &h));
+
+    if (pos == 0 && memcmp(h, "ID3", 3) == 0 && len >= 10) {
+      return_with_nonzero (PlzjAudioTrack_fetch(track, offset, 10, &h));
+      pos = 10 + (
+        (h[6] & 0x7f) << 21 | (h[7] & 0x7f) << 14 |
+        (h[8] & 0x7f) << 7 | (h[9] & 0x7f));
+      continue;
+    }
+
+    struct PlzjMpaFrame frame;
+    if (!plzj_mpa_frame_parse(h, &frame) || (first.size != 0 && (
+          frame.layer != first.layer ||
+          frame.sampling_freq != first.sampling_freq))) {
+      pos++;
+      skipped++;
+      continue;
+    }
+    break_if_fail (pos + frame.size <= len);
+    if (first.size == 0) {
+      first = frame;
+    }
+
+    return_with_nonzero (PlzjAudioTrack_add_packet(
+      track, offset + pos, frame.size));
+    pos += frame.size;
+  }
+  if (skipped > 0) {
+    sc_debug("MP3 skipped %" PRIuSIZE " bytes of garbage\n", skipped);
+  }
+  return_if_fail (track->packets_cnt > 0) 1;
+
+  static const char *const codec_ids[] = {
+    "A_MPEG/L1", "A_MPEG/L2", "A_MPEG/L3"};
+  track->codec_id = codec_ids[first.layer - 1];
+  track->sampling_freq = first.sampling_freq;
+  track->channels = first.channels;
+  track->samples_per_packet = first.samples;
+  return 0;
+}
+
+
+static int PlzjAudioTrack_init_truespeech (struct PlzjAudioTrack *track) {
+  struct PlzjLxeAudioTruespeech audio;
+  return_if_fail (fread(&audio, sizeof(audio), 1, track->file) == 1)
+    ERR_STD(fread);
+
+  uint32_t data_size_h;
+  return_if_fail (fread(&data_size_h, sizeof(data_size_h), 1, track->file) == 1)
+    ERR_STD(fread);
+  off_t offset = ftello(track->file);
+  return_if_fail (offset != -1) ERR_STD(ftello);
+
+  // same format block as _Plzj_extract_audio_truespeech()
+  unsigned char fmt[sizeof(audio.ts_spec) + 32];
+  memcpy(fmt, &audio.ts_spec, sizeof(audio.ts_spec));
+  memcpy(fmt + 18, "\1\0\xf0", 4);
+  memset(fmt + 22, 0, 28);
+  return_with_nonzero (PlzjAudioTrack_set_format(track, fmt, sizeof(fmt)));
+
+  return PlzjAudioTrack_add_slices(
+    track, offset, le32toh(data_size_h), le16toh(audio.ts_spec.nBlockAlign));
+}
+
+
+static int PlzjAudioTrack_init_aac (struct PlzjAudioTrack *track) {
+  struct PlzjAudioAAC aac;
+  return_with_nonzero (PlzjAudioAAC_init(&aac, track->file));
+
+  int ret;
+
+  track->packets = malloc(
+    sizeof(*track->packets) * max(aac.stream_data_sizes_cnt, 1));
+  if_fail (track->packets != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail;
+  }
+
+  off_t offset = aac.data_offset;
+  for (uint32_t i = 0; i < aac.stream_data_sizes_cnt; i++) {
+    track->packets[i] = (struct PlzjAudioPacket) {
+      offset, aac.stream_data_sizes[i]};
+    offset += aac.stream_data_sizes[i];
+  }
+  track->packets_cnt = aac.stream_data_sizes_cnt;
+
+  track->codec_id = "A_AAC";
+  track->codec_private = aac.config;
+  track->codec_private_len = aac.config_len;
+  aac.config = NULL;
+  track->sampling_freq = aac.sampling_freq;
+  track->channels = aac.channel_cfg;
+  track->samples_per_packet =
+    aac.sample_pre_chunk == 0 ? 1024 : aac.sample_pre_chunk;
+
+  ret = track->packets_cnt > 0 ? 0 : 1;
+fail:
+  PlzjAudioAAC_destroy(&aac);
+  return ret;
+}
+
+
+int PlzjAudioTrack_next (struct PlzjAudioTrack *track) {
+  return_if_fail (track->packet_i < track->packets_cnt) 1;
+
+  const struct PlzjAudioPacket *packet = track->packets + track->packet_i;
+  const unsigned char *data;
+  return_with_nonzero (PlzjAudioTrack_fetch(
+    track, packet->offset, packet->size, &data));
+  size_t size = packet->size;
+
+  if (track->zlib) {
+    uLongf zlen = PLZJ_AUDIO_ZLIB_BSIZE;
+    int res = uncompress(track->zbuf, &zlen, data, size);
+    return_if_fail (res == Z_OK) ERR_ZLIB(uncompress, res);
+    data = track->zbuf;
+    size = zlen;
+    if (track->packet_i == 0) {
+      size_t skip = min(track->zlib_skip, size);
+      data += skip;
+      size -= skip;
+    }
+  }
+
+  track->data = data;
+  track->size = size;
+  if (track->samples_per_packet != 0) {
+    track->timecode_ns = plzj_units_to_ns(
+      track->units_done, track->sampling_freq);
+    track->units_done += track->samples_per_packet;
+  } else {
+    track->timecode_ns = plzj_units_to_ns(
+      track->units_done, track->bytes_per_sec);
+    track->units_done += size;
+  }
+  track->packet_i++;
+  return 0;
+}
+
+
+void PlzjAudioTrack_destroy (struct PlzjAudioTrack *track) {
+  free(track->zbuf);
+  free(track->buf);
+  free(track->packets);
+  free(track->codec_private);
+}
+
+
+int PlzjAudioTrack_init (struct PlzjAudioTrack *track, const struct Plzj *pl) {
+  *track = (struct PlzjAudioTrack) {.file = pl->file};
+  return_if_fail (pl->audio_offset != -1) 1;
+  return_if_fail (fseeko(pl->file, pl->audio_offset, SEEK_SET) == 0)
+    ERR_STD(fseeko);
+
+  int ret;
+  switch (le32toh(pl->player.audio_type)) {
+    case PLZJ_AUDIO_WAV:
+      ret = PlzjAudioTrack_init_wav(track);
+      break;
+    case PLZJ_AUDIO_WAV_ZLIB:
+      ret = PlzjAudioTrack_init_wav_zlib(track);
+      break;
+    case PLZJ_AUDIO_MP3:
+      ret = PlzjAudioTrack_init_mp3(track);
+      break;
+    case PLZJ_AUDIO_TRUESPEECH:
+      ret = PlzjAudioTrack_init_truespeech(track);
+      break;
+    case PLZJ_AUDIO_AAC:
+      ret = PlzjAudioTrack_init_aac(track);
+      break;
+    default:
+      ret = ERR(PL_ENOTSUP);
+      break;
+  }
+  if_fail (ret == 0) {
+    PlzjAudioTrack_destroy(track);
+    return ret;
+  }
+
+  sc_debug(
+    "Audio track %s, %" PRIu32 " Hz, %" PRIu16 " channels, %" PRIuSIZE
+    " packets\n", track->codec_id, track->sampling_freq, track->channels,
+    track->packets_cnt);
+  return 0;
+}
+
+
 int Plzj_extract_audio (const struct Plzj *pl, const char *dir) {
   return_if_fail (pl->audio_offset != -1) 0;
   return_if_fail (fseeko(pl->file, pl->audio_offset, SEEK_SET) == 0)
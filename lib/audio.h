@@ -0,0 +1,76 @@
+#ifndef AUDIO_H
+#define AUDIO_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "include/defs.h"
+
+struct Plzj;
+
+
+struct PlzjAudioPacket {
+  off_t offset;
+  uint32_t size;
+};
+
+
+/// Audio packet source, for muxing audio into containers
+struct PlzjAudioTrack {
+  FILE *file;
+
+  /// Matroska codec ID
+  const char *codec_id;
+  unsigned char *codec_private;
+  size_t codec_private_len;
+  uint32_t sampling_freq;
+  uint16_t channels;
+  uint16_t bit_depth;
+
+  struct PlzjAudioPacket *packets;
+  size_t packets_cnt;
+  size_t packet_i;
+
+  /// packets are zlib compressed WAV chunks
+  bool zlib;
+  /// size of WAV header in the first uncompressed chunk
+  size_t zlib_skip;
+
+  /// if nonzero, duration of each packet in samples, otherwise timecodes are
+  /// calculated from `bytes_per_sec`
+  uint32_t samples_per_packet;
+  uint32_t bytes_per_sec;
+  uint64_t units_done;
+
+  /// current packet
+  const unsigned char *data;
+  size_t size;
+  uint64_t timecode_ns;
+
+  unsigned char *buf;
+  size_t buf_cap;
+  off_t buf_offset;
+  size_t buf_len;
+  unsigned char *zbuf;
+};
+
+__THROW __nonnull()
+int PlzjAudioTrack_next (struct PlzjAudioTrack *track);
+__THROW __nonnull()
+void PlzjAudioTrack_destroy (struct PlzjAudioTrack *track);
+__THROW __nonnull() __attr_access((__write_only__, 1))
+__attr_access((__read_only__, 2))
+int PlzjAudioTrack_init (struct PlzjAudioTrack *track, const struct Plzj *pl);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_H */
@@ -0,0 +1,142 @@
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "bufpool.h"
+#include "macro.h"
+#include "log.h"
+
+
+/// header in front of every pooled buffer
+union PlzjBufHeader {
+  size_t cap;
+  max_align_t align;
+};
+
+
+__attribute_artificial__
+static inline union PlzjBufHeader *PlzjBufHeader_of (void *buf) {
+  return (union PlzjBufHeader *) buf - 1;
+}
+
+
+static void PlzjBufPool_lock (struct PlzjBufPool *pool) {
+#ifndef NO_THREADS
+  mtx_lock(&pool->mutex);
+#else
+  (void) pool;
+#endif
+}
+
+
+static void PlzjBufPool_unlock (struct PlzjBufPool *pool) {
+#ifndef NO_THREADS
+  mtx_unlock(&pool->mutex);
+#else
+  (void) pool;
+#endif
+}
+
+
+/**
+ * @brief Get a buffer of at least `size` bytes.
+ *
+ * The smallest free buffer large enough is taken; if there is none, the
+ * largest free one is grown, so buffers settle at the sizes the caller needs
+ * and later requests no longer allocate.
+ */
+void *PlzjBufPool_get (struct PlzjBufPool *pool, size_t size) {
+  union PlzjBufHeader *header = NULL;
+
+  PlzjBufPool_lock(pool);
+  if (pool->free_cnt > 0) {
+    size_t best = pool->free_cnt;
+    size_t largest = 0;
+    for (size_t i = 0; i < pool->free_cnt; i++) {
+      size_t cap = PlzjBufHeader_of(pool->free[i])->cap;
+      if (cap >= size &&
+          (best >= pool->free_cnt ||
+           cap < PlzjBufHeader_of(pool->free[best])->cap)) {
+        best = i;
+      }
+      if (cap > PlzjBufHeader_of(pool->free[largest])->cap) {
+        largest = i;
+      }
+    }
+    size_t i = best < pool->free_cnt ? best : largest;
+    header = PlzjBufHeader_of(pool->free[i]);
+    pool->free_cnt--;
+    pool->free[i] = pool->free[pool->free_cnt];
+  }
+  PlzjBufPool_unlock(pool);
+
+  if (header != NULL && header->cap >= size) {
+    atomic_fetch_add_explicit(&pool->reuses, 1, memory_order_relaxed);
+    return header + 1;
+  }
+
+  // round up to reduce regrowing for slightly larger requests, but keep small
+  // objects small; contents are not kept, so do not let realloc() copy them
+  size_t align = size < 4096 ? alignof(max_align_t) : 4096;
+  size_t cap = (size + align - 1) & ~(align - 1);
+  free(header);
+  union PlzjBufHeader *new_header = malloc(sizeof(*header) + cap);
+  if_fail (new_header != NULL) {
+    (void) ERR_STD(malloc);
+    return NULL;
+  }
+  atomic_fetch_add_explicit(&pool->allocs, 1, memory_order_relaxed);
+
+  new_header->cap = cap;
+  return new_header + 1;
+}
+
+
+/**
+ * @brief Give a buffer from PlzjBufPool_get() back to `pool`.
+ */
+void PlzjBufPool_put (struct PlzjBufPool *pool, void *buf) {
+  return_if_fail (buf != NULL);
+
+  PlzjBufPool_lock(pool);
+  if (pool->free_cnt >= pool->free_cap) {
+    size_t new_cap = pool->free_cap == 0 ? 16 : 2 * pool->free_cap;
+    void **new_free = realloc(pool->free, sizeof(*new_free) * new_cap);
+    if_fail (new_free != NULL) {
+      PlzjBufPool_unlock(pool);
+      free(PlzjBufHeader_of(buf));
+      return;
+    }
+    pool->free = new_free;
+    pool->free_cap = new_cap;
+  }
+  pool->free[pool->free_cnt] = buf;
+  pool->free_cnt++;
+  PlzjBufPool_unlock(pool);
+}
+
+
+void PlzjBufPool_destroy (struct PlzjBufPool *pool) {
+  for (size_t i = 0; i < pool->free_cnt; i++) {
+    free(PlzjBufHeader_of(pool->free[i]));
+  }
+  free(pool->free);
+#ifndef NO_THREADS
+  mtx_destroy(&pool->mutex);
+#endif
+}
+
+
+int PlzjBufPool_init (struct PlzjBufPool *pool) {
+#ifndef NO_THREADS
+  return_if_fail (mtx_init(&pool->mutex, mtx_plain) == thrd_success)
+    ERR_STD(mtx_init);
+#endif
+  pool->free = NULL;
+  pool->free_cnt = 0;
+  pool->free_cap = 0;
+  atomic_init(&pool->allocs, 0);
+  atomic_init(&pool->reuses, 0);
+  return 0;
+}
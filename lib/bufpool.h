@@ -0,0 +1,80 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifndef NO_THREADS
+#  include "platform/c11threads.h"
+#endif
+
+#include "include/defs.h"
+#include "macro.h"
+#include "log.h"
+
+/** @file */
+
+
+/// Pool of growable buffers, shared between threads
+struct PlzjBufPool {
+#ifndef NO_THREADS
+  mtx_t mutex;
+#endif
+  /// stack of free buffers
+  void **free;
+  size_t free_cnt;
+  size_t free_cap;
+
+  /// number of buffers allocated or grown
+  atomic_size_t allocs;
+  /// number of requests served by a free buffer as is
+  atomic_size_t reuses;
+};
+
+__THROW __attribute_warn_unused_result__ __nonnull()
+void *PlzjBufPool_get (struct PlzjBufPool *pool, size_t size);
+__THROW __nonnull((1))
+void PlzjBufPool_put (struct PlzjBufPool *pool, void *buf);
+__THROW __nonnull()
+void PlzjBufPool_destroy (struct PlzjBufPool *pool);
+__THROW __nonnull() __attr_access((__write_only__, 1))
+int PlzjBufPool_init (struct PlzjBufPool *pool);
+
+/**
+ * @brief Get a buffer from `pool`, or from malloc() if `pool` is `NULL`.
+ */
+__attribute_artificial__ __attribute_warn_unused_result__
+static inline void *PlzjBufPool_alloc (struct PlzjBufPool *pool, size_t size) {
+  if (pool != NULL) {
+    return PlzjBufPool_get(pool, size);
+  }
+  void *buf = malloc(size);
+  if_fail (buf != NULL) {
+    (void) ERR_STD(malloc);
+  }
+  return buf;
+}
+
+/**
+ * @brief Return a buffer from PlzjBufPool_alloc().
+ */
+__attribute_artificial__
+static inline void PlzjBufPool_free (struct PlzjBufPool *pool, void *buf) {
+  if (pool != NULL) {
+    PlzjBufPool_put(pool, buf);
+  } else {
+    free(buf);
+  }
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUFPOOL_H */
@@ -0,0 +1,312 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "include/platform/endian.h"
+#include "platform/nowide.h"
+#include "platform/pio.h"
+
+#include "checkpoint.h"
+#include "macro.h"
+#include "log.h"
+
+
+#define PLZJ_CHECKPOINT_MAGIC "PLZJCKP3"
+
+
+/// all fields are naturally aligned, no padding in between
+struct PlzjCheckpointHead {
+  char magic[8];
+  int32_t left;
+  int32_t top;
+  uint32_t width;
+  uint32_t height;
+  uint32_t flags;
+  uint32_t transitions_cnt;
+  uint32_t interp;
+  int32_t compression_level;
+  /// bit patterns of float
+  uint32_t target_fps;
+  uint32_t target_mbps;
+  uint64_t video_frames_cnt;
+  uint64_t video_patches_cnt;
+  uint64_t frame_i;
+  int64_t out_offset;
+  int64_t acTL_offset;
+  int32_t rect_cursor[4];
+  int32_t rect_click[4];
+  uint8_t draw_cursor;
+  uint8_t draw_click;
+  uint8_t reserved[6];
+  uint64_t frames_cnt;
+  uint64_t canvas_len;
+  uint64_t canvas_last_len;
+};
+static_assert(sizeof(struct PlzjCheckpointHead) == 152);
+
+
+struct PlzjCheckpointEntry {
+  int32_t rect[4];
+  uint32_t timecode_ms;
+  uint32_t size;
+};
+static_assert(sizeof(struct PlzjCheckpointEntry) == 24);
+
+
+static void plzj_rect_pack (int32_t dst[4], const struct PlzjRect *rect) {
+  dst[0] = htole32(rect->p1.x);
+  dst[1] = htole32(rect->p1.y);
+  dst[2] = htole32(rect->p2.x);
+  dst[3] = htole32(rect->p2.y);
+}
+
+
+static void plzj_rect_unpack (struct PlzjRect *rect, const int32_t src[4]) {
+  *rect = (struct PlzjRect) {
+    {le32toh(src[0]), le32toh(src[1])}, {le32toh(src[2]), le32toh(src[3])}};
+}
+
+
+static uint32_t plzj_float_pack (float f) {
+  static_assert(sizeof(f) == sizeof(uint32_t));
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return htole32(u);
+}
+
+
+static float plzj_float_unpack (uint32_t u) {
+  u = le32toh(u);
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+
+static int plzj_fwrite_crc (
+    const void *data, size_t size, FILE *file, uint32_t *crcp) {
+  if (size == 0) {
+    return 0;
+  }
+  return_if_fail (fwrite(data, size, 1, file) == 1) ERR_STD(fwrite);
+  *crcp = crc32_z(*crcp, data, size);
+  return 0;
+}
+
+
+static int plzj_fread_crc (void *data, size_t size, FILE *file, uint32_t *crcp) {
+  if (size == 0) {
+    return 0;
+  }
+  return_if_fail (fread(data, size, 1, file) == 1) ERR_STD(fread);
+  *crcp = crc32_z(*crcp, data, size);
+  return 0;
+}
+
+
+static int PlzjCheckpoint_write (
+    const struct PlzjCheckpoint *ckpt, FILE *file) {
+  struct PlzjCheckpointHead head = {
+    .magic = PLZJ_CHECKPOINT_MAGIC,
+    .left = htole32(ckpt->left),
+    .top = htole32(ckpt->top),
+    .width = htole32(ckpt->width),
+    .height = htole32(ckpt->height),
+    .flags = htole32(ckpt->flags),
+    .transitions_cnt = htole32(ckpt->transitions_cnt),
+    .interp = htole32(ckpt->interp),
+    .compression_level = htole32(ckpt->compression_level),
+    .target_fps = plzj_float_pack(ckpt->target_fps),
+    .target_mbps = plzj_float_pack(ckpt->target_mbps),
+    .video_frames_cnt = htole64(ckpt->video_frames_cnt),
+    .video_patches_cnt = htole64(ckpt->video_patches_cnt),
+    .frame_i = htole64(ckpt->frame_i),
+    .out_offset = htole64(ckpt->out_offset),
+    .acTL_offset = htole64(ckpt->acTL_offset),
+    .draw_cursor = ckpt->draw_cursor,
+    .draw_click = ckpt->draw_click,
+    .frames_cnt = htole64(ckpt->frames_cnt),
+    .canvas_len = htole64(ckpt->canvas_len),
+    .canvas_last_len = htole64(ckpt->canvas_last_len),
+  };
+  plzj_rect_pack(head.rect_cursor, &ckpt->rect_cursor);
+  plzj_rect_pack(head.rect_click, &ckpt->rect_click);
+
+  uint32_t crc = crc32_z(0, Z_NULL, 0);
+  return_with_nonzero (plzj_fwrite_crc(&head, sizeof(head), file, &crc));
+
+  for (size_t i = 0; i < ckpt->frames_cnt; i++) {
+    const struct PlzjCheckpointFrame *frame = &ckpt->frames[i];
+    struct PlzjCheckpointEntry entry = {
+      .timecode_ms = htole32(frame->timecode_ms),
+      .size = htole32(frame->size),
+    };
+    plzj_rect_pack(entry.rect, &frame->rect);
+    return_with_nonzero (plzj_fwrite_crc(&entry, sizeof(entry), file, &crc));
+  }
+
+  return_with_nonzero (plzj_fwrite_crc(
+    ckpt->canvas, ckpt->canvas_len, file, &crc));
+  return_with_nonzero (plzj_fwrite_crc(
+    ckpt->canvas_last, ckpt->canvas_last_len, file, &crc));
+
+  crc = htole32(crc);
+  return_if_fail (fwrite(&crc, sizeof(crc), 1, file) == 1) ERR_STD(fwrite);
+  return 0;
+}
+
+
+/**
+ * @brief Save checkpoint, replacing the old one only when fully written.
+ */
+int PlzjCheckpoint_save (const struct PlzjCheckpoint *ckpt, const char *path) {
+  size_t path_len = strlen(path);
+  char *path_tmp = malloc(path_len + 5);
+  return_if_fail (path_tmp != NULL) ERR_STD(malloc);
+  memcpy(path_tmp, path, path_len);
+  memcpy(path_tmp + path_len, ".tmp", 5);
+
+  int ret;
+  FILE *file = mfopen(path_tmp, "wb");
+  if_fail (file != NULL) {
+    ret = ERR_STD(mfopen);
+    goto fail_open;
+  }
+
+  ret = PlzjCheckpoint_write(ckpt, file);
+  // make the new checkpoint durable before it replaces the old one
+  if (ret == 0) {
+    if_fail (fflush(file) == 0) {
+      ret = ERR_STD(fflush);
+    } else if_fail (sync_fd(fileno(file)) == 0) {
+      ret = ERR_STD(sync_fd);
+    }
+  }
+  if_fail (fclose(file) == 0) {
+    if (ret == 0) {
+      ret = ERR_STD(fclose);
+    }
+  }
+  goto_if_fail (ret == 0) fail;
+
+  if (mrename(path_tmp, path) != 0) {
+    // Windows does not replace existing files
+    mremove(path);
+    if_fail (mrename(path_tmp, path) == 0) {
+      ret = ERR_STD(mrename);
+      goto fail;
+    }
+  }
+  free(path_tmp);
+  return 0;
+
+fail:
+  mremove(path_tmp);
+fail_open:
+  free(path_tmp);
+  return ret;
+}
+
+
+void PlzjCheckpoint_destroy (struct PlzjCheckpoint *ckpt) {
+  free(ckpt->frames);
+  free(ckpt->canvas);
+  free(ckpt->canvas_last);
+}
+
+
+static int PlzjCheckpoint_read (struct PlzjCheckpoint *ckpt, FILE *file) {
+  struct PlzjCheckpointHead head;
+  uint32_t crc = crc32_z(0, Z_NULL, 0);
+  return_with_nonzero (plzj_fread_crc(&head, sizeof(head), file, &crc));
+  return_if_fail (memcmp(
+    head.magic, PLZJ_CHECKPOINT_MAGIC, sizeof(head.magic)) == 0)
+    ERR(PL_EFORMAT);
+
+  ckpt->left = le32toh(head.left);
+  ckpt->top = le32toh(head.top);
+  ckpt->width = le32toh(head.width);
+  ckpt->height = le32toh(head.height);
+  ckpt->flags = le32toh(head.flags);
+  ckpt->transitions_cnt = le32toh(head.transitions_cnt);
+  ckpt->interp = le32toh(head.interp);
+  ckpt->compression_level = le32toh(head.compression_level);
+  ckpt->target_fps = plzj_float_unpack(head.target_fps);
+  ckpt->target_mbps = plzj_float_unpack(head.target_mbps);
+  ckpt->video_frames_cnt = le64toh(head.video_frames_cnt);
+  ckpt->video_patches_cnt = le64toh(head.video_patches_cnt);
+  ckpt->frame_i = le64toh(head.frame_i);
+  ckpt->out_offset = le64toh(head.out_offset);
+  ckpt->acTL_offset = le64toh(head.acTL_offset);
+  plzj_rect_unpack(&ckpt->rect_cursor, head.rect_cursor);
+  plzj_rect_unpack(&ckpt->rect_click, head.rect_click);
+  ckpt->draw_cursor = head.draw_cursor != 0;
+  ckpt->draw_click = head.draw_click != 0;
+
+  uint64_t frames_cnt = le64toh(head.frames_cnt);
+  uint64_t canvas_len = le64toh(head.canvas_len);
+  uint64_t canvas_last_len = le64toh(head.canvas_last_len);
+  return_if_fail (frames_cnt <= SIZE_MAX / sizeof(*ckpt->frames))
+    ERR(PL_EFORMAT);
+
+  // canvases are 32-bit pixels of the recorded size, compressed by zlib
+  uint64_t canvas_size = 4 * (uint64_t) ckpt->width * ckpt->height;
+  return_if_fail (canvas_size <= ULONG_MAX / 2) ERR(PL_EFORMAT);
+  uint64_t canvas_bound = compressBound(canvas_size);
+  return_if_fail (
+    canvas_len > 0 && canvas_len <= canvas_bound &&
+    canvas_last_len > 0 && canvas_last_len <= canvas_bound) ERR(PL_EFORMAT);
+
+  if (frames_cnt > 0) {
+    ckpt->frames = malloc(sizeof(*ckpt->frames) * frames_cnt);
+    return_if_fail (ckpt->frames != NULL) ERR_STD(malloc);
+  }
+  ckpt->frames_cnt = frames_cnt;
+  for (size_t i = 0; i < frames_cnt; i++) {
+    struct PlzjCheckpointEntry entry;
+    return_with_nonzero (plzj_fread_crc(&entry, sizeof(entry), file, &crc));
+
+    struct PlzjCheckpointFrame *frame = &ckpt->frames[i];
+    plzj_rect_unpack(&frame->rect, entry.rect);
+    frame->timecode_ms = le32toh(entry.timecode_ms);
+    frame->size = le32toh(entry.size);
+  }
+
+  ckpt->canvas = malloc(canvas_len);
+  return_if_fail (ckpt->canvas != NULL) ERR_STD(malloc);
+  ckpt->canvas_len = canvas_len;
+  return_with_nonzero (plzj_fread_crc(ckpt->canvas, canvas_len, file, &crc));
+
+  ckpt->canvas_last = malloc(canvas_last_len);
+  return_if_fail (ckpt->canvas_last != NULL) ERR_STD(malloc);
+  ckpt->canvas_last_len = canvas_last_len;
+  return_with_nonzero (plzj_fread_crc(
+    ckpt->canvas_last, canvas_last_len, file, &crc));
+
+  uint32_t crc_file;
+  return_if_fail (fread(&crc_file, sizeof(crc_file), 1, file) == 1)
+    ERR_STD(fread);
+  return_if_fail (le32toh(crc_file) == crc) ERR(PL_EFORMAT);
+  return 0;
+}
+
+
+/**
+ * @brief Load checkpoint from file.
+ */
+int PlzjCheckpoint_init_file (struct PlzjCheckpoint *ckpt, const char *path) {
+  *ckpt = (struct PlzjCheckpoint) {0};
+
+  FILE *file = mfopen(path, "rb");
+  return_if_fail (file != NULL) ERR_STD(mfopen);
+
+  int ret = PlzjCheckpoint_read(ckpt, file);
+  fclose(file);
+  if_fail (ret == 0) {
+    PlzjCheckpoint_destroy(ckpt);
+  }
+  return ret;
+}
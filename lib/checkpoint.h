@@ -0,0 +1,81 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "include/defs.h"
+#include "include/video.h"
+
+/** @file */
+
+
+/// APNG frame already written, as needed to fill in its fcTL at the end
+struct PlzjCheckpointFrame {
+  struct PlzjRect rect;
+  uint32_t timecode_ms;
+  /// size of fdAT data
+  uint32_t size;
+};
+
+
+/// State of an interrupted APNG extraction, at the beginning of a source frame
+struct PlzjCheckpoint {
+  /// parameters of the extraction, must match when resuming
+  int32_t left;
+  int32_t top;
+  uint32_t width;
+  uint32_t height;
+  uint32_t flags;
+  uint32_t interp;
+  uint32_t transitions_cnt;
+  int32_t compression_level;
+  float target_fps;
+  float target_mbps;
+  uint64_t video_frames_cnt;
+  uint64_t video_patches_cnt;
+
+  /// next source frame to process
+  uint64_t frame_i;
+  /// end of data written, output is truncated to it when resuming
+  off_t out_offset;
+  off_t acTL_offset;
+
+  /// cursor drawn by the previous source frame
+  struct PlzjRect rect_cursor;
+  struct PlzjRect rect_click;
+  bool draw_cursor;
+  bool draw_click;
+
+  struct PlzjCheckpointFrame *frames;
+  size_t frames_cnt;
+
+  /// zlib compressed pixels of encoder canvas, without cursor
+  void *canvas;
+  size_t canvas_len;
+  /// zlib compressed pixels of last written canvas
+  void *canvas_last;
+  size_t canvas_last_len;
+};
+
+__THROW __nonnull() __attr_access((__read_only__, 1))
+__attr_access((__read_only__, 2))
+int PlzjCheckpoint_save (const struct PlzjCheckpoint *ckpt, const char *path);
+__THROW __nonnull()
+void PlzjCheckpoint_destroy (struct PlzjCheckpoint *ckpt);
+__THROW __nonnull() __attr_access((__write_only__, 1))
+__attr_access((__read_only__, 2))
+int PlzjCheckpoint_init_file (struct PlzjCheckpoint *ckpt, const char *path);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,173 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "platform/nowide.h"
+#include "platform/nproc.h"
+
+#include "include/parser.h"
+#include "include/video.h"
+#include "macro.h"
+#include "log.h"
+#include "threadpool.h"
+
+
+struct PlzjSectionJob {
+  const struct Plzj *pl;
+  const char *path;
+  struct PlzjVideoExtractOptions options;
+  char dir[4096];
+
+  int ret;
+  struct ScException exc;
+};
+
+
+/**
+ * @brief Extract one section into `dir`, creating it if not exist.
+ */
+int Plzj_extract (
+    const struct Plzj *pl, const char *dir,
+    const struct PlzjVideoExtractOptions *options) {
+  struct stat statbuf;
+  if (mstat(dir, &statbuf) != 0) {
+    return_if_fail (mmkdir(dir, 0755) == 0) ERR_STD(mmkdir);
+  } else {
+    return_if_fail (S_ISDIR(statbuf.st_mode)) ERR(PL_EINVAL);
+  }
+
+  int res = Plzj_extract_video_or_cursor(pl, dir, options);
+  return_if_fail (res >= 0) res;
+
+  // Matroska output carries the audio track itself, unless muxing failed
+  bool audio_muxed =
+    (options->video.flags & PLZJ_VIDEO_MKV) != 0 &&
+    (options->video.flags & PLZJ_VIDEO_MKV_AUDIO) != 0 &&
+    options->extract_video && res == 0;
+  if (options->extract_audio && !audio_muxed) {
+    res = Plzj_extract_audio(pl, dir);
+    return_if_fail (res >= 0) res;
+  }
+  if (options->extract_txts) {
+    return_with_nonzero (Plzj_extract_txts(pl, dir));
+  }
+  if (options->extract_thumbnails) {
+    res = Plzj_extract_thumbnails(
+      pl, dir, options->frames_limit, options->thumbnails_every,
+      options->thumbnail_width);
+    return_if_fail (res >= 0) res;
+  }
+  return 0;
+}
+
+
+static int PlzjSectionJob_run (void *arg) {
+  struct PlzjSectionJob *job = arg;
+
+  // each section decodes with its own file position
+  struct Plzj pl = *job->pl;
+  pl.file = mfopen(job->path, "rb");
+  if_fail (pl.file != NULL) {
+    job->ret = ERR_STD(mfopen);
+    job->exc = sc_exc;
+    return 0;
+  }
+
+  job->ret = Plzj_extract(&pl, job->dir, &job->options);
+  if_fail (job->ret == 0) {
+    job->exc = sc_exc;
+  }
+
+  fclose(pl.file);
+  return 0;
+}
+
+
+/**
+ * @brief Extract all sections concurrently, section `i` into `<dir>/<i>`.
+ *
+ * `options->video.nproc` is the thread budget of the whole call, divided between
+ * sections running at the same time.
+ *
+ * @param path Path of the file, reopened for each section.
+ * @param[out] results Result of each section, can be `NULL`.
+ * @return 0 if all sections were extracted, otherwise error of the first
+ *   failed section.
+ */
+int PlzjFile_extract_sections (
+    const struct PlzjFile *pf, const char *path, const char *dir,
+    const struct PlzjVideoExtractOptions *options, int *results) {
+  return_if_fail (PlzjFile_valid(pf)) ERR(PL_EINVAL);
+
+  size_t dir_len = strlen(dir);
+  return_if_fail (dir_len + 16 <= sizeof(((struct PlzjSectionJob *) 0)->dir))
+    ERR(PL_EINVAL);
+
+  struct stat statbuf;
+  if (mstat(dir, &statbuf) != 0) {
+    return_if_fail (mmkdir(dir, 0755) == 0) ERR_STD(mmkdir);
+  } else {
+    return_if_fail (S_ISDIR(statbuf.st_mode)) ERR(PL_EINVAL);
+  }
+
+  unsigned int nproc = options->video.nproc;
+  if (nproc == 0) {
+    nproc = get_nproc();
+    if (nproc == 0) {
+      nproc = 1;
+    }
+  }
+  unsigned int jobs_cnt = min(nproc, pf->sections_cnt);
+  unsigned int job_nproc = nproc / jobs_cnt;
+
+  struct PlzjSectionJob *jobs = calloc(pf->sections_cnt, sizeof(*jobs));
+  return_if_fail (jobs != NULL) ERR_STD(calloc);
+
+  int ret;
+
+  struct ThreadPool pool;
+  ret = ThreadPool_init(&pool, jobs_cnt, "section");
+  goto_if_fail (ret == 0) fail_pool;
+
+  sc_info(
+    "Extracting %" PRIu32 " sections, %u at a time with %u threads each\n",
+    pf->sections_cnt, jobs_cnt, job_nproc);
+
+  uint32_t i;
+  for (i = 0; i < pf->sections_cnt; i++) {
+    struct PlzjSectionJob *job = jobs + i;
+    job->pl = pf->sections + i;
+    job->path = path;
+    job->options = *options;
+    job->options.video.nproc = job_nproc;
+    snprintf(job->dir, sizeof(job->dir), "%s" DIR_SEP_S "%" PRIu32, dir, i);
+
+    ret = ThreadPool_run(&pool, PlzjSectionJob_run, job);
+    break_if_fail (ret == 0);
+  }
+
+  const struct ScException *exc;
+  int res = ThreadPool_stop(&pool, &exc);
+  if (unlikely(res != 0) && ret == 0) {
+    sc_exc = *exc;
+    ret = res;
+  }
+
+  for (i = 0; i < pf->sections_cnt; i++) {
+    if (results != NULL) {
+      results[i] = jobs[i].ret;
+    }
+    if (ret == 0 && jobs[i].ret != 0) {
+      ret = jobs[i].ret;
+      sc_exc = jobs[i].exc;
+    }
+  }
+
+  ThreadPool_destroy(&pool);
+fail_pool:
+  free(jobs);
+  return ret;
+}
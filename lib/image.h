@@ -6,6 +6,16 @@ extern "C" {
 #endif
 
 #include "include/defs.h"
+#include "include/video.h"
+
+/** @file */
+
+
+/// largest factor of PlzjCanvas_downscale(), so that sums of 8-bit samples
+/// fit in 32 bits
+#define PLZJ_DOWNSCALE_MAX 4096
+/// output pixels summed at a time by PlzjCanvas_downscale()
+#define PLZJ_DOWNSCALE_CHUNK 256
 
 
 extern const unsigned char depth5to8_table[];
@@ -17,6 +27,12 @@ static inline unsigned char to_depth8 (
   return (depth == 5 ? depth5to8_table : depth6to8_table)[color];
 }
 
+__THROW __nonnull() __attr_access((__read_only__, 2))
+__attr_access((__read_only__, 3))
+int PlzjCanvas_downscale (
+  struct PlzjCanvas *canvas, const struct PlzjCanvas *screen,
+  const struct PlzjRect *rect, unsigned int scale);
+
 
 #ifdef __cplusplus
 }
@@ -15,6 +15,7 @@ extern "C" {
 #include "alg.h"
 #include "structs.h"
 
+struct PlzjRect;
 
 struct Plzj {
   FILE *file;
@@ -71,40 +72,142 @@ PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
 __attr_access((__read_only__, 2))
 int Plzj_extract_audio (const struct Plzj *pl, const char *dir);
 
-struct PlzjVideoExtractOptions {
-  int32_t frames_limit;
+/// cursor interpolation kernel
+enum PlzjInterp {
+  PLZJ_INTERP_CUBIC = 0,
+  PLZJ_INTERP_LINEAR = 1,
+  PLZJ_INTERP_LANCZOS = 2,
+};
+
+/// write every patch as its own APNG frame
+#define PLZJ_VIDEO_SUBFRAMES 1
+/// draw cursor
+#define PLZJ_VIDEO_CURSOR 2
+/// write Matroska instead of APNG
+#define PLZJ_VIDEO_MKV 4
+/// write APNG without seeking back, after counting frames in a dry run
+#define PLZJ_VIDEO_STREAM 8
+/// save progress to `<output>.ckpt` periodically, and resume from it
+#define PLZJ_VIDEO_CHECKPOINT 16
+/// mux audio into Matroska
+#define PLZJ_VIDEO_MKV_AUDIO 32
+/// draw the cursor highlight if the player enables it
+#define PLZJ_VIDEO_HIGHLIGHT 64
+
+/// Options of writing video
+struct PlzjVideoOptions {
+  /// `PLZJ_VIDEO_*` flags
+  unsigned int flags;
+  enum PlzjInterp interp;
+  /// transition frames between two source frames
   unsigned int transitions_cnt;
+  /// output one frame every n source frames, 0 or 1 for every frame
+  unsigned int decimate;
+  /// output n times smaller in both directions (at most 15), 0 or 1 for full
+  /// size
+  unsigned int scale;
+  /// zlib level, or the highest level if a throughput target is set
   int compression_level;
+  /// throughput target of frames per second, 0 if none
+  float target_fps;
+  /// throughput target of uncompressed megabytes per second, 0 if none
+  float target_mbps;
+  /// number of threads, 0 for number of cores
   unsigned int nproc;
+  /// region of the screen to extract video from, whole screen if width is 0
+  int32_t crop_left;
+  int32_t crop_top;
+  uint32_t crop_width;
+  uint32_t crop_height;
+};
+
+struct PlzjVideoExtractOptions {
+  int32_t frames_limit;
+  struct PlzjVideoOptions video;
+  /// thumbnail of every n-th keyframe, see Plzj_extract_thumbnails()
+  unsigned int thumbnails_every;
+  /// width of thumbnails at most, 0 for full size
+  unsigned int thumbnail_width;
+
+  bool extract_video : 1;
+  bool extract_cursor : 1;
+  bool extract_audio : 1;
+  bool extract_txts : 1;
+  bool extract_thumbnails : 1;
 };
 
+/**
+ * @brief Extract video and / or cursors into `dir`, as selected by
+ *   `PlzjVideoExtractOptions::extract_video` and
+ *   `PlzjVideoExtractOptions::extract_cursor`.
+ *
+ * @return 0 on success, 1 if `PLZJ_VIDEO_MKV_AUDIO` is set but audio was not
+ *   muxed.
+ */
 PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
-__attr_access((__read_only__, 2))
+__attr_access((__read_only__, 2)) __attr_access((__read_only__, 3))
 int Plzj_extract_video_or_cursor (
-  const struct Plzj *pl, const char *dir, int32_t frames_limit,
-  unsigned int flags, unsigned int transitions_cnt, int compression_level,
-  unsigned int nproc, bool extract_video, bool extract_cursor);
+  const struct Plzj *pl, const char *dir,
+  const struct PlzjVideoExtractOptions *options);
 
 __attribute_artificial__ __nonnull() __attr_access((__read_only__, 1))
 __attr_access((__read_only__, 2))
 static inline int Plzj_extract_video (
     const struct Plzj *pl, const char *dir, unsigned int flags,
   unsigned int transitions_cnt, int compression_level, unsigned int nproc) {
-  return Plzj_extract_video_or_cursor(
-    pl, dir, -1, flags, transitions_cnt, compression_level, nproc, true, false);
+  struct PlzjVideoExtractOptions options = {
+    .frames_limit = -1,
+    .video = {
+      .flags = flags,
+      .transitions_cnt = transitions_cnt,
+      .compression_level = compression_level,
+      .nproc = nproc,
+    },
+    .extract_video = true,
+  };
+  return Plzj_extract_video_or_cursor(pl, dir, &options);
 }
 
 __attribute_artificial__ __nonnull() __attr_access((__read_only__, 1))
 __attr_access((__read_only__, 2))
 static inline int Plzj_extract_cursor (
     const struct Plzj *pl, const char *dir) {
-  return Plzj_extract_video_or_cursor(pl, dir, -1, 0, 0, 0, 0, false, true);
+  struct PlzjVideoExtractOptions options = {
+    .frames_limit = -1,
+    .extract_cursor = true,
+  };
+  return Plzj_extract_video_or_cursor(pl, dir, &options);
 }
 
 PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
 __attr_access((__read_only__, 2))
 int Plzj_extract_txts (const struct Plzj *pl, const char *dir);
 
+/**
+ * @brief Write thumbnails of keyframes and a contact sheet of them.
+ *
+ * Only the full-frame image of each keyframe listed in keyframes txt is
+ * decoded, then downscaled with a box filter into
+ * `<dir>/thumb_<frame>.png`, and all thumbnails are laid out in
+ * `<dir>/contact_sheet.png`, one cell for each keyframe taken.
+ *
+ * @param every Take every `every`-th keyframe, 0 for all.
+ * @param thumb_width Width of thumbnails at most, 0 for full size.
+ * @return 0 on success, 1 if no keyframes found, 2 if none of them has a
+ *   full-frame image.
+ */
+PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
+__attr_access((__read_only__, 2))
+int Plzj_extract_thumbnails (
+  const struct Plzj *pl, const char *dir, int32_t frames_limit,
+  unsigned int every, unsigned int thumb_width);
+
+PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
+__attr_access((__read_only__, 2)) __attr_access((__read_only__, 3))
+int Plzj_extract (
+  const struct Plzj *pl, const char *dir,
+  const struct PlzjVideoExtractOptions *options);
+
 PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
 int Plzj_print_info (const struct Plzj *pl, FILE *out, bool in_section);
 PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
@@ -159,6 +262,13 @@ __attr_access((__read_only__, 2))
 int PlzjFile_set_password_iconv (
   const struct PlzjFile *pf, const char *password, bool force);
 
+PLZJ_API __THROW __nonnull((1, 2, 3, 4)) __attr_access((__read_only__, 1))
+__attr_access((__read_only__, 2)) __attr_access((__read_only__, 3))
+__attr_access((__read_only__, 4)) __attr_access((__write_only__, 5))
+int PlzjFile_extract_sections (
+  const struct PlzjFile *pf, const char *path, const char *dir,
+  const struct PlzjVideoExtractOptions *options, int *results);
+
 PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
 void PlzjFile_destroy (const struct PlzjFile *pf);
 PLZJ_API __THROW __nonnull() __attr_access((__write_only__, 1))
@@ -139,6 +139,13 @@ struct PlzjCursorRes {
   struct PlzjBuffer buf;
   unsigned long tag;
   bool gray;
+
+  /// decoded sprite, top-down, `NULL` if the icon is malformed
+  struct PlzjColor *colors;
+  /// `color` of each pixel has all bits set where the cursor is drawn
+  struct PlzjColor *masks;
+  uint16_t width;
+  uint16_t height;
 };
 
 
@@ -241,6 +248,7 @@ PLZJ_API __THROW __nonnull() __attr_access((__write_only__, 1))
 int PlzjImage_init_file (struct PlzjImage *image, FILE *file);
 
 
+/// frame built by the caller; PlzjVideo stores its frames in flat arrays
 struct PlzjFrame {
   struct PlzjCursor cursor;
   struct PlzjImage **patches;
@@ -268,25 +276,61 @@ static inline int PlzjFrame_init (struct PlzjFrame *frame) {
 }
 
 
+struct PlzjFrameCache;
+
 struct PlzjVideo {
-  struct PlzjFrame **frames;
+  /// patches of all frames, in stream order
+  struct PlzjImage *patches;
+  size_t patches_cnt;
+  /// patches of frame `i` are `patches[frame_patches[i]]` up to
+  /// `patches[frame_patches[i + 1]]` (exclusive), `frames_cnt + 1` entries
+  size_t *frame_patches;
+  /// cursor of each frame
+  struct PlzjCursor *cursors;
   size_t frames_cnt;
   struct PlzjCursorRes **curreses;
   size_t curreses_cnt;
+  /// open addressing hash map from CRC tag to cursor resource
+  struct PlzjCursorRes **curres_map;
+  size_t curres_map_cap;
 
   const struct Plzj *pl;
   uint32_t frame_ms;
+
+  /// canvases reconstructed by PlzjVideo_get_frame(), created on first use
+  struct PlzjFrameCache *frame_cache;
 };
 
+__attribute_artificial__ __attribute_warn_unused_result__ __attribute_pure__
+__nonnull() __attr_access((__read_only__, 1))
+static inline size_t PlzjVideo_frame_patches_cnt (
+    const struct PlzjVideo *video, size_t i) {
+  return video->frame_patches[i + 1] - video->frame_patches[i];
+}
+
+__attribute_artificial__ __attribute_warn_unused_result__ __attribute_pure__
+__nonnull() __attr_access((__read_only__, 1))
+static inline struct PlzjImage *PlzjVideo_frame_patches (
+    const struct PlzjVideo *video, size_t i) {
+  return video->patches + video->frame_patches[i];
+}
+
 PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
+int PlzjVideo_apply_frame (
+  const struct PlzjVideo *video, size_t i, struct PlzjCanvas *canvas);
+PLZJ_API __THROW __nonnull()
+int PlzjVideo_get_frame (
+  struct PlzjVideo *video, size_t i, struct PlzjCanvas *canvas);
+PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
+__attr_access((__read_only__, 3))
 int PlzjVideo_write_apng (
-  const struct PlzjVideo *video, FILE *out, unsigned int flags,
-  unsigned int transitions_cnt, int compression_level, unsigned int nproc);
+  const struct PlzjVideo *video, FILE *out,
+  const struct PlzjVideoOptions *options);
 PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
-__attr_access((__read_only__, 2))
+__attr_access((__read_only__, 2)) __attr_access((__read_only__, 3))
 int PlzjVideo_save_apng (
-  const struct PlzjVideo *video, const char *path, unsigned int flags,
-  unsigned int transitions_cnt, int compression_level, unsigned int nproc);
+  const struct PlzjVideo *video, const char *path,
+  const struct PlzjVideoOptions *options);
 
 PLZJ_API __THROW __nonnull() __attr_access((__read_only__, 1))
 __attr_access((__read_only__, 2))
@@ -1,9 +1,13 @@
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "include/platform/endian.h"
+#include "platform/pio.h"
 
 #include "include/iter.h"
 #include "include/video.h"
@@ -136,28 +140,37 @@ int Plzj_print_video (const struct Plzj *pl, FILE *out, int32_t frames_limit) {
 }
 
 
-int Plzj_set_playlock (struct Plzj *pl, const char *password) {
-  return_if_fail (pl->key_set >= 0) ERR(PL_EKEY);
+/// 20-byte region rewritten by Plzj_set_playlock()
+struct PlzjPlaylockPatch {
+  /// offset of the encrypted bytes
+  off_t offset;
+  /// offset of the image head, XORed in or out when the lock is toggled
+  off_t head_offset;
+};
+
+
+static int PlzjPlaylockPatch_cmp (const void *a, const void *b) {
+  off_t x = ((const struct PlzjPlaylockPatch *) a)->offset;
+  off_t y = ((const struct PlzjPlaylockPatch *) b)->offset;
+  return (x > y) - (x < y);
+}
 
-  bool setkey = password != NULL && password[0] != '\0';
-  return_if_fail (pl->key_set > 0 || setkey) 0;
 
+/**
+ * @brief Collect the offsets of all encrypted regions of the video stream.
+ *
+ * @param[out] patchesp Array of patches, sorted by offset.
+ * @param[out] cntp Number of patches.
+ */
+static int Plzj_collect_playlock_patches (
+    const struct Plzj *pl, struct PlzjPlaylockPatch **patchesp,
+    size_t *cntp) {
   struct PlzjLxePacketIter iter;
   PlzjLxePacketIter_init(&iter, pl, -1);
 
-  char key[20] = {0};
-  if (setkey) {
-    char buf[22];
-    strncpy(buf, password, sizeof(buf) - 1);
-    plzj_key_enc(key, buf);
-  }
-  if (pl->key_set > 0) {
-    for (unsigned int i = 0; i < 20; i++) {
-      key[i] ^= pl->key[i];
-    }
-  }
-
-  bool recrypt = (pl->key_set > 0) == setkey;
+  struct PlzjPlaylockPatch *patches = NULL;
+  size_t cnt = 0;
+  size_t cap = 0;
 
   int ret;
   while (true) {
@@ -171,44 +184,163 @@ int Plzj_set_playlock (struct Plzj *pl, const char *password) {
       break_if_fail (iter.frame_no < iter.frames_cnt);
       continue;
     }
+    if (state != PlzjLxePacketIter_NEXT_IMAGE) {
+      continue;
+    }
 
-    if (state == PlzjLxePacketIter_NEXT_IMAGE) {
-      size_t size = le32toh(iter.packet.image.size);
-      if (size <= 10240) {
-        continue;
-      }
+    size_t size = le32toh(iter.packet.image.size);
+    if (size <= 10240) {
+      continue;
+    }
 
-      unsigned char head[20];
-      if (!recrypt) {
-        ret = read_at(pl->file, iter.offset + 4, SEEK_SET, head, sizeof(head));
-        goto_if_fail (ret == 0) fail;
+    if (cnt >= cap) {
+      size_t new_cap = cap == 0 ? 256 : cap * 2;
+      struct PlzjPlaylockPatch *new_patches =
+        realloc(patches, new_cap * sizeof(*patches));
+      if_fail (new_patches != NULL) {
+        ret = ERR_STD(realloc);
+        goto fail;
       }
+      patches = new_patches;
+      cap = new_cap;
+    }
+    patches[cnt].offset = iter.offset + size / 2;
+    patches[cnt].head_offset = iter.offset + 4;
+    cnt++;
+  }
 
-      unsigned char encrypted[20];
-      ret = read_at(
-        pl->file, iter.offset + size / 2, SEEK_SET, encrypted,
-        sizeof(encrypted));
-      goto_if_fail (ret == 0) fail;
+  // packets come in file order, sorting is only a safeguard
+  qsort(patches, cnt, sizeof(*patches), PlzjPlaylockPatch_cmp);
 
-      if_fail (fseeko(pl->file, iter.offset + size / 2, SEEK_SET) == 0) {
-        ret = ERR_STD(fseeko);
-        goto fail;
-      }
-      if (!recrypt) {
-        for (unsigned int i = 0; i < 20; i++) {
-          encrypted[i] ^= head[i];
-        }
+  *patchesp = patches;
+  *cntp = cnt;
+  return 0;
+
+fail:
+  free(patches);
+  return ret;
+}
+
+
+/**
+ * @brief Get the offset of the `i`-th 20-byte region to touch, in file order.
+ *
+ * Without `recrypt`, the head of each image is needed too. It comes before the
+ * encrypted bytes of the image, which come before the next image.
+ */
+static off_t Plzj_playlock_span (
+    const struct PlzjPlaylockPatch *patches, bool recrypt, size_t i) {
+  return recrypt ? patches[i].offset :
+    i % 2 == 0 ? patches[i / 2].head_offset : patches[i / 2].offset;
+}
+
+
+/**
+ * @brief Apply XOR patches with coalesced positional reads and writes.
+ *
+ * Image heads and encrypted bytes close to each other are read in one block of
+ * at most `PLAYLOCK_BLOCK_SIZE` bytes, XORed in memory, and written back. A
+ * head is kept until the encrypted bytes of its image are reached, possibly in
+ * a later block.
+ *
+ * @param key XOR key of the new password against the old one.
+ * @param recrypt `true` if the file stays locked (only the password changes).
+ */
+static int Plzj_apply_playlock_patches (
+    const struct Plzj *pl, const struct PlzjPlaylockPatch *patches,
+    size_t cnt, const char key[20], bool recrypt) {
+  enum {
+    PLAYLOCK_BLOCK_SIZE = 1024 * 1024,
+    PLAYLOCK_GAP_SIZE = 64 * 1024,
+  };
+
+  return_if_fail (cnt > 0) 0;
+
+  // the stream may have buffered data in either direction
+  return_if_fail (fflush(pl->file) == 0) ERR_STD(fflush);
+  int fd = fileno(pl->file);
+
+  unsigned char *buf = malloc(PLAYLOCK_BLOCK_SIZE);
+  return_if_fail (buf != NULL) ERR_STD(malloc);
+
+  size_t spans_cnt = recrypt ? cnt : 2 * cnt;
+  unsigned char head[20] = {0};
+  int ret = 0;
+  for (size_t i = 0; i < spans_cnt; ) {
+    off_t begin = Plzj_playlock_span(patches, recrypt, i);
+    off_t end = begin + 20;
+
+    size_t j = i + 1;
+    for (; j < spans_cnt; j++) {
+      off_t next = Plzj_playlock_span(patches, recrypt, j);
+      break_if_fail (next - end <= PLAYLOCK_GAP_SIZE);
+      break_if_fail (next + 20 - begin <= PLAYLOCK_BLOCK_SIZE);
+      end = next + 20;
+    }
+
+    if_fail (pread_full(fd, buf, end - begin, begin) == 0) {
+      ret = ERR_STD(pread);
+      break;
+    }
+
+    bool dirty = false;
+    for (size_t k = i; k < j; k++) {
+      unsigned char *span =
+        buf + (Plzj_playlock_span(patches, recrypt, k) - begin);
+      if (!recrypt && k % 2 == 0) {
+        memcpy(head, span, sizeof(head));
+        continue;
       }
-      for (unsigned int i = 0; i < 20; i++) {
-        encrypted[i] ^= key[i];
+      for (unsigned int l = 0; l < 20; l++) {
+        span[l] ^= key[l] ^ (recrypt ? 0 : head[l]);
       }
-      if_fail (fwrite(encrypted, sizeof(encrypted), 1, pl->file) == 1) {
-        ret = ERR_STD(fwrite);
-        goto fail;
+      dirty = true;
+    }
+
+    if (dirty) {
+      if_fail (pwrite_full(fd, buf, end - begin, begin) == 0) {
+        ret = ERR_STD(pwrite);
+        break;
       }
     }
+
+    i = j;
+  }
+
+  free(buf);
+  return ret;
+}
+
+
+int Plzj_set_playlock (struct Plzj *pl, const char *password) {
+  return_if_fail (pl->key_set >= 0) ERR(PL_EKEY);
+
+  bool setkey = password != NULL && password[0] != '\0';
+  return_if_fail (pl->key_set > 0 || setkey) 0;
+
+  char key[20] = {0};
+  if (setkey) {
+    char buf[22];
+    strncpy(buf, password, sizeof(buf) - 1);
+    plzj_key_enc(key, buf);
+  }
+  if (pl->key_set > 0) {
+    for (unsigned int i = 0; i < 20; i++) {
+      key[i] ^= pl->key[i];
+    }
   }
 
+  bool recrypt = (pl->key_set > 0) == setkey;
+
+  struct PlzjPlaylockPatch *patches;
+  size_t patches_cnt;
+  int ret = Plzj_collect_playlock_patches(pl, &patches, &patches_cnt);
+  return_if_fail (ret == 0) ret;
+
+  ret = Plzj_apply_playlock_patches(pl, patches, patches_cnt, key, recrypt);
+  free(patches);
+  goto_if_fail (ret == 0) fail;
+
   if_fail (fseeko(
       pl->file, pl->end_offset + PLZJ_OFFSET_FOOTER + offsetof(
         struct PlzjLxeFooter, editlock_key), SEEK_SET) == 0) {
@@ -0,0 +1,616 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "include/platform/endian.h"
+
+#include "include/parser.h"
+#include "audio.h"
+#include "gdi.h"
+#include "macro.h"
+#include "log.h"
+#include "mkv.h"
+#include "utils.h"
+
+
+// https://www.matroska.org/technical/elements.html
+#define EBML_ID_EBML 0x1A45DFA3
+#define EBML_ID_EBMLVERSION 0x4286
+#define EBML_ID_EBMLREADVERSION 0x42F7
+#define EBML_ID_EBMLMAXIDLENGTH 0x42F2
+#define EBML_ID_EBMLMAXSIZELENGTH 0x42F3
+#define EBML_ID_DOCTYPE 0x4282
+#define EBML_ID_DOCTYPEVERSION 0x4287
+#define EBML_ID_DOCTYPEREADVERSION 0x4285
+#define EBML_ID_VOID 0xEC
+
+#define MKV_ID_SEGMENT 0x18538067
+#define MKV_ID_SEEKHEAD 0x114D9B74
+#define MKV_ID_SEEK 0x4DBB
+#define MKV_ID_SEEKID 0x53AB
+#define MKV_ID_SEEKPOSITION 0x53AC
+#define MKV_ID_INFO 0x1549A966
+#define MKV_ID_TIMESTAMPSCALE 0x2AD7B1
+#define MKV_ID_DURATION 0x4489
+#define MKV_ID_TITLE 0x7BA9
+#define MKV_ID_MUXINGAPP 0x4D80
+#define MKV_ID_WRITINGAPP 0x5741
+#define MKV_ID_TRACKS 0x1654AE6B
+#define MKV_ID_TRACKENTRY 0xAE
+#define MKV_ID_TRACKNUMBER 0xD7
+#define MKV_ID_TRACKUID 0x73C5
+#define MKV_ID_TRACKTYPE 0x83
+#define MKV_ID_FLAGLACING 0x9C
+#define MKV_ID_CODECID 0x86
+#define MKV_ID_CODECPRIVATE 0x63A2
+#define MKV_ID_VIDEO 0xE0
+#define MKV_ID_PIXELWIDTH 0xB0
+#define MKV_ID_PIXELHEIGHT 0xBA
+#define MKV_ID_AUDIO 0xE1
+#define MKV_ID_SAMPLINGFREQUENCY 0xB5
+#define MKV_ID_CHANNELS 0x9F
+#define MKV_ID_BITDEPTH 0x6264
+#define MKV_ID_CLUSTER 0x1F43B675
+#define MKV_ID_TIMESTAMP 0xE7
+#define MKV_ID_SIMPLEBLOCK 0xA3
+#define MKV_ID_CUES 0x1C53BB6B
+#define MKV_ID_CUEPOINT 0xBB
+#define MKV_ID_CUETIME 0xB3
+#define MKV_ID_CUETRACKPOSITIONS 0xB7
+#define MKV_ID_CUETRACK 0xF7
+#define MKV_ID_CUECLUSTERPOSITION 0xF1
+
+#define MKV_TRACK_VIDEO 1
+#define MKV_TRACK_AUDIO 2
+
+/// space reserved for SeekHead at the beginning of Segment
+#define MKV_SEEKHEAD_SIZE 96
+/// start a new cluster at the next video frame after this duration
+#define MKV_CLUSTER_DURATION_MS 5000
+#define MKV_CLUSTER_MAX_SIZE (8 * 1024 * 1024)
+
+
+/******** EBML ********/
+
+static int PlzjEbml_reserve (struct PlzjEbml *ebml, size_t size) {
+  return_if_fail (ebml->len + size > ebml->cap) 0;
+
+  size_t cap = max(max(2 * ebml->cap, ebml->len + size), 4096);
+  unsigned char *data = realloc(ebml->data, cap);
+  return_if_fail (data != NULL) ERR_STD(realloc);
+  ebml->data = data;
+  ebml->cap = cap;
+  return 0;
+}
+
+
+static void PlzjEbml_put_be (
+    struct PlzjEbml *ebml, uint64_t value, unsigned int len) {
+  for (unsigned int i = len; i > 0; ) {
+    i--;
+    ebml->data[ebml->len++] = value >> (8 * i);
+  }
+}
+
+
+__attribute_const__
+static unsigned int ebml_uint_len (uint64_t value) {
+  unsigned int len = 1;
+  while (len < 8 && (value >> (8 * len)) != 0) {
+    len++;
+  }
+  return len;
+}
+
+
+__attribute_const__
+static unsigned int ebml_id_len (uint32_t id) {
+  return id > 0xffffff ? 4 : id > 0xffff ? 3 : id > 0xff ? 2 : 1;
+}
+
+
+static int PlzjEbml_put_raw (
+    struct PlzjEbml *ebml, const void *data, size_t len) {
+  return_with_nonzero (PlzjEbml_reserve(ebml, len));
+  memcpy(ebml->data + ebml->len, data, len);
+  ebml->len += len;
+  return 0;
+}
+
+
+static int PlzjEbml_put_header (
+    struct PlzjEbml *ebml, uint32_t id, uint64_t size) {
+  return_with_nonzero (PlzjEbml_reserve(ebml, 4 + 8));
+  PlzjEbml_put_be(ebml, id, ebml_id_len(id));
+
+  // shortest variable size integer, all ones are reserved
+  unsigned int len = 1;
+  while (len < 8 && size >= (UINT64_C(1) << (7 * len)) - 1) {
+    len++;
+  }
+  PlzjEbml_put_be(ebml, UINT64_C(1) << (7 * len) | size, len);
+  return 0;
+}
+
+
+static int PlzjEbml_put_uint (
+    struct PlzjEbml *ebml, uint32_t id, uint64_t value) {
+  unsigned int len = ebml_uint_len(value);
+  return_with_nonzero (PlzjEbml_put_header(ebml, id, len));
+  return_with_nonzero (PlzjEbml_reserve(ebml, len));
+  PlzjEbml_put_be(ebml, value, len);
+  return 0;
+}
+
+
+static int PlzjEbml_put_float (
+    struct PlzjEbml *ebml, uint32_t id, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return_with_nonzero (PlzjEbml_put_header(ebml, id, 8));
+  return_with_nonzero (PlzjEbml_reserve(ebml, 8));
+  PlzjEbml_put_be(ebml, bits, 8);
+  return 0;
+}
+
+
+static int PlzjEbml_put_bin (
+    struct PlzjEbml *ebml, uint32_t id, const void *data, size_t len) {
+  return_with_nonzero (PlzjEbml_put_header(ebml, id, len));
+  return PlzjEbml_put_raw(ebml, data, len);
+}
+
+
+static int PlzjEbml_put_str (
+    struct PlzjEbml *ebml, uint32_t id, const char *str) {
+  return PlzjEbml_put_bin(ebml, id, str, strlen(str));
+}
+
+
+/**
+ * @brief Begin a master element with a 8-byte size field.
+ *
+ * @param[out] posp Position of element data, for PlzjEbml_end().
+ */
+static int PlzjEbml_begin (struct PlzjEbml *ebml, uint32_t id, size_t *posp) {
+  return_with_nonzero (PlzjEbml_reserve(ebml, 4 + 8));
+  PlzjEbml_put_be(ebml, id, ebml_id_len(id));
+  PlzjEbml_put_be(ebml, UINT64_C(1) << 56, 8);
+  *posp = ebml->len;
+  return 0;
+}
+
+
+static void PlzjEbml_end (struct PlzjEbml *ebml, size_t pos) {
+  uint64_t size = htobe64(UINT64_C(1) << 56 | (ebml->len - pos));
+  memcpy(ebml->data + pos - 8, &size, 8);
+}
+
+
+/******** Matroska ********/
+
+static int PlzjMkv_write (struct PlzjMkv *mkv, const void *data, size_t len) {
+  return_if_fail (fwrite(data, len, 1, mkv->out) == 1) ERR_STD(fwrite);
+  mkv->position += len;
+  return 0;
+}
+
+
+static int PlzjMkv_flush_cluster (struct PlzjMkv *mkv) {
+  return_if_fail (mkv->cluster.len > 0) 0;
+
+  unsigned char header[4 + 8];
+  *(uint32_t *) header = htobe32(MKV_ID_CLUSTER);
+  *(uint64_t *) (header + 4) = htobe64(UINT64_C(1) << 56 | mkv->cluster.len);
+  return_with_nonzero (PlzjMkv_write(mkv, header, sizeof(header)));
+  return_with_nonzero (PlzjMkv_write(
+    mkv, mkv->cluster.data, mkv->cluster.len));
+  mkv->cluster.len = 0;
+  return 0;
+}
+
+
+static int PlzjMkv_open_cluster (
+    struct PlzjMkv *mkv, uint64_t timecode_ms, bool cue) {
+  return_with_nonzero (PlzjMkv_flush_cluster(mkv));
+
+  if (cue) {
+    struct PlzjMkvCue *cues = realloc(
+      mkv->cues, sizeof(*cues) * (mkv->cues_cnt + 1));
+    return_if_fail (cues != NULL) ERR_STD(realloc);
+    mkv->cues = cues;
+    cues[mkv->cues_cnt] = (struct PlzjMkvCue) {timecode_ms, mkv->position};
+    mkv->cues_cnt++;
+  }
+
+  mkv->cluster_timecode_ms = timecode_ms;
+  return PlzjEbml_put_uint(&mkv->cluster, MKV_ID_TIMESTAMP, timecode_ms);
+}
+
+
+static int PlzjMkv_put_block (
+    struct PlzjMkv *mkv, unsigned int track, uint64_t timecode_ms,
+    size_t len) {
+  if (timecode_ms < mkv->cluster_timecode_ms ||
+      timecode_ms - mkv->cluster_timecode_ms > INT16_MAX ||
+      mkv->cluster.len == 0 || mkv->cluster.len >= MKV_CLUSTER_MAX_SIZE) {
+    return_with_nonzero (PlzjMkv_open_cluster(mkv, timecode_ms, false));
+  }
+
+  return_with_nonzero (PlzjEbml_put_header(
+    &mkv->cluster, MKV_ID_SIMPLEBLOCK, 4 + len));
+  return_with_nonzero (PlzjEbml_reserve(&mkv->cluster, 4));
+  PlzjEbml_put_be(&mkv->cluster, 0x80 | track, 1);
+  PlzjEbml_put_be(
+    &mkv->cluster, timecode_ms - mkv->cluster_timecode_ms, 2);
+  // keyframe
+  PlzjEbml_put_be(&mkv->cluster, 0x80, 1);
+
+  if (timecode_ms > mkv->last_timecode_ms) {
+    mkv->last_timecode_ms = timecode_ms;
+  }
+  return 0;
+}
+
+
+static int PlzjMkv_write_audio (
+    struct PlzjMkv *mkv, uint64_t timecode_ms, bool all) {
+  while (mkv->has_audio) {
+    if (!mkv->audio_pending) {
+      int res = PlzjAudioTrack_next(&mkv->audio);
+      return_if_fail (res >= 0) res;
+      if (res > 0) {
+        mkv->has_audio = false;
+        break;
+      }
+      mkv->audio_pending = true;
+    }
+
+    uint64_t audio_timecode_ms = mkv->audio.timecode_ns / 1000000;
+    break_if_fail (all || audio_timecode_ms <= timecode_ms);
+
+    return_with_nonzero (PlzjMkv_put_block(
+      mkv, MKV_TRACK_AUDIO, audio_timecode_ms, mkv->audio.size));
+    return_with_nonzero (PlzjEbml_put_raw(
+      &mkv->cluster, mkv->audio.data, mkv->audio.size));
+    mkv->audio_pending = false;
+  }
+  return 0;
+}
+
+
+int PlzjMkv_write_png (
+    struct PlzjMkv *mkv, const void *zdata, size_t zlen, uint32_t timecode_ms) {
+  return_with_nonzero (PlzjMkv_write_audio(mkv, timecode_ms, false));
+
+  if (mkv->cluster.len == 0 || timecode_ms < mkv->cluster_timecode_ms ||
+      timecode_ms - mkv->cluster_timecode_ms >= MKV_CLUSTER_DURATION_MS ||
+      mkv->cluster.len >= MKV_CLUSTER_MAX_SIZE) {
+    return_with_nonzero (PlzjMkv_open_cluster(mkv, timecode_ms, true));
+  }
+
+  static const unsigned char chunk_IEND[12] = {
+    0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82};
+  return_with_nonzero (PlzjMkv_put_block(
+    mkv, MKV_TRACK_VIDEO, timecode_ms,
+    sizeof(mkv->png_head) + 8 + zlen + 4 + sizeof(chunk_IEND)));
+
+  unsigned char IDAT_head[8];
+  *(uint32_t *) IDAT_head = htobe32(zlen);
+  memcpy(IDAT_head + 4, "IDAT", 4);
+  uint32_t crc = htobe32(crc32_z(
+    crc32_z(crc32_z(0, Z_NULL, 0), IDAT_head + 4, 4), zdata, zlen));
+
+  return_with_nonzero (PlzjEbml_put_raw(
+    &mkv->cluster, mkv->png_head, sizeof(mkv->png_head)));
+  return_with_nonzero (PlzjEbml_put_raw(
+    &mkv->cluster, IDAT_head, sizeof(IDAT_head)));
+  return_with_nonzero (PlzjEbml_put_raw(&mkv->cluster, zdata, zlen));
+  return_with_nonzero (PlzjEbml_put_raw(&mkv->cluster, &crc, sizeof(crc)));
+  return PlzjEbml_put_raw(&mkv->cluster, chunk_IEND, sizeof(chunk_IEND));
+}
+
+
+static int PlzjMkv_write_seekhead (
+    struct PlzjMkv *mkv, uint64_t cues_position) {
+  const uint32_t ids[] = {MKV_ID_INFO, MKV_ID_TRACKS, MKV_ID_CUES};
+  const uint64_t positions[] = {
+    mkv->info_position, mkv->tracks_position, cues_position};
+
+  struct PlzjEbml ebml = {0};
+  size_t pos;
+  int ret;
+
+  ret = PlzjEbml_begin(&ebml, MKV_ID_SEEKHEAD, &pos);
+  goto_if_fail (ret == 0) fail;
+  for (unsigned int i = 0; i < arraysize(ids); i++) {
+    size_t seek_pos;
+    uint32_t id = htobe32(ids[i]);
+    ret = PlzjEbml_begin(&ebml, MKV_ID_SEEK, &seek_pos);
+    goto_if_fail (ret == 0) fail;
+    ret = PlzjEbml_put_bin(&ebml, MKV_ID_SEEKID, &id, sizeof(id));
+    goto_if_fail (ret == 0) fail;
+    ret = PlzjEbml_put_uint(&ebml, MKV_ID_SEEKPOSITION, positions[i]);
+    goto_if_fail (ret == 0) fail;
+    PlzjEbml_end(&ebml, seek_pos);
+  }
+  PlzjEbml_end(&ebml, pos);
+
+  // fill the rest of the reserved space
+  assert(ebml.len + 2 <= MKV_SEEKHEAD_SIZE);
+  size_t void_len = MKV_SEEKHEAD_SIZE - ebml.len;
+  ret = PlzjEbml_put_header(&ebml, EBML_ID_VOID, void_len - 2);
+  goto_if_fail (ret == 0) fail;
+  ret = PlzjEbml_reserve(&ebml, void_len - 2);
+  goto_if_fail (ret == 0) fail;
+  memset(ebml.data + ebml.len, 0, void_len - 2);
+  ebml.len += void_len - 2;
+
+  if_fail (fseeko(mkv->out, mkv->segment_offset, SEEK_SET) == 0) {
+    ret = ERR_STD(fseeko);
+    goto fail;
+  }
+  if_fail (fwrite(ebml.data, ebml.len, 1, mkv->out) == 1) {
+    ret = ERR_STD(fwrite);
+    goto fail;
+  }
+
+  ret = 0;
+fail:
+  free(ebml.data);
+  return ret;
+}
+
+
+int PlzjMkv_finish (struct PlzjMkv *mkv, uint32_t duration_ms) {
+  return_with_nonzero (PlzjMkv_write_audio(mkv, 0, true));
+  return_with_nonzero (PlzjMkv_flush_cluster(mkv));
+
+  // index
+  uint64_t cues_position = mkv->position;
+  struct PlzjEbml ebml = {0};
+  size_t pos;
+  int ret;
+
+  ret = PlzjEbml_begin(&ebml, MKV_ID_CUES, &pos);
+  goto_if_fail (ret == 0) fail;
+  for (size_t i = 0; i < mkv->cues_cnt; i++) {
+    size_t point_pos;
+    size_t track_pos;
+    ret = PlzjEbml_begin(&ebml, MKV_ID_CUEPOINT, &point_pos);
+    goto_if_fail (ret == 0) fail;
+    ret = PlzjEbml_put_uint(&ebml, MKV_ID_CUETIME, mkv->cues[i].timecode_ms);
+    goto_if_fail (ret == 0) fail;
+    ret = PlzjEbml_begin(&ebml, MKV_ID_CUETRACKPOSITIONS, &track_pos);
+    goto_if_fail (ret == 0) fail;
+    ret = PlzjEbml_put_uint(&ebml, MKV_ID_CUETRACK, MKV_TRACK_VIDEO);
+    goto_if_fail (ret == 0) fail;
+    ret = PlzjEbml_put_uint(
+      &ebml, MKV_ID_CUECLUSTERPOSITION, mkv->cues[i].position);
+    goto_if_fail (ret == 0) fail;
+    PlzjEbml_end(&ebml, track_pos);
+    PlzjEbml_end(&ebml, point_pos);
+  }
+  PlzjEbml_end(&ebml, pos);
+
+  ret = PlzjMkv_write(mkv, ebml.data, ebml.len);
+  goto_if_fail (ret == 0) fail;
+
+  // patch sizes, only possible if output is seekable
+  off_t end_offset = ftello(mkv->out);
+  if (end_offset == -1 || fflush(mkv->out) != 0 ||
+      fseeko(mkv->out, mkv->segment_offset, SEEK_SET) != 0) {
+    sc_info("Matroska output not seekable, leave Segment size unknown\n");
+    ret = 0;
+    goto fail;
+  }
+
+  ret = PlzjMkv_write_seekhead(mkv, cues_position);
+  goto_if_fail (ret == 0) fail;
+
+  double duration = max(duration_ms, mkv->last_timecode_ms);
+  uint64_t duration_be;
+  memcpy(&duration_be, &duration, sizeof(duration_be));
+  duration_be = htobe64(duration_be);
+  uint64_t segment_size = htobe64(
+    UINT64_C(1) << 56 | (end_offset - mkv->segment_offset));
+  if_fail (
+      fseeko(mkv->out, mkv->duration_offset, SEEK_SET) == 0 &&
+      fwrite(&duration_be, sizeof(duration_be), 1, mkv->out) == 1 &&
+      fseeko(mkv->out, mkv->segment_offset - 8, SEEK_SET) == 0 &&
+      fwrite(&segment_size, sizeof(segment_size), 1, mkv->out) == 1 &&
+      fseeko(mkv->out, end_offset, SEEK_SET) == 0) {
+    ret = ERR_STD(fwrite);
+    goto fail;
+  }
+
+  ret = 0;
+fail:
+  free(ebml.data);
+  return ret;
+}
+
+
+void PlzjMkv_destroy (struct PlzjMkv *mkv) {
+  free(mkv->cluster.data);
+  free(mkv->cues);
+  PlzjAudioTrack_destroy(&mkv->audio);
+}
+
+
+static int PlzjMkv_put_tracks (
+    struct PlzjMkv *mkv, struct PlzjEbml *ebml) {
+  size_t pos;
+  size_t entry_pos;
+  size_t sub_pos;
+
+  return_with_nonzero (PlzjEbml_begin(ebml, MKV_ID_TRACKS, &pos));
+
+  // PNG frames in VfW compatibility mode
+  BITMAPINFOHEADER bih = {
+    .biSize = htole32(sizeof(bih)),
+    .biWidth = htole32(mkv->width),
+    .biHeight = htole32(mkv->height),
+    .biPlanes = htole16(1),
+    .biBitCount = htole16(24),
+    .biSizeImage = htole32(3 * mkv->width * mkv->height),
+  };
+  memcpy(&bih.biCompression, "MPNG", 4);
+
+  return_with_nonzero (PlzjEbml_begin(ebml, MKV_ID_TRACKENTRY, &entry_pos));
+  return_with_nonzero (PlzjEbml_put_uint(
+    ebml, MKV_ID_TRACKNUMBER, MKV_TRACK_VIDEO));
+  return_with_nonzero (PlzjEbml_put_uint(
+    ebml, MKV_ID_TRACKUID, MKV_TRACK_VIDEO));
+  return_with_nonzero (PlzjEbml_put_uint(ebml, MKV_ID_TRACKTYPE, 1));
+  return_with_nonzero (PlzjEbml_put_uint(ebml, MKV_ID_FLAGLACING, 0));
+  return_with_nonzero (PlzjEbml_put_str(
+    ebml, MKV_ID_CODECID, "V_MS/VFW/FOURCC"));
+  return_with_nonzero (PlzjEbml_put_bin(
+    ebml, MKV_ID_CODECPRIVATE, &bih, sizeof(bih)));
+  return_with_nonzero (PlzjEbml_begin(ebml, MKV_ID_VIDEO, &sub_pos));
+  return_with_nonzero (PlzjEbml_put_uint(ebml, MKV_ID_PIXELWIDTH, mkv->width));
+  return_with_nonzero (PlzjEbml_put_uint(
+    ebml, MKV_ID_PIXELHEIGHT, mkv->height));
+  PlzjEbml_end(ebml, sub_pos);
+  PlzjEbml_end(ebml, entry_pos);
+
+  if (mkv->has_audio) {
+    const struct PlzjAudioTrack *audio = &mkv->audio;
+
+    return_with_nonzero (PlzjEbml_begin(ebml, MKV_ID_TRACKENTRY, &entry_pos));
+    return_with_nonzero (PlzjEbml_put_uint(
+      ebml, MKV_ID_TRACKNUMBER, MKV_TRACK_AUDIO));
+    return_with_nonzero (PlzjEbml_put_uint(
+      ebml, MKV_ID_TRACKUID, MKV_TRACK_AUDIO));
+    return_with_nonzero (PlzjEbml_put_uint(ebml, MKV_ID_TRACKTYPE, 2));
+    return_with_nonzero (PlzjEbml_put_uint(ebml, MKV_ID_FLAGLACING, 0));
+    return_with_nonzero (PlzjEbml_put_str(
+      ebml, MKV_ID_CODECID, audio->codec_id));
+    if (audio->codec_private_len > 0) {
+      return_with_nonzero (PlzjEbml_put_bin(
+        ebml, MKV_ID_CODECPRIVATE, audio->codec_private,
+        audio->codec_private_len));
+    }
+    return_with_nonzero (PlzjEbml_begin(ebml, MKV_ID_AUDIO, &sub_pos));
+    return_with_nonzero (PlzjEbml_put_float(
+      ebml, MKV_ID_SAMPLINGFREQUENCY, audio->sampling_freq));
+    return_with_nonzero (PlzjEbml_put_uint(
+      ebml, MKV_ID_CHANNELS, audio->channels));
+    if (audio->bit_depth > 0) {
+      return_with_nonzero (PlzjEbml_put_uint(
+        ebml, MKV_ID_BITDEPTH, audio->bit_depth));
+    }
+    PlzjEbml_end(ebml, sub_pos);
+    PlzjEbml_end(ebml, entry_pos);
+  }
+
+  PlzjEbml_end(ebml, pos);
+  return 0;
+}
+
+
+static int PlzjMkv_put_head (
+    struct PlzjMkv *mkv, struct PlzjEbml *ebml, const struct Plzj *pl) {
+  size_t pos;
+
+  return_with_nonzero (PlzjEbml_begin(ebml, EBML_ID_EBML, &pos));
+  return_with_nonzero (PlzjEbml_put_uint(ebml, EBML_ID_EBMLVERSION, 1));
+  return_with_nonzero (PlzjEbml_put_uint(ebml, EBML_ID_EBMLREADVERSION, 1));
+  return_with_nonzero (PlzjEbml_put_uint(ebml, EBML_ID_EBMLMAXIDLENGTH, 4));
+  return_with_nonzero (PlzjEbml_put_uint(ebml, EBML_ID_EBMLMAXSIZELENGTH, 8));
+  return_with_nonzero (PlzjEbml_put_str(ebml, EBML_ID_DOCTYPE, "matroska"));
+  return_with_nonzero (PlzjEbml_put_uint(ebml, EBML_ID_DOCTYPEVERSION, 4));
+  return_with_nonzero (PlzjEbml_put_uint(
+    ebml, EBML_ID_DOCTYPEREADVERSION, 2));
+  PlzjEbml_end(ebml, pos);
+
+  // Segment of unknown size, patched in PlzjMkv_finish()
+  return_with_nonzero (PlzjEbml_begin(ebml, MKV_ID_SEGMENT, &pos));
+  ebml->data[pos - 8] = 0x01;
+  memset(ebml->data + pos - 7, 0xff, 7);
+  size_t segment_pos = pos;
+
+  // placeholder for SeekHead
+  return_with_nonzero (PlzjEbml_put_header(
+    ebml, EBML_ID_VOID, MKV_SEEKHEAD_SIZE - 2));
+  return_with_nonzero (PlzjEbml_reserve(ebml, MKV_SEEKHEAD_SIZE - 2));
+  memset(ebml->data + ebml->len, 0, MKV_SEEKHEAD_SIZE - 2);
+  ebml->len += MKV_SEEKHEAD_SIZE - 2;
+
+  mkv->info_position = ebml->len - segment_pos;
+  return_with_nonzero (PlzjEbml_begin(ebml, MKV_ID_INFO, &pos));
+  return_with_nonzero (PlzjEbml_put_uint(
+    ebml, MKV_ID_TIMESTAMPSCALE, 1000000));
+  return_with_nonzero (PlzjEbml_put_str(ebml, MKV_ID_MUXINGAPP, "plzj"));
+  return_with_nonzero (PlzjEbml_put_str(ebml, MKV_ID_WRITINGAPP, "plzj"));
+  char title[2 * 64];
+  if (Plzj_get_title(pl, title, sizeof(title)) > 0) {
+    return_with_nonzero (PlzjEbml_put_str(ebml, MKV_ID_TITLE, title));
+  }
+  return_with_nonzero (PlzjEbml_put_float(ebml, MKV_ID_DURATION, 0));
+  size_t duration_pos = ebml->len - 8;
+  PlzjEbml_end(ebml, pos);
+
+  mkv->tracks_position = ebml->len - segment_pos;
+  return_with_nonzero (PlzjMkv_put_tracks(mkv, ebml));
+
+  off_t offset = ftello(mkv->out);
+  if (offset == -1) {
+    offset = 0;
+  }
+  mkv->segment_offset = offset + segment_pos;
+  mkv->duration_offset = offset + duration_pos;
+  mkv->position = ebml->len - segment_pos;
+  return 0;
+}
+
+
+/**
+ * @brief Start Matroska output.
+ *
+ * @param with_audio Mux audio of `pl`. Failing to do so is not an error, check
+ *   PlzjMkv::has_audio.
+ */
+int PlzjMkv_init (
+    struct PlzjMkv *mkv, FILE *out, uint32_t width, uint32_t height,
+    const struct Plzj *pl, bool with_audio) {
+  *mkv = (struct PlzjMkv) {.out = out, .width = width, .height = height};
+
+  // standalone PNG header, without tRNS, so frames can be decoded on their own
+  memcpy(mkv->png_head, "\x89PNG\r\n\x1a\n", 8);
+  unsigned char *IHDR = mkv->png_head + 8;
+  *(uint32_t *) IHDR = htobe32(13);
+  memcpy(IHDR + 4, "IHDR", 4);
+  *(uint32_t *) (IHDR + 8) = htobe32(width);
+  *(uint32_t *) (IHDR + 12) = htobe32(height);
+  // bit depth 8, RGB, deflate, adaptive filtering, no interlace
+  memcpy(IHDR + 16, "\x08\x02\0\0\0", 5);
+  *(uint32_t *) (IHDR + 21) = htobe32(plzj_crc32(IHDR + 4, 4 + 13));
+
+  int res = with_audio ? PlzjAudioTrack_init(&mkv->audio, pl) : 1;
+  if (res == 0) {
+    mkv->has_audio = true;
+  } else if (res < 0) {
+    mkv->audio = (struct PlzjAudioTrack) {0};
+    sc_warning("Cannot mux audio into Matroska, skipped\n");
+  }
+
+  struct PlzjEbml ebml = {0};
+  int ret = PlzjMkv_put_head(mkv, &ebml, pl);
+  if (ret == 0) {
+    if_fail (fwrite(ebml.data, ebml.len, 1, out) == 1) {
+      ret = ERR_STD(fwrite);
+    }
+  }
+  free(ebml.data);
+  if_fail (ret == 0) {
+    PlzjMkv_destroy(mkv);
+  }
+  return ret;
+}
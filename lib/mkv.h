@@ -0,0 +1,85 @@
+#ifndef MKV_H
+#define MKV_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "include/defs.h"
+#include "audio.h"
+
+struct Plzj;
+
+/** @file */
+
+
+struct PlzjEbml {
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+};
+
+
+struct PlzjMkvCue {
+  uint64_t timecode_ms;
+  uint64_t position;
+};
+
+
+/// Minimal Matroska muxer, PNG video track and optional audio track
+struct PlzjMkv {
+  FILE *out;
+  uint32_t width;
+  uint32_t height;
+
+  /// PNG signature and IHDR chunk
+  unsigned char png_head[8 + 25];
+
+  /// offset of Segment data
+  off_t segment_offset;
+  /// bytes written after the beginning of Segment data
+  uint64_t position;
+  /// positions of top-level elements, relative to Segment data
+  uint64_t info_position;
+  uint64_t tracks_position;
+  /// offset of the Duration value in Info
+  off_t duration_offset;
+
+  /// current Cluster, buffered in memory
+  struct PlzjEbml cluster;
+  uint64_t cluster_timecode_ms;
+  uint64_t last_timecode_ms;
+
+  struct PlzjMkvCue *cues;
+  size_t cues_cnt;
+
+  bool has_audio;
+  /// `PlzjMkv::audio` has a packet not yet written
+  bool audio_pending;
+  struct PlzjAudioTrack audio;
+};
+
+__THROW __nonnull()
+int PlzjMkv_write_png (
+  struct PlzjMkv *mkv, const void *zdata, size_t zlen, uint32_t timecode_ms);
+__THROW __nonnull()
+int PlzjMkv_finish (struct PlzjMkv *mkv, uint32_t duration_ms);
+__THROW __nonnull()
+void PlzjMkv_destroy (struct PlzjMkv *mkv);
+__THROW __nonnull() __attr_access((__write_only__, 1))
+__attr_access((__read_only__, 5))
+int PlzjMkv_init (
+  struct PlzjMkv *mkv, FILE *out, uint32_t width, uint32_t height,
+  const struct Plzj *pl, bool with_audio);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MKV_H */
@@ -0,0 +1,283 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#  include <malloc.h>
+#endif
+
+#include "platform/pio.h"
+
+#include "outbuf.h"
+#include "macro.h"
+#include "log.h"
+#include "threadname.h"
+
+
+static void *plzj_aligned_alloc (size_t alignment, size_t size) {
+#ifdef _WIN32
+  return _aligned_malloc(size, alignment);
+#else
+  return aligned_alloc(alignment, size);
+#endif
+}
+
+
+static void plzj_aligned_free (void *ptr) {
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+
+static int PlzjOutBuf_write_out (
+    struct PlzjOutBuf *ob, const void *buf, size_t len, off_t offset) {
+  if (ob->seekable) {
+    return_if_fail (pwrite_full(ob->fd, buf, len, offset) == 0)
+      ERR_STD(pwrite_full);
+  } else {
+    return_if_fail (fwrite(buf, len, 1, ob->file) == 1) ERR_STD(fwrite);
+  }
+  return 0;
+}
+
+
+#ifndef NO_THREADS
+static int PlzjOutBuf_writer (void *arg) {
+  struct PlzjOutBuf *ob = arg;
+
+  threadname_append(" (output)");
+
+  mtx_lock(&ob->mutex);
+  while (true) {
+    while (ob->pending_i < 0 && !ob->stop) {
+      cnd_wait(&ob->cond, &ob->mutex);
+    }
+    break_if_fail (ob->pending_i >= 0);
+
+    const void *buf = ob->bufs[ob->pending_i];
+    size_t len = ob->pending_len;
+    off_t offset = ob->pending_offset;
+    mtx_unlock(&ob->mutex);
+
+    // stop writing after the first error, the output is broken anyway
+    if (ob->ret == 0) {
+      int res = PlzjOutBuf_write_out(ob, buf, len, offset);
+      if_fail (res == 0) {
+        ob->exc = sc_exc;
+        ob->ret = res;
+      }
+    }
+
+    mtx_lock(&ob->mutex);
+    ob->pending_i = -1;
+    cnd_signal(&ob->cond);
+  }
+  mtx_unlock(&ob->mutex);
+  return 0;
+}
+#endif
+
+
+/**
+ * @brief Wait until the writer has written the buffer handed over.
+ *
+ * @return Error of the writer, if any.
+ */
+static int PlzjOutBuf_wait (struct PlzjOutBuf *ob) {
+#ifndef NO_THREADS
+  return_if_fail (mtx_lock(&ob->mutex) == thrd_success) ERR_STD(mtx_lock);
+  while (ob->pending_i >= 0) {
+    cnd_wait(&ob->cond, &ob->mutex);
+  }
+  mtx_unlock(&ob->mutex);
+#endif
+
+  if_fail (ob->ret == 0) {
+    sc_exc = ob->exc;
+  }
+  return ob->ret;
+}
+
+
+/**
+ * @brief Hand the buffer being filled over to the writer, and continue with
+ *   the other one.
+ */
+static int PlzjOutBuf_submit (struct PlzjOutBuf *ob) {
+  return_with_nonzero (PlzjOutBuf_wait(ob));
+  return_if_fail (ob->buf_len > 0) 0;
+
+#ifndef NO_THREADS
+  return_if_fail (mtx_lock(&ob->mutex) == thrd_success) ERR_STD(mtx_lock);
+  ob->pending_i = ob->buf_i;
+  ob->pending_len = ob->buf_len;
+  ob->pending_offset = ob->buf_offset;
+  cnd_signal(&ob->cond);
+  mtx_unlock(&ob->mutex);
+  ob->buf_i ^= 1;
+#else
+  int ret = PlzjOutBuf_write_out(
+    ob, ob->bufs[ob->buf_i], ob->buf_len, ob->buf_offset);
+  if_fail (ret == 0) {
+    ob->exc = sc_exc;
+    ob->ret = ret;
+    return ret;
+  }
+#endif
+
+  ob->buf_offset += ob->buf_len;
+  ob->buf_len = 0;
+  return 0;
+}
+
+
+/**
+ * @brief Append data to the output.
+ */
+int PlzjOutBuf_write (struct PlzjOutBuf *ob, const void *data, size_t size) {
+  while (size > 0) {
+    if (ob->buf_len >= PLZJ_OUTBUF_SIZE) {
+      return_with_nonzero (PlzjOutBuf_submit(ob));
+    }
+
+    size_t len = min(size, PLZJ_OUTBUF_SIZE - ob->buf_len);
+    memcpy(ob->bufs[ob->buf_i] + ob->buf_len, data, len);
+    ob->buf_len += len;
+    ob->offset += len;
+    data = (const unsigned char *) data + len;
+    size -= len;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Overwrite data already appended, at `offset` of the file.
+ *
+ * Data still in the buffer is patched in memory, data already handed over is
+ * written to the file after the writer is done with it.
+ */
+int PlzjOutBuf_pwrite (
+    struct PlzjOutBuf *ob, const void *data, size_t size, off_t offset) {
+  return_if_fail (ob->seekable) ERR(PL_EINVAL);
+  return_if_fail (offset >= 0 && offset + (off_t) size <= ob->offset)
+    ERR(PL_EINVAL);
+
+  if (offset < ob->buf_offset) {
+    size_t len = min(size, (size_t) (ob->buf_offset - offset));
+    return_with_nonzero (PlzjOutBuf_wait(ob));
+    return_if_fail (pwrite_full(ob->fd, data, len, offset) == 0)
+      ERR_STD(pwrite_full);
+    data = (const unsigned char *) data + len;
+    size -= len;
+    offset += len;
+  }
+
+  if (size > 0) {
+    memcpy(ob->bufs[ob->buf_i] + (offset - ob->buf_offset), data, size);
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Write out all appended data, and move the file position to the end
+ *   of it.
+ */
+int PlzjOutBuf_flush (struct PlzjOutBuf *ob) {
+  return_with_nonzero (PlzjOutBuf_submit(ob));
+  return_with_nonzero (PlzjOutBuf_wait(ob));
+
+  if (ob->seekable) {
+    return_if_fail (fseeko(ob->file, ob->offset, SEEK_SET) == 0)
+      ERR_STD(fseeko);
+  } else {
+    return_if_fail (fflush(ob->file) == 0) ERR_STD(fflush);
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Stop the writer. Data not flushed is discarded.
+ */
+void PlzjOutBuf_destroy (struct PlzjOutBuf *ob) {
+#ifndef NO_THREADS
+  mtx_lock(&ob->mutex);
+  ob->stop = true;
+  cnd_signal(&ob->cond);
+  mtx_unlock(&ob->mutex);
+  thrd_join(ob->thr, NULL);
+
+  cnd_destroy(&ob->cond);
+  mtx_destroy(&ob->mutex);
+#endif
+
+  plzj_aligned_free(ob->bufs[0]);
+  plzj_aligned_free(ob->bufs[1]);
+}
+
+
+/**
+ * @brief Start buffered output at the current position of `file`.
+ *
+ * `file` must not be used until PlzjOutBuf_flush() is called.
+ */
+int PlzjOutBuf_init (struct PlzjOutBuf *ob, FILE *file) {
+  return_if_fail (fflush(file) == 0) ERR_STD(fflush);
+  ob->fd = fileno(file);
+  return_if_fail (ob->fd >= 0) ERR_STD(fileno);
+  ob->file = file;
+
+  // pipes and sockets are written sequentially through `file`
+  ob->offset = ftello(file);
+  ob->seekable = ob->offset != -1;
+  if (!ob->seekable) {
+    ob->offset = 0;
+  }
+
+  ob->bufs[0] = plzj_aligned_alloc(PLZJ_OUTBUF_ALIGN, PLZJ_OUTBUF_SIZE);
+  ob->bufs[1] = plzj_aligned_alloc(PLZJ_OUTBUF_ALIGN, PLZJ_OUTBUF_SIZE);
+  int ret;
+  if_fail (ob->bufs[0] != NULL && ob->bufs[1] != NULL) {
+    ret = ERR_STD(aligned_alloc);
+    goto fail;
+  }
+  ob->buf_i = 0;
+  ob->buf_len = 0;
+  ob->buf_offset = ob->offset;
+  ob->ret = 0;
+
+#ifndef NO_THREADS
+  ob->pending_i = -1;
+  ob->stop = false;
+  if_fail (mtx_init(&ob->mutex, mtx_plain) == thrd_success) {
+    ret = ERR_STD(mtx_init);
+    goto fail;
+  }
+  if_fail (cnd_init(&ob->cond) == thrd_success) {
+    ret = ERR_STD(cnd_init);
+    goto fail_cond;
+  }
+  if_fail (thrd_create(&ob->thr, PlzjOutBuf_writer, ob) == thrd_success) {
+    ret = ERR_STD(thrd_create);
+    goto fail_thr;
+  }
+#endif
+  return 0;
+
+#ifndef NO_THREADS
+fail_thr:
+  cnd_destroy(&ob->cond);
+fail_cond:
+  mtx_destroy(&ob->mutex);
+#endif
+fail:
+  plzj_aligned_free(ob->bufs[0]);
+  plzj_aligned_free(ob->bufs[1]);
+  return ret;
+}
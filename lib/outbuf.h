@@ -0,0 +1,86 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#ifndef NO_THREADS
+#  include "platform/c11threads.h"
+#endif
+
+#include "include/defs.h"
+#include "log.h"
+
+/** @file */
+
+
+/// size of each output buffer
+#define PLZJ_OUTBUF_SIZE (4 * 1024 * 1024)
+/// alignment of output buffers
+#define PLZJ_OUTBUF_ALIGN 4096
+
+
+/// Output file written in large chunks by a background thread
+struct PlzjOutBuf {
+  FILE *file;
+  int fd;
+  /// write at file offsets, otherwise append to `file`
+  bool seekable;
+  /// offset of the next byte to append
+  off_t offset;
+
+  /// buffer being filled, the other one may be written by the writer
+  unsigned char *bufs[2];
+  unsigned int buf_i;
+  size_t buf_len;
+  /// file offset of the buffer being filled
+  off_t buf_offset;
+
+#ifndef NO_THREADS
+  mtx_t mutex;
+  cnd_t cond;
+  thrd_t thr;
+  /// buffer handed to the writer, -1 if none
+  int pending_i;
+  size_t pending_len;
+  off_t pending_offset;
+  bool stop;
+#endif
+
+  /// first error of writing
+  int ret;
+  struct ScException exc;
+};
+
+__THROW __nonnull() __attr_access((__read_only__, 2, 3))
+int PlzjOutBuf_write (struct PlzjOutBuf *ob, const void *data, size_t size);
+__THROW __nonnull() __attr_access((__read_only__, 2, 3))
+int PlzjOutBuf_pwrite (
+  struct PlzjOutBuf *ob, const void *data, size_t size, off_t offset);
+__THROW __nonnull()
+int PlzjOutBuf_flush (struct PlzjOutBuf *ob);
+__THROW __nonnull()
+void PlzjOutBuf_destroy (struct PlzjOutBuf *ob);
+__THROW __nonnull() __attr_access((__write_only__, 1))
+int PlzjOutBuf_init (struct PlzjOutBuf *ob, FILE *file);
+
+/**
+ * @brief Get the offset of the next byte to append.
+ */
+__attribute_artificial__ __attribute_warn_unused_result__
+static inline off_t PlzjOutBuf_tell (const struct PlzjOutBuf *ob) {
+  return ob->offset;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OUTBUF_H */
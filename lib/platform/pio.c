@@ -0,0 +1,132 @@
+#include <errno.h>
+
+#include "pio.h"
+
+#ifdef _WIN32
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <io.h>
+#include <windows.h>
+
+
+static int pio_win32 (
+    int fd, void *buf, size_t size, off_t offset, bool write) {
+  HANDLE handle = (HANDLE) _get_osfhandle(fd);
+  if (handle == INVALID_HANDLE_VALUE) {
+    errno = EBADF;
+    return -1;
+  }
+
+  while (size > 0) {
+    DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD) size;
+    OVERLAPPED ov = {0};
+    ov.Offset = (DWORD) offset;
+    ov.OffsetHigh = (DWORD) ((uint64_t) offset >> 32);
+
+    DWORD done;
+    BOOL ok = write ?
+      WriteFile(handle, buf, chunk, &done, &ov) :
+      ReadFile(handle, buf, chunk, &done, &ov);
+    if (!ok || done == 0) {
+      errno = EIO;
+      return -1;
+    }
+
+    buf = (unsigned char *) buf + done;
+    size -= done;
+    offset += done;
+  }
+  return 0;
+}
+
+
+int pread_full (int fd, void *buf, size_t size, off_t offset) {
+  return pio_win32(fd, buf, size, offset, false);
+}
+
+
+int pwrite_full (int fd, const void *buf, size_t size, off_t offset) {
+  return pio_win32(fd, (void *) buf, size, offset, true);
+}
+
+
+int truncate_fd (int fd, off_t size) {
+  errno_t err = _chsize_s(fd, size);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+
+int sync_fd (int fd) {
+  return _commit(fd);
+}
+
+#else
+
+#include <unistd.h>
+
+
+int pread_full (int fd, void *buf, size_t size, off_t offset) {
+  while (size > 0) {
+    ssize_t done = pread(fd, buf, size, offset);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (done == 0) {
+      errno = EIO;
+      return -1;
+    }
+
+    buf = (unsigned char *) buf + done;
+    size -= done;
+    offset += done;
+  }
+  return 0;
+}
+
+
+int pwrite_full (int fd, const void *buf, size_t size, off_t offset) {
+  while (size > 0) {
+    ssize_t done = pwrite(fd, buf, size, offset);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    buf = (const unsigned char *) buf + done;
+    size -= done;
+    offset += done;
+  }
+  return 0;
+}
+
+
+int truncate_fd (int fd, off_t size) {
+  while (ftruncate(fd, size) != 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+int sync_fd (int fd) {
+  while (fsync(fd) != 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+#endif
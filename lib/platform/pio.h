@@ -0,0 +1,54 @@
+#ifndef PLATFORM_PIO_H
+#define PLATFORM_PIO_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "../include/defs.h"
+
+
+/**
+ * @brief Read exactly `size` bytes at `offset`.
+ *
+ * The file position is left alone on POSIX, but moved on Windows, so seek any
+ * stream on `fd` before using it again.
+ *
+ * @return 0 on success, -1 with `errno` set on error or short read.
+ */
+__attribute_warn_unused_result__ __THROW __attr_access((__write_only__, 2, 3))
+int pread_full (int fd, void *buf, size_t size, off_t offset);
+/**
+ * @brief Write exactly `size` bytes at `offset`.
+ *
+ * The file position is left alone on POSIX, but moved on Windows, so seek any
+ * stream on `fd` before using it again.
+ *
+ * @return 0 on success, -1 with `errno` set on error.
+ */
+__attribute_warn_unused_result__ __THROW __attr_access((__read_only__, 2, 3))
+int pwrite_full (int fd, const void *buf, size_t size, off_t offset);
+/**
+ * @brief Truncate or extend file to `size` bytes.
+ *
+ * @return 0 on success, -1 with `errno` set on error.
+ */
+__attribute_warn_unused_result__ __THROW
+int truncate_fd (int fd, off_t size);
+/**
+ * @brief Flush data written to `fd` to the storage device.
+ *
+ * @return 0 on success, -1 with `errno` set on error.
+ */
+__attribute_warn_unused_result__ __THROW
+int sync_fd (int fd);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PLATFORM_PIO_H */
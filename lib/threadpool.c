@@ -30,6 +30,20 @@ int ThreadPool_run (void *ctx, ThreadPool_func_t func, void *arg) {
 }
 
 
+unsigned long ThreadPool_done (struct ThreadPool *_pool) {
+  (void) _pool;
+  return 0;
+}
+
+
+int ThreadPool_wait (struct ThreadPool *_pool, unsigned long done) {
+  // tasks finish before ThreadPool_run() returns
+  (void) _pool;
+  (void) done;
+  return 0;
+}
+
+
 int ThreadPool_stop (
     struct ThreadPool *_pool, const struct ScException **excp) {
   return ThreadPool_get_err(_pool, excp);
@@ -89,6 +103,10 @@ struct _ThreadPool {
   mtx_t mutex;
   cnd_t producer_cond;
   cnd_t consumer_cond;
+  /// signaled when a task finishes
+  cnd_t done_cond;
+  /// number of finished tasks
+  unsigned long done;
 
   ThreadPool_func_t func;
   void *arg;
@@ -165,6 +183,11 @@ static int ThreadPool_worker (void *arg) {
         worker->exc = sc_exc;
         pool->err_i = worker->id;
       }
+
+      mtx_lock(&pool->mutex);
+      pool->done++;
+      mtx_unlock(&pool->mutex);
+      cnd_broadcast(&pool->done_cond);
     }
   }
 
@@ -212,6 +235,38 @@ int ThreadPool_run (void *ctx, ThreadPool_func_t func, void *arg) {
 }
 
 
+/**
+ * @brief Get the number of finished tasks, to be passed to ThreadPool_wait().
+ */
+unsigned long ThreadPool_done (struct ThreadPool *_pool) {
+  struct _ThreadPool *pool = (struct _ThreadPool *) _pool;
+
+  mtx_lock(&pool->mutex);
+  unsigned long done = pool->done;
+  mtx_unlock(&pool->mutex);
+  return done;
+}
+
+
+/**
+ * @brief Wait until more than `done` tasks have finished.
+ */
+int ThreadPool_wait (struct ThreadPool *_pool, unsigned long done) {
+  struct _ThreadPool *pool = (struct _ThreadPool *) _pool;
+
+  return_if_fail (mtx_lock(&pool->mutex) == thrd_success) ERR_STD(mtx_lock);
+  int ret = 0;
+  while (pool->done == done && pool->state >= 0) {
+    if_fail (cnd_wait(&pool->done_cond, &pool->mutex) == thrd_success) {
+      ret = ERR_STD(cnd_wait);
+      break;
+    }
+  }
+  mtx_unlock(&pool->mutex);
+  return ret;
+}
+
+
 int ThreadPool_stop (
     struct ThreadPool *_pool, const struct ScException **excp) {
   struct _ThreadPool *pool = (struct _ThreadPool *) _pool;
@@ -253,6 +308,7 @@ void ThreadPool_destroy (struct ThreadPool *_pool) {
   }
 
   free(pool->workers);
+  cnd_destroy(&pool->done_cond);
   cnd_destroy(&pool->consumer_cond);
   cnd_destroy(&pool->producer_cond);
   mtx_destroy(&pool->mutex);
@@ -280,6 +336,10 @@ int ThreadPool_init (
     ret = ERR_STD(cnd_init);
     goto fail_consumer_cond;
   }
+  if_fail (cnd_init(&pool->done_cond) == thrd_success) {
+    ret = ERR_STD(cnd_init);
+    goto fail_done_cond;
+  }
   pool->workers = calloc(nproc, sizeof(pool->workers[0]));
   if_fail (pool->workers != NULL) {
     ret = ERR_STD(calloc);
@@ -295,6 +355,7 @@ int ThreadPool_init (
     pool->name[sizeof(pool->name) - 1] = '\0';
   }
   pool->state = 0;
+  pool->done = 0;
 #pragma GCC diagnostic pop
 
   unsigned int i;
@@ -320,6 +381,8 @@ int ThreadPool_init (
 fail:
   free(pool->workers);
 fail_workers:
+  cnd_destroy(&pool->done_cond);
+fail_done_cond:
   cnd_destroy(&pool->consumer_cond);
 fail_consumer_cond:
   cnd_destroy(&pool->producer_cond);
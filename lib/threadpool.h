@@ -12,7 +12,7 @@ struct ScException;
 
 struct ThreadPool {
   union {
-    char __size[192];
+    char __size[256];
     long long __align;
   };
 };
@@ -26,6 +26,10 @@ int ThreadPool_get_err (
 
 __THROW __nonnull((1, 2))
 int ThreadPool_run (void *ctx, ThreadPool_func_t func, void *arg);
+__attribute_warn_unused_result__ __THROW __nonnull()
+unsigned long ThreadPool_done (struct ThreadPool *pool);
+__THROW __nonnull()
+int ThreadPool_wait (struct ThreadPool *pool, unsigned long done);
 __THROW __nonnull((1)) __attr_access((__write_only__, 2))
 int ThreadPool_stop (struct ThreadPool *pool, const struct ScException **excp);
 __THROW __nonnull()
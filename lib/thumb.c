@@ -0,0 +1,524 @@
+#include <inttypes.h>
+#include <png.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/platform/endian.h"
+
+#include "platform/nowide.h"
+
+#include "include/iter.h"
+#include "include/parser.h"
+#include "include/video.h"
+#include "macro.h"
+#include "image.h"
+#include "log.h"
+#include "utils.h"
+
+
+#define PLZJ_THUMB_GAP 4
+#define PLZJ_THUMB_BACKGROUND 0x20
+
+
+struct PlzjKeyframe {
+  int32_t frame_no;
+  /// offset of the first packet, relative to the video header
+  off_t offset;
+};
+
+
+/**
+ * @brief Parse keyframes txt, one `<frame> <offset>` pair per line.
+ *
+ * Malformed lines are skipped.
+ */
+static int Plzj_read_keyframes (
+    const struct Plzj *pl, struct PlzjKeyframe **keyframesp, size_t *cntp) {
+  char *txt = malloc(pl->keyframes_size + 1);
+  return_if_fail (txt != NULL) ERR_STD(malloc);
+
+  int ret;
+
+  if_fail (fseeko(pl->file, pl->keyframes_offset, SEEK_SET) == 0) {
+    ret = ERR_STD(fseeko);
+    goto fail_txt;
+  }
+  if_fail (pl->keyframes_size == 0 ||
+           fread(txt, pl->keyframes_size, 1, pl->file) == 1) {
+    ret = ERR_STD(fread);
+    goto fail_txt;
+  }
+  txt[pl->keyframes_size] = '\0';
+
+  // every entry takes at least 4 characters
+  size_t cap = pl->keyframes_size / 4 + 1;
+  struct PlzjKeyframe *keyframes = malloc(sizeof(*keyframes) * cap);
+  if_fail (keyframes != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail_txt;
+  }
+
+  size_t cnt = 0;
+  for (char *line = txt; *line != '\0' && cnt < cap; ) {
+    char *end;
+    long frame_no = strtol(line, &end, 10);
+    bool valid = end != line;
+    line = end;
+    long long offset = strtoll(line, &end, 10);
+    valid = valid && end != line;
+    line = end + strcspn(end, "\n");
+    if (*line != '\0') {
+      line++;
+    }
+
+    if (valid && frame_no >= 0 && frame_no <= INT32_MAX && offset > 0) {
+      keyframes[cnt].frame_no = frame_no;
+      keyframes[cnt].offset = offset;
+      cnt++;
+    }
+  }
+
+  free(txt);
+  *keyframesp = keyframes;
+  *cntp = cnt;
+  return 0;
+
+fail_txt:
+  free(txt);
+  return ret;
+}
+
+
+/**
+ * @brief Decode the full-frame image of a keyframe, skipping cursors and
+ *   patches of other regions.
+ *
+ * @param[out] canvas Canvas of the video size.
+ * @return 0 if decoded, 1 if the keyframe has no full-frame image.
+ */
+static int Plzj_read_keyframe (
+    const struct Plzj *pl, const struct PlzjKeyframe *keyframe,
+    struct PlzjCanvas *canvas) {
+  struct PlzjLxePacketIter iter;
+  PlzjLxePacketIter_init(&iter, pl, -1);
+  return_if_fail (keyframe->frame_no < iter.frames_cnt) 1;
+
+  // frame 0 has its own header layout, walk it from the stream header
+  if (keyframe->frame_no > 0) {
+    off_t offset = pl->video_offset + keyframe->offset;
+    return_if_fail (offset >= iter.end_offset && offset < pl->end_offset) 1;
+    iter.end_offset = offset;
+    iter.frame_no = keyframe->frame_no;
+    iter.frame_packet_no = 0;
+  }
+
+  const void *key = pl->key_set <= 0 ? NULL : pl->key;
+  unsigned int video_type = le32toh(pl->player.video_type);
+  // frame header is expected only before the packets of frame 0
+  bool frame_head = keyframe->frame_no == 0;
+
+  while (true) {
+    int state = PlzjLxePacketIter_next(&iter);
+    return_if_fail (state >= 0) state;
+
+    if (state == PlzjLxePacketIter_NEXT_FRAME) {
+      // otherwise the offset is wrong, or the frame has ended
+      return_if_fail (frame_head) 1;
+      frame_head = false;
+      continue;
+    }
+    if (state != PlzjLxePacketIter_NEXT_IMAGE) {
+      continue;
+    }
+
+    struct PlzjImage image;
+    PlzjImage_init(&image, &iter.packet.image);
+    if (image.rect.p1.x != 0 || image.rect.p1.y != 0 ||
+        image.rect.p2.x != (int32_t) canvas->width ||
+        image.rect.p2.y != (int32_t) canvas->height) {
+      continue;
+    }
+
+    image.seg.offset = iter.offset;
+    return_with_nonzero (
+      PlzjImage_read(&image, pl->file, video_type, key, true));
+    int ret = PlzjImage_apply(&image, canvas);
+    PlzjImage_destroy(&image);
+    return ret;
+  }
+}
+
+
+/**
+ * @brief Pack pixels of `canvas` into RGB.
+ */
+static void PlzjCanvas_pack_rgb (
+    const struct PlzjCanvas *canvas, unsigned char *dst) {
+  size_t size = (size_t) canvas->width * canvas->height;
+  for (size_t i = 0; i < size; i++) {
+    dst[3 * i] = canvas->pixels[i].r;
+    dst[3 * i + 1] = canvas->pixels[i].g;
+    dst[3 * i + 2] = canvas->pixels[i].b;
+  }
+}
+
+
+/// PNG file of packed RGB, written row by row
+struct PlzjThumbPng {
+  FILE *out;
+  png_structp png_ptr;
+  png_infop info_ptr;
+};
+
+
+static int PlzjThumbPng_end (struct PlzjThumbPng *png) {
+  int res = setjmp(png_jmpbuf(png->png_ptr));
+  return_if_fail (res == 0) ERR_PNG(png_jmpbuf);
+
+  png_write_end(png->png_ptr, png->info_ptr);
+  return 0;
+}
+
+
+/**
+ * @brief Finish writing the PNG, or discard it if `ret` is not 0.
+ */
+static int PlzjThumbPng_close (
+    struct PlzjThumbPng *png, int ret, const char *path) {
+  if (ret == 0) {
+    ret = PlzjThumbPng_end(png);
+  }
+  png_destroy_write_struct(&png->png_ptr, &png->info_ptr);
+  if_fail (fclose(png->out) == 0 || ret != 0) {
+    ret = ERR_STD(fclose);
+  }
+  if (ret != 0) {
+    mremove(path);
+  }
+  return ret;
+}
+
+
+/**
+ * @brief Write `rows` rows of packed RGB.
+ */
+static int PlzjThumbPng_write_rows (
+    struct PlzjThumbPng *png, const unsigned char *rgb, uint32_t width,
+    size_t rows) {
+  int res = setjmp(png_jmpbuf(png->png_ptr));
+  return_if_fail (res == 0) ERR_PNG(png_jmpbuf);
+
+  for (size_t y = 0; y < rows; y++) {
+    png_write_row(png->png_ptr, rgb + (size_t) 3 * width * y);
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Create a PNG file and write its header.
+ */
+static int PlzjThumbPng_open (
+    struct PlzjThumbPng *png, const char *path, uint32_t width,
+    uint32_t height) {
+  png->out = mfopen(path, "wb");
+  return_if_fail (png->out != NULL) ERR_STD(mfopen);
+
+  int ret;
+
+  png->info_ptr = NULL;
+  png->png_ptr = png_create_write_struct(
+    PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if_fail (png->png_ptr != NULL) {
+    ret = ERR_PNG(png_create_write_struct);
+    goto fail_png_ptr;
+  }
+  png->info_ptr = png_create_info_struct(png->png_ptr);
+  if_fail (png->info_ptr != NULL) {
+    ret = ERR_PNG(png_create_info_struct);
+    goto fail;
+  }
+
+  int res = setjmp(png_jmpbuf(png->png_ptr));
+  if_fail (res == 0) {
+    ret = ERR_PNG(png_jmpbuf);
+    goto fail;
+  }
+
+  png_init_io(png->png_ptr, png->out);
+  png_set_IHDR(
+    png->png_ptr, png->info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB,
+    PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png->png_ptr, png->info_ptr);
+  return 0;
+
+fail:
+  png_destroy_write_struct(&png->png_ptr, &png->info_ptr);
+fail_png_ptr:
+  fclose(png->out);
+  mremove(path);
+  return ret;
+}
+
+
+/**
+ * @brief Write packed RGB as a PNG file.
+ */
+static int plzj_thumb_save_png (
+    const char *path, const unsigned char *rgb, uint32_t width,
+    uint32_t height) {
+  struct PlzjThumbPng png;
+  return_with_nonzero (PlzjThumbPng_open(&png, path, width, height));
+  int ret = PlzjThumbPng_write_rows(&png, rgb, width, height);
+  return PlzjThumbPng_close(&png, ret, path);
+}
+
+
+/// Contact sheet, written one row of thumbnails at a time
+struct PlzjThumbSheet {
+  struct PlzjThumbPng png;
+  uint32_t thumb_w;
+  uint32_t thumb_h;
+  size_t cols;
+  size_t rows;
+  /// width of the sheet
+  uint32_t width;
+  /// row of thumbnails being filled, with the gap above it
+  unsigned char *band;
+  /// index of the row in `band`
+  size_t row_i;
+};
+
+
+/**
+ * @brief Write the band and clear it for the next row of thumbnails.
+ */
+static int PlzjThumbSheet_flush (struct PlzjThumbSheet *sheet) {
+  size_t band_rows = PLZJ_THUMB_GAP + sheet->thumb_h;
+  return_with_nonzero (PlzjThumbPng_write_rows(
+    &sheet->png, sheet->band, sheet->width, band_rows));
+  memset(sheet->band, PLZJ_THUMB_BACKGROUND,
+         (size_t) 3 * sheet->width * band_rows);
+  sheet->row_i++;
+  return 0;
+}
+
+
+/**
+ * @brief Put thumbnail into cell `i`. Cells must be put in increasing order.
+ */
+static int PlzjThumbSheet_put (
+    struct PlzjThumbSheet *sheet, size_t i, const unsigned char *thumb) {
+  size_t row_i = i / sheet->cols;
+  return_if_fail (row_i >= sheet->row_i && row_i < sheet->rows) ERR(PL_EINVAL);
+  while (sheet->row_i < row_i) {
+    return_with_nonzero (PlzjThumbSheet_flush(sheet));
+  }
+
+  size_t left = (i % sheet->cols) * (sheet->thumb_w + PLZJ_THUMB_GAP) +
+    PLZJ_THUMB_GAP;
+  for (uint32_t y = 0; y < sheet->thumb_h; y++) {
+    memcpy(sheet->band +
+             3 * ((size_t) sheet->width * (PLZJ_THUMB_GAP + y) + left),
+           thumb + (size_t) 3 * sheet->thumb_w * y,
+           (size_t) 3 * sheet->thumb_w);
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Write the remaining rows and close the sheet.
+ *
+ * @param ret Error to discard the sheet with, 0 to finish it.
+ */
+static int PlzjThumbSheet_close (
+    struct PlzjThumbSheet *sheet, int ret, const char *path) {
+  while (ret == 0 && sheet->row_i < sheet->rows) {
+    ret = PlzjThumbSheet_flush(sheet);
+  }
+  if (ret == 0) {
+    // gap below the last row
+    ret = PlzjThumbPng_write_rows(
+      &sheet->png, sheet->band, sheet->width, PLZJ_THUMB_GAP);
+  }
+  free(sheet->band);
+  return PlzjThumbPng_close(&sheet->png, ret, path);
+}
+
+
+/**
+ * @brief Start a contact sheet of `cnt` cells, laid out in a grid as close to
+ *   square as possible.
+ */
+static int PlzjThumbSheet_open (
+    struct PlzjThumbSheet *sheet, const char *path, size_t cnt,
+    uint32_t thumb_w, uint32_t thumb_h) {
+  size_t cols = 1;
+  while (cols * cols < cnt) {
+    cols++;
+  }
+  size_t rows = (cnt + cols - 1) / cols;
+
+  size_t width = cols * (thumb_w + PLZJ_THUMB_GAP) + PLZJ_THUMB_GAP;
+  size_t height = rows * (thumb_h + PLZJ_THUMB_GAP) + PLZJ_THUMB_GAP;
+  return_if_fail (width <= INT32_MAX && height <= INT32_MAX) ERR(PL_EINVAL);
+
+  size_t band_len = 3 * width * (PLZJ_THUMB_GAP + thumb_h);
+  sheet->band = malloc(band_len);
+  return_if_fail (sheet->band != NULL) ERR_STD(malloc);
+  memset(sheet->band, PLZJ_THUMB_BACKGROUND, band_len);
+
+  int ret = PlzjThumbPng_open(&sheet->png, path, width, height);
+  if_fail (ret == 0) {
+    free(sheet->band);
+    return ret;
+  }
+
+  sheet->thumb_w = thumb_w;
+  sheet->thumb_h = thumb_h;
+  sheet->cols = cols;
+  sheet->rows = rows;
+  sheet->width = width;
+  sheet->row_i = 0;
+  return 0;
+}
+
+
+int Plzj_extract_thumbnails (
+    const struct Plzj *pl, const char *dir, int32_t frames_limit,
+    unsigned int every, unsigned int thumb_width) {
+  return_if_fail (pl->key_set >= 0) ERR(PL_EKEY);
+
+  uint32_t width = le32toh(pl->video.width);
+  uint32_t height = le32toh(pl->video.height);
+  return_if_fail (width > 0 && height > 0) ERR(PL_EFORMAT);
+
+  if (every == 0) {
+    every = 1;
+  }
+  unsigned int factor = 1;
+  if (thumb_width > 0 && thumb_width < width) {
+    factor = (width + thumb_width - 1) / thumb_width;
+  }
+  factor = min(factor, min(min(width, height), PLZJ_DOWNSCALE_MAX));
+  uint32_t thumb_w = width / factor;
+  uint32_t thumb_h = height / factor;
+
+  struct PlzjKeyframe *keyframes;
+  size_t keyframes_cnt;
+  return_with_nonzero (Plzj_read_keyframes(pl, &keyframes, &keyframes_cnt));
+
+  // one cell for each keyframe taken, so the sheet can be written as we go
+  size_t cells_cnt = 0;
+  for (size_t i = 0; i < keyframes_cnt; i += every) {
+    break_if_fail (frames_limit < 0 || keyframes[i].frame_no < frames_limit);
+    cells_cnt++;
+  }
+  if (cells_cnt == 0) {
+    free(keyframes);
+    return 1;
+  }
+
+  int ret;
+
+  size_t dir_len = strlen(dir);
+  char *path = malloc(dir_len + 65);
+  if_fail (path != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail_path;
+  }
+  memcpy(path, dir, dir_len);
+  char *filename = path + dir_len;
+  filename[0] = DIR_SEP;
+  filename++;
+  char *sheet_path = malloc(dir_len + 65);
+  if_fail (sheet_path != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail_sheet_path;
+  }
+  memcpy(sheet_path, path, dir_len + 1);
+  snprintf(sheet_path + dir_len + 1, 64, "contact_sheet.png");
+
+  struct PlzjCanvas canvas = {
+    .pixels = malloc(sizeof(*canvas.pixels) * width * height),
+    .width = width,
+    .height = height,
+  };
+  if_fail (canvas.pixels != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail_canvas;
+  }
+  struct PlzjCanvas small = {
+    .pixels = malloc(sizeof(*small.pixels) * thumb_w * thumb_h),
+    .width = thumb_w,
+    .height = thumb_h,
+  };
+  if_fail (small.pixels != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail_small;
+  }
+  struct PlzjRect small_box;
+  PlzjRect_init_box(&small_box, thumb_w, thumb_h);
+  unsigned char *thumb = malloc((size_t) 3 * thumb_w * thumb_h);
+  if_fail (thumb != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail_thumb;
+  }
+
+  struct PlzjThumbSheet sheet;
+  ret = PlzjThumbSheet_open(&sheet, sheet_path, cells_cnt, thumb_w, thumb_h);
+  goto_if_fail (ret == 0) fail_sheet;
+
+  size_t thumbs_cnt = 0;
+  for (size_t cell_i = 0; cell_i < cells_cnt; cell_i++) {
+    const struct PlzjKeyframe *keyframe = keyframes + cell_i * every;
+
+    ret = Plzj_read_keyframe(pl, keyframe, &canvas);
+    goto_if_fail (ret >= 0) fail;
+    if (ret > 0) {
+      sc_warning(
+        "no full-frame image at keyframe %" PRId32 "\n", keyframe->frame_no);
+      continue;
+    }
+
+    ret = PlzjCanvas_downscale(&small, &canvas, &small_box, factor);
+    goto_if_fail (ret == 0) fail;
+    PlzjCanvas_pack_rgb(&small, thumb);
+
+    snprintf(filename, 64, "thumb_%06" PRId32 ".png", keyframe->frame_no);
+    ret = plzj_thumb_save_png(path, thumb, thumb_w, thumb_h);
+    goto_if_fail (ret == 0) fail;
+    ret = PlzjThumbSheet_put(&sheet, cell_i, thumb);
+    goto_if_fail (ret == 0) fail;
+    sc_debug("Keyframe %" PRId32 " saved\n", keyframe->frame_no);
+    thumbs_cnt++;
+  }
+
+  ret = thumbs_cnt > 0 ? 0 : 2;
+fail:
+  // an empty sheet is discarded too
+  ret = PlzjThumbSheet_close(&sheet, ret, sheet_path);
+  if (ret == 0) {
+    sc_info(
+      "%" PRIuSIZE " thumbnails of %" PRIu32 "x%" PRIu32 " from %" PRIuSIZE
+      " keyframes\n", thumbs_cnt, thumb_w, thumb_h, keyframes_cnt);
+  }
+fail_sheet:
+  free(thumb);
+fail_thumb:
+  free(small.pixels);
+fail_small:
+  free(canvas.pixels);
+fail_canvas:
+  free(sheet_path);
+fail_sheet_path:
+  free(path);
+fail_path:
+  free(keyframes);
+  return ret;
+}
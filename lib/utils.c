@@ -9,6 +9,8 @@
 #include <unistd.h>
 #include <zlib.h>
 #ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/sendfile.h>
 #endif
 
@@ -153,6 +155,45 @@ int copy (FILE *dst, FILE *src, size_t len, unsigned int bsize) {
 
 #endif
 
+#ifdef FICLONERANGE
+
+/**
+ * @brief Same as copy(), but share extents with `src` if the file system
+ *   supports it, so the copy costs nothing until either side is modified.
+ */
+int reflink (FILE *dst, FILE *src, size_t len, unsigned int bsize) {
+  off_t inoff = ftello(src);
+  return_if_fail (inoff != -1) ERR_STD(ftello);
+  off_t outoff = ftello(dst);
+  return_if_fail (outoff != -1) ERR_STD(ftello);
+
+  return_if_fail (fflush(src) == 0) ERR_STD(fflush);
+  return_if_fail (fflush(dst) == 0) ERR_STD(fflush);
+
+  struct file_clone_range range = {
+    .src_fd = fileno(src),
+    .src_offset = inoff,
+    .src_length = len,
+    .dest_offset = outoff,
+  };
+  // not supported by file system, across devices, or unaligned offsets
+  if_fail (ioctl(fileno(dst), FICLONERANGE, &range) == 0) {
+    return copy(dst, src, len, bsize);
+  }
+
+  return_if_fail (fseeko(src, inoff + len, SEEK_SET) == 0) ERR_STD(fseeko);
+  return_if_fail (fseeko(dst, outoff + len, SEEK_SET) == 0) ERR_STD(fseeko);
+  return 0;
+}
+
+#else
+
+int reflink (FILE *dst, FILE *src, size_t len, unsigned int bsize) {
+  return copy(dst, src, len, bsize);
+}
+
+#endif
+
 int dump (const char *path, FILE *src, size_t len, unsigned int bsize) {
   FILE *out = mfopen(path, "wb");
   return_if_fail (out != NULL) ERR_STD(mfopen);
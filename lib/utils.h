@@ -66,6 +66,8 @@ static inline int read_at (
 __THROW __nonnull()
 int copy (FILE *dst, FILE *src, size_t len, unsigned int bsize);
 __THROW __nonnull()
+int reflink (FILE *dst, FILE *src, size_t len, unsigned int bsize);
+__THROW __nonnull()
 int dump (const char *path, FILE *src, size_t len, unsigned int bsize);
 __THROW __nonnull((1, 2)) __attr_access((__write_only__, 5))
 int copy_uncompress (
@@ -1,5 +1,6 @@
 #include <ctype.h>
 #include <inttypes.h>
+#include <math.h>
 #include <png.h>
 #include <stdatomic.h>
 #include <stddef.h>
@@ -7,10 +8,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <zlib.h>
 
 #include "include/platform/endian.h"
+#ifndef NO_THREADS
+#  include "platform/c11threads.h"
+#endif
 #include "platform/nowide.h"
+#include "platform/nproc.h"
+#include "platform/pio.h"
 #include "platform/stdbit.h"
 
 #include "include/alg.h"
@@ -18,16 +26,33 @@
 #include "include/parser.h"
 #include "include/video.h"
 #include "macro.h"
+#include "bufpool.h"
+#include "checkpoint.h"
 #include "gdi.h"
 #include "image.h"
 #include "log.h"
+#include "mkv.h"
+#include "outbuf.h"
 #include "threadpool.h"
 #include "utils.h"
+#include "zcache.h"
+#include "zlevel.h"
 
 
 #define PLZJ_PNG_TRANSPARENT 222
 #define PLZJ_PNG_DELAY_DEN 1000
 #define PLZJ_PNG_PATCH_DELAY 1
+#define PLZJ_CURSOR_HIGHLIGHT_RADIUS 20
+#define PLZJ_ZCACHE_SIZE_MAX (64 * 1024 * 1024)
+/// seconds between checkpoints
+#define PLZJ_CHECKPOINT_INTERVAL 60
+#define PLZJ_FRAME_CACHE_SIZE_MAX (64 * 1024 * 1024)
+#define PLZJ_FRAME_CACHE_SLOTS_MIN 2
+#define PLZJ_FRAME_CACHE_SLOTS_MAX 16
+/// positions on the output are kept within [-PLZJ_COORD_MAX, PLZJ_COORD_MAX]
+#define PLZJ_COORD_MAX (1 << 30)
+/// rectangles examined at most for occlusion of a patch
+#define PLZJ_OCCLUSION_BUDGET 4096
 
 
 struct __packed png_acTL {
@@ -58,6 +83,20 @@ struct __packed png_fcTL {
 #define PNG_BLEND_OP_OVER          0x01U
 
 
+struct compress_worker {
+  void *src;
+  size_t srclen;
+  size_t dstlen_before;
+  void **dstp;
+  size_t *dstlenp;
+  int level;
+  /// pool of `src` and `*dstp`
+  struct PlzjBufPool *bufpool;
+  /// cache of compressed data, can be `NULL`
+  struct PlzjZCache *zcache;
+};
+
+
 struct PlzjPngFrame {
   struct PlzjRect rect;
   uint32_t timecode_ms;
@@ -65,27 +104,150 @@ struct PlzjPngFrame {
 
   void *fdAT;
   size_t size;
+
+  /// compression task of this frame, kept here to avoid a malloc per frame
+  struct compress_worker worker;
+};
+
+
+/// canvas reconstructed at one frame
+struct PlzjFrameSlot {
+  struct PlzjColor *pixels;
+  /// frame of the canvas, `SIZE_MAX` if unused
+  size_t frame_i;
+  /// tick of last use
+  uint64_t used;
+};
+
+
+/// LRU cache of canvases reconstructed by PlzjVideo_get_frame()
+struct PlzjFrameCache {
+  struct PlzjFrameSlot *slots;
+  size_t slots_cnt;
+  uint64_t tick;
+
+  /// frames with a full-canvas patch, ascending
+  size_t *keyframes;
+  size_t keyframes_cnt;
+
+  /// pool of patch buffers
+  struct PlzjBufPool bufpool;
+};
+
+
+/// run of pixels in one row, relative to the center of the shape
+struct PlzjSpan {
+  int16_t y;
+  int16_t x1;
+  int16_t x2;
+};
+
+/// shape stored as runs of pixels, so drawing it tests no pixel
+struct PlzjSpanMask {
+  /// bounding box is [-radius, radius) in both directions
+  int32_t radius;
+  unsigned int spans_cnt;
+  struct PlzjSpan *spans;
 };
 
 
 struct PlzjEncoder {
   struct PlzjPngFrame **frames;
   size_t frames_len;
+  size_t frames_cap;
   size_t frame_i;
+  /// storage of frames, reused once streamed frames are written
+  struct PlzjBufPool framepool;
 
   off_t acTL_offset;
   png_structp png_ptr;
+  /// APNG output, written in large chunks by a background thread
+  struct PlzjOutBuf outbuf;
+  /// write each fcTL once, as soon as its delay is known, instead of seeking
+  /// back at the end, for non-seekable output
+  bool streaming;
+  /// dry run, frames are only counted and nothing is written
+  bool counting;
+  /// number of frames counted in the dry run, announced in acTL when streaming
+  size_t frames_total;
+
+  /// write full frames into Matroska instead of APNG
+  bool to_mkv;
+  struct PlzjMkv mkv;
 
   struct PlzjCanvas canvas;
   struct PlzjCanvas canvas_last;
   struct PlzjCanvas canvas_swap;
 
-  struct ThreadPool pool;
+  /// output is `scale` times smaller than the screen in both directions
+  unsigned int scale;
+  /// screen in full resolution, only when downscaling
+  struct PlzjCanvas screen;
+  /// cursor sprites at the output size, only when downscaling, with the same
+  /// tags as the originals
+  struct PlzjCursorRes *curreses;
+  size_t curreses_cnt;
 
-  int compression_level;
+  struct ThreadPool pool;
+  /// scratch buffers for decoding patches and encoding frames
+  struct PlzjBufPool bufpool;
+  /// previously compressed frames, for screens seen before
+  struct PlzjZCache zcache;
+
+  /// rings of single and double click
+  struct PlzjSpanMask click_masks[2];
+  /// draw highlight circle around cursor
+  bool highlight;
+  /// center the circle at the left-top of cursor instead of its middle
+  bool highlight_at_corner;
+  struct PlzjColor highlight_color;
+  /// opacity of highlight circle, 0 - 256
+  uint32_t highlight_alpha;
+  struct PlzjSpanMask highlight_mask;
+
+  /// zlib level of each frame
+  struct PlzjZLevel zlevel;
+  /// number of compression threads
+  unsigned int nproc;
 };
 
 
+/**
+ * @brief Append a frame taken from the frame pool.
+ */
+static struct PlzjPngFrame *PlzjEncoder_new_frame (
+    struct PlzjEncoder *encoder) {
+  if (encoder->frames_len >= encoder->frames_cap) {
+    size_t new_cap = encoder->frames_cap == 0 ? 256 : 2 * encoder->frames_cap;
+    struct PlzjPngFrame **new_frames = realloc(
+      encoder->frames, sizeof(*new_frames) * new_cap);
+    if_fail (new_frames != NULL) {
+      (void) ERR_STD(realloc);
+      return NULL;
+    }
+    encoder->frames = new_frames;
+    encoder->frames_cap = new_cap;
+  }
+
+  struct PlzjPngFrame *frame = PlzjBufPool_get(
+    &encoder->framepool, sizeof(*frame));
+  return_if_fail (frame != NULL) NULL;
+  encoder->frames[encoder->frames_len] = frame;
+  encoder->frames_len++;
+  return frame;
+}
+
+
+/**
+ * @brief Give a frame from PlzjEncoder_new_frame() back to the frame pool.
+ */
+__attribute_artificial__
+static inline void PlzjEncoder_free_frame (
+    struct PlzjEncoder *encoder, struct PlzjPngFrame *frame) {
+  PlzjBufPool_put(&encoder->framepool, frame);
+}
+
+
 __attribute_artificial__
 static inline size_t bmp_max_size (uint32_t width, uint32_t height) {
   // they use 0x1400, which seems too large
@@ -209,19 +371,50 @@ fail:
 }
 
 
+static void plzj_png_write_data (
+    png_structp png_ptr, png_bytep data, size_t length) {
+  struct PlzjOutBuf *ob = png_get_io_ptr(png_ptr);
+  if_fail (PlzjOutBuf_write(ob, data, length) == 0) {
+    png_error(png_ptr, "Write Error");
+  }
+}
+
+
+static void plzj_png_flush (png_structp png_ptr) {
+  // flushed explicitly at checkpoints and the end
+  (void) png_ptr;
+}
+
+
 static int plzj_png_save_acTL (png_structp png_ptr, off_t *acTL_offsetp) {
-  int res = setjmp(png_jmpbuf(png_ptr));
-  return_if_fail (res == 0) ERR_PNG(png_jmpbuf);
+  struct PlzjOutBuf *ob = png_get_io_ptr(png_ptr);
+  return_if_fail (ob->seekable) ERR(PL_EINVAL);
+  *acTL_offsetp = PlzjOutBuf_tell(ob);
 
-  FILE *file = png_get_io_ptr(png_ptr);
-  *acTL_offsetp = ftello(file);
-  return_if_fail (*acTL_offsetp != -1) ERR_STD(ftello);
+  static const unsigned char chunk_acTL[
+    4 + 4 + sizeof(struct png_acTL) + 4] = {0};
+  return PlzjOutBuf_write(ob, chunk_acTL, sizeof(chunk_acTL));
+}
 
-  static unsigned char chunk_acTL[4 + 4 + sizeof(struct png_acTL) + 4] = {0};
-  return_if_fail (fwrite(chunk_acTL, sizeof(chunk_acTL), 1, file) == 1)
-    ERR_STD(fwrite);
 
-  return 0;
+/**
+ * @brief Overwrite the placeholder of a chunk at `offset` of the output.
+ */
+static int plzj_png_pwrite_chunk (
+    struct PlzjOutBuf *ob, off_t offset, const char type[4],
+    const void *data, uint32_t len) {
+  // write length and type, data and CRC in place, without joining them
+  unsigned char head[4 + 4];
+  uint32_t len_be = htobe32(len);
+  memcpy(head, &len_be, 4);
+  memcpy(head + 4, type, 4);
+  uint32_t crc = crc32_z(0, head + 4, 4);
+  crc = htobe32(crc32_z(crc, data, len));
+
+  return_with_nonzero (PlzjOutBuf_pwrite(ob, head, sizeof(head), offset));
+  return_with_nonzero (PlzjOutBuf_pwrite(
+    ob, data, len, offset + sizeof(head)));
+  return PlzjOutBuf_pwrite(ob, &crc, sizeof(crc), offset + sizeof(head) + len);
 }
 
 
@@ -230,15 +423,17 @@ static int plzj_png_write_timecodes (
     off_t acTL_offset) {
   return_if_fail (acTL_offset != -1) ERR(PL_EINVAL);
 
-  FILE *file = png_get_io_ptr(png_ptr);
-  return_if_fail (fseeko(file, acTL_offset, SEEK_SET) == 0) ERR_STD(fseeko);
-
   int res = setjmp(png_jmpbuf(png_ptr));
   return_if_fail (res == 0) ERR_PNG(png_jmpbuf);
 
+  png_write_chunk(png_ptr, (const void *) "IEND", NULL, 0);
+
+  // fill in placeholders, most of them are still in the output buffer
+  struct PlzjOutBuf *ob = png_get_io_ptr(png_ptr);
   struct png_acTL acTL = {htobe32(len), htobe32(0)};
-  png_write_chunk(
-    png_ptr, (const void *) "acTL", (const void *) &acTL, sizeof(acTL));
+  return_with_nonzero (plzj_png_pwrite_chunk(
+    ob, acTL_offset, "acTL", &acTL, sizeof(acTL)));
+  off_t offset = acTL_offset + 4 + 4 + sizeof(acTL) + 4;
 
   for (size_t i = 0; i < len; i++) {
     const struct PlzjPngFrame *png_frame = frames[i];
@@ -249,25 +444,83 @@ static int plzj_png_write_timecodes (
       &fcTL, &png_frame->rect, i == 0 ? 0 : 2 * i - 1,
       png_frame_next->timecode_ms - png_frame->timecode_ms,
       png_frame_next->patches_remain);
-    png_write_chunk(
-      png_ptr, (const void *) "fcTL", (const void *) &fcTL, sizeof(fcTL));
-
-    return_if_fail (fseeko(
-      file, 4 + 4 + png_frame->size - (i == 0 ? 4 : 0) + 4, SEEK_CUR
-    ) == 0) ERR_STD(fseeko);
+    return_with_nonzero (plzj_png_pwrite_chunk(
+      ob, offset, "fcTL", &fcTL, sizeof(fcTL)));
+    offset += 4 + 4 + sizeof(fcTL) + 4;
+    offset += 4 + 4 + png_frame->size - (i == 0 ? 4 : 0) + 4;
   }
+  return 0;
+}
+
+
+/**
+ * @brief End the stream.
+ *
+ * @param len Number of frames written.
+ * @param total Number of frames announced in acTL.
+ */
+static int plzj_png_finish_stream (
+    png_structp png_ptr, size_t len, size_t total) {
+  return_if_fail (len > 0 && len == total) ERR_FMT(
+    PL_EINVAL, "%" PRIuSIZE " frames written, %" PRIuSIZE " announced",
+    len, total);
+
+  int res = setjmp(png_jmpbuf(png_ptr));
+  return_if_fail (res == 0) ERR_PNG(png_jmpbuf);
 
   png_write_chunk(png_ptr, (const void *) "IEND", NULL, 0);
   return 0;
 }
 
 
+/**
+ * @brief Get the final fcTL of frame `i` from the timecodes of the frames after
+ *   it.
+ *
+ * @param final All frames have been appended, and the end frame is stored at
+ *   `PlzjEncoder::frames_len`.
+ * @return `true` if the known frames are enough to determine the fcTL.
+ */
+static bool PlzjEncoder_get_fcTL (
+    const struct PlzjEncoder *encoder, size_t i, bool final,
+    struct png_fcTL *fcTL) {
+  size_t end = encoder->frames_len + (final ? 1 : 0);
+  size_t next = i + 1;
+  if (next >= end) {
+    return false;
+  }
+
+  // patches of the next frame shorten the delay, wait until all of them come
+  uint32_t timecode_ms = encoder->frames[next]->timecode_ms;
+  uint16_t patches_remain = 0;
+  size_t j;
+  for (j = next + 1;
+       j < end && encoder->frames[j]->timecode_ms == timecode_ms; j++) {
+    patches_remain++;
+  }
+  if (j >= end && !final) {
+    return false;
+  }
+
+  const struct PlzjPngFrame *png_frame = encoder->frames[i];
+  plzj_png_fcTL_init(
+    fcTL, &png_frame->rect, i == 0 ? 0 : 2 * i - 1,
+    timecode_ms - png_frame->timecode_ms, patches_remain);
+  return true;
+}
+
+
+/**
+ * @brief Write compressed frames in order.
+ *
+ * @param final All frames have been appended.
+ */
 static int plzj_png_write_frames (
-    png_structp png_ptr, struct PlzjEncoder *encoder) {
+    png_structp png_ptr, struct PlzjEncoder *encoder, bool final) {
   int res = setjmp(png_jmpbuf(png_ptr));
   return_if_fail (res == 0) ERR_PNG(png_jmpbuf);
 
-  FILE *file = png_get_io_ptr(png_ptr);
+  struct PlzjOutBuf *ob = png_get_io_ptr(png_ptr);
 
   size_t i;
   for (i = encoder->frame_i; i < encoder->frames_len; i++) {
@@ -275,9 +528,32 @@ static int plzj_png_write_frames (
     void *fdAT = atomic_load_explicit(&png_frame->fdAT, memory_order_acquire);
     break_if_fail (fdAT != NULL);
 
-    static unsigned char chunk_fcTL[4 + 4 + sizeof(struct png_fcTL) + 4] = {0};
-    return_if_fail (fwrite(chunk_fcTL, sizeof(chunk_fcTL), 1, file) == 1)
-      ERR_STD(fwrite);
+    if (!encoder->streaming) {
+      static const unsigned char chunk_fcTL[
+        4 + 4 + sizeof(struct png_fcTL) + 4] = {0};
+      return_with_nonzero (PlzjOutBuf_write(
+        ob, chunk_fcTL, sizeof(chunk_fcTL)));
+    } else {
+      struct png_fcTL fcTL;
+      if (!PlzjEncoder_get_fcTL(encoder, i, final, &fcTL)) {
+        break;
+      }
+      return_if_fail (i < encoder->frames_total) ERR(PL_EINVAL);
+
+      if (i == 0) {
+        struct png_acTL acTL = {htobe32(encoder->frames_total), htobe32(0)};
+        png_write_chunk(
+          png_ptr, (const void *) "acTL", (const void *) &acTL, sizeof(acTL));
+      }
+      png_write_chunk(
+        png_ptr, (const void *) "fcTL", (const void *) &fcTL, sizeof(fcTL));
+    }
+
+    PlzjZLevel_done(
+      &encoder->zlevel,
+      (3 * (size_t) PlzjRect_width(&png_frame->rect) + 1) *
+        PlzjRect_height(&png_frame->rect),
+      png_frame->size - 4);
 
     if (i == 0) {
       png_write_chunk(
@@ -290,7 +566,36 @@ static int plzj_png_write_frames (
         png_ptr, (const void *) "fdAT", fdAT, png_frame->size);
     }
 
-    free(fdAT);
+    PlzjBufPool_put(&encoder->bufpool, fdAT);
+    png_frame->fdAT = NULL;
+    if (encoder->streaming) {
+      // only later frames are needed from now on
+      PlzjEncoder_free_frame(encoder, png_frame);
+      encoder->frames[i] = NULL;
+    }
+  }
+  encoder->frame_i = i;
+  return 0;
+}
+
+
+static int plzj_mkv_write_frames (struct PlzjEncoder *encoder) {
+  size_t i;
+  for (i = encoder->frame_i; i < encoder->frames_len; i++) {
+    struct PlzjPngFrame *png_frame = encoder->frames[i];
+    void *fdAT = atomic_load_explicit(&png_frame->fdAT, memory_order_acquire);
+    break_if_fail (fdAT != NULL);
+
+    int ret = PlzjMkv_write_png(
+      &encoder->mkv, (const unsigned char *) fdAT + 4, png_frame->size - 4,
+      png_frame->timecode_ms);
+    return_if_fail (ret == 0) ret;
+    PlzjZLevel_done(
+      &encoder->zlevel,
+      (3 * (size_t) encoder->canvas.width + 1) * encoder->canvas.height,
+      png_frame->size - 4);
+
+    PlzjBufPool_put(&encoder->bufpool, fdAT);
     png_frame->fdAT = NULL;
   }
   encoder->frame_i = i;
@@ -298,27 +603,48 @@ static int plzj_png_write_frames (
 }
 
 
+/**
+ * @brief Compress `src`, reusing the result of identical data in `zcache`.
+ *
+ * @param zcache Cache of compressed data, can be `NULL`.
+ */
 static void *plzj_compress (
     const void *src, size_t srclen, size_t dstlen_before, size_t *dstlenp,
-    int level) {
-  uLongf buflen = compressBound(srclen);
-  Bytef *dst = malloc(dstlen_before + buflen);
-  if_fail (dst != NULL) {
-    (void) ERR_STD(malloc);
-    return NULL;
+    int level, struct PlzjBufPool *bufpool, struct PlzjZCache *zcache) {
+  uint64_t hash = 0;
+  size_t dstlen;
+  Bytef *dst;
+
+  if (zcache != NULL) {
+    hash = PlzjZCache_hash(src, srclen, level);
+    dst = PlzjZCache_get(
+      zcache, hash, src, srclen, level, dstlen_before, &dstlen, bufpool);
+    if (dst != NULL) {
+      goto end;
+    }
   }
 
+  uLongf buflen = compressBound(srclen);
+  dst = PlzjBufPool_alloc(bufpool, dstlen_before + buflen);
+  return_if_fail (dst != NULL) NULL;
+
   int res = compress2(dst + dstlen_before, &buflen, src, srclen, level);
   if_fail (res == Z_OK) {
     (void) ERR_ZLIB(compress2, res);
-    free(dst);
+    PlzjBufPool_free(bufpool, dst);
     return NULL;
   }
 
-  size_t dstlen = buflen + dstlen_before;
+  dstlen = buflen + dstlen_before;
   // speed up for stream PNG writing
   // dst = realloc(dst, dstlen);
 
+  if (zcache != NULL) {
+    PlzjZCache_put(
+      zcache, hash, src, srclen, level, dst + dstlen_before, buflen);
+  }
+
+end:
   if (dstlenp != NULL) {
     *dstlenp = dstlen;
   }
@@ -326,33 +652,31 @@ static void *plzj_compress (
 }
 
 
-struct compress_worker {
-  void *src;
-  size_t srclen;
-  size_t dstlen_before;
-  void **dstp;
-  size_t *dstlenp;
-  int level;
-};
-
-
 static int plzj_compress_worker (void *arg) {
   struct compress_worker *worker = arg;
 
   void *dst = plzj_compress(
     worker->src, worker->srclen, worker->dstlen_before, worker->dstlenp,
-    worker->level);
-  atomic_store_explicit(worker->dstp, dst, memory_order_release);
+    worker->level, worker->bufpool, worker->zcache);
+  PlzjBufPool_free(worker->bufpool, worker->src);
+  worker->src = NULL;
 
-  free(worker->src);
-  free(worker);
+  // the frame holding this worker may be freed once the result is published
+  atomic_store_explicit(worker->dstp, dst, memory_order_release);
   return dst == NULL ? -sc_exc.code : 0;
 }
 
 
+/**
+ * @brief Compress `src` in `pool`, taking ownership of it.
+ *
+ * @param worker Storage of the task, must live until the task is done.
+ */
 static int plzj_compress_bg (
-    void *src, size_t srclen, size_t dstlen_before, void **dstp,
-    size_t *dstlenp, int level, struct ThreadPool *pool) {
+    struct compress_worker *worker, void *src, size_t srclen,
+    size_t dstlen_before, void **dstp, size_t *dstlenp, int level,
+    struct ThreadPool *pool, struct PlzjBufPool *bufpool,
+    struct PlzjZCache *zcache) {
   int ret;
 
   const struct ScException *exc;
@@ -362,39 +686,35 @@ static int plzj_compress_bg (
     return ret;
   }
 
-  struct compress_worker *worker = malloc(sizeof(*worker));
-  return_if_fail (worker != NULL) ERR_STD(malloc);
   *worker = (struct compress_worker) {
-    src, srclen, dstlen_before, dstp, dstlenp, level
+    src, srclen, dstlen_before, dstp, dstlenp, level, bufpool, zcache
   };
 
   // set up atomic variable
   *dstlenp = 0;
   atomic_store_explicit(dstp, NULL, memory_order_release);
 
-  ret = ThreadPool_run(pool, plzj_compress_worker, worker);
-  if_fail (ret == 0) {
-    free(worker);
-    return ret;
-  }
-
-  return 0;
+  return ThreadPool_run(pool, plzj_compress_worker, worker);
 }
 
 
-int PlzjBuffer_init_file (
-    struct PlzjBuffer *buf, FILE *file, size_t size, off_t offset) {
+static int PlzjBuffer_init_file_pool (
+    struct PlzjBuffer *buf, FILE *file, size_t size, off_t offset,
+    struct PlzjBufPool *bufpool) {
+  *buf = (struct PlzjBuffer) {0};
+
   if (offset != -1) {
     return_if_fail (fseeko(file, offset, SEEK_SET) == 0) ERR_STD(fseeko);
   }
 
-  unsigned char *data = malloc(size);
+  unsigned char *data = PlzjBufPool_alloc(bufpool, size);
+  // both the pool and malloc() leave ENOMEM in errno
   return_if_fail (data != NULL) ERR_STD(malloc);
 
   if (size > 0) {
     if_fail (fread(data, size, 1, file) == 1) {
       int ret = ERR_STD(fread);
-      free(data);
+      PlzjBufPool_free(bufpool, data);
       return ret;
     }
   }
@@ -405,12 +725,154 @@ int PlzjBuffer_init_file (
 }
 
 
+int PlzjBuffer_init_file (
+    struct PlzjBuffer *buf, FILE *file, size_t size, off_t offset) {
+  return PlzjBuffer_init_file_pool(buf, file, size, offset, NULL);
+}
+
+
+static void PlzjSpanMask_destroy (const struct PlzjSpanMask *mask) {
+  free(mask->spans);
+}
+
+
+/**
+ * @brief Build a mask of rings, pixel (x, y) is set if `x^2 + y^2` falls in
+ *   any of the [low, high) ranges.
+ */
+static int PlzjSpanMask_init (
+    struct PlzjSpanMask *mask, int32_t radius,
+    const uint32_t (*ranges)[2], unsigned int ranges_cnt) {
+  return_if_fail (radius > 0 && radius <= INT16_MAX) ERR(PL_EINVAL);
+
+  // a row crosses each ring at most twice
+  size_t spans_max = (size_t) 4 * radius * ranges_cnt;
+  mask->spans = malloc(sizeof(*mask->spans) * spans_max);
+  return_if_fail (mask->spans != NULL) ERR_STD(malloc);
+  mask->radius = radius;
+  mask->spans_cnt = 0;
+
+  for (int32_t y = -radius; y < radius; y++) {
+    int32_t x1 = 0;
+    bool inside = false;
+    for (int32_t x = -radius; x <= radius; x++) {
+      bool set = false;
+      if (x < radius) {
+        uint32_t dis2 = x * x + y * y;
+        for (unsigned int i = 0; i < ranges_cnt; i++) {
+          if (ranges[i][0] <= dis2 && dis2 < ranges[i][1]) {
+            set = true;
+            break;
+          }
+        }
+      }
+
+      if (set && !inside) {
+        x1 = x;
+      } else if (!set && inside) {
+        mask->spans[mask->spans_cnt++] = (struct PlzjSpan) {y, x1, x};
+      }
+      inside = set;
+    }
+  }
+  return 0;
+}
+
+
+static bool PlzjSpanMask_rect (
+    const struct PlzjSpanMask *mask, const struct PlzjPoint *center,
+    uint32_t width, uint32_t height, struct PlzjRect *rect_out) {
+  int32_t radius = mask->radius;
+  struct PlzjRect rect = {
+    {clamp(center->x - radius, 0, (int32_t) width),
+     clamp(center->y - radius, 0, (int32_t) height)},
+    {clamp(center->x + radius, 0, (int32_t) width),
+     clamp(center->y + radius, 0, (int32_t) height)}
+  };
+  return_if_fail (PlzjRect_width(&rect) > 0 && PlzjRect_height(&rect) > 0)
+    false;
+
+  *rect_out = rect;
+  return true;
+}
+
+
+/**
+ * @brief Clip span to the canvas.
+ *
+ * @return Pointer to the first pixel, or `NULL` if nothing left.
+ */
+static struct PlzjColor *PlzjSpan_clip (
+    const struct PlzjSpan *span, const struct PlzjPoint *center,
+    struct PlzjCanvas *canvas, uint32_t *len_out) {
+  int32_t y = center->y + span->y;
+  return_if_fail (0 <= y && y < (int32_t) canvas->height) NULL;
+
+  int32_t x1 = max(center->x + span->x1, 0);
+  int32_t x2 = min(center->x + span->x2, (int32_t) canvas->width);
+  return_if_fail (x1 < x2) NULL;
+
+  *len_out = x2 - x1;
+  return &canvas->pixels[(size_t) canvas->width * y + x1];
+}
+
+
+static void PlzjSpanMask_fill (
+    const struct PlzjSpanMask *mask, struct PlzjCanvas *canvas,
+    const struct PlzjPoint *center, struct PlzjColor color) {
+  for (unsigned int i = 0; i < mask->spans_cnt; i++) {
+    uint32_t len;
+    struct PlzjColor *pixels =
+      PlzjSpan_clip(&mask->spans[i], center, canvas, &len);
+    continue_if_fail (pixels != NULL);
+
+    for (uint32_t x = 0; x < len; x++) {
+      pixels[x] = color;
+    }
+  }
+}
+
+
+/**
+ * @brief Blend `color` over the canvas.
+ *
+ * @param alpha Opacity of `color`, 0 - 256.
+ */
+static void PlzjSpanMask_blend (
+    const struct PlzjSpanMask *mask, struct PlzjCanvas *canvas,
+    const struct PlzjPoint *center, struct PlzjColor color, uint32_t alpha) {
+  uint32_t alpha_inv = 256 - alpha;
+  uint32_t premul[3] = {
+    color.r * alpha + 128, color.g * alpha + 128, color.b * alpha + 128
+  };
+
+  for (unsigned int i = 0; i < mask->spans_cnt; i++) {
+    uint32_t len;
+    struct PlzjColor *pixels =
+      PlzjSpan_clip(&mask->spans[i], center, canvas, &len);
+    continue_if_fail (pixels != NULL);
+
+    for (uint32_t x = 0; x < len; x++) {
+      for (unsigned int c = 0; c < 3; c++) {
+        pixels[x].values[c] =
+          (pixels[x].values[c] * alpha_inv + premul[c]) >> 8;
+      }
+    }
+  }
+}
+
+
+/**
+ * @brief Get the area of click rings.
+ *
+ * @param masks Rings of single and double click.
+ */
 static bool PlzjClick_rect (
-    const struct PlzjClick *event, uint32_t width, uint32_t height,
-    struct PlzjRect *rect_out) {
+    const struct PlzjClick *event, const struct PlzjSpanMask masks[2],
+    uint32_t width, uint32_t height, struct PlzjRect *rect_out) {
   return_if_fail (event->type != 0) false;
 
-  int radius = event->type == 3 ? 22 : 16;
+  int32_t radius = masks[event->type == 3].radius;
   struct PlzjRect rect = {
     {clamp(event->p.x - radius, 0, (int32_t) width),
      clamp(event->p.y - radius, 0, (int32_t) height)},
@@ -425,27 +887,22 @@ static bool PlzjClick_rect (
 }
 
 
+/**
+ * @brief Draw click rings.
+ *
+ * @param masks Rings of single and double click.
+ */
 static int PlzjClick_apply (
-    const struct PlzjClick *event, struct PlzjCanvas *canvas,
-    struct PlzjRect *rect_out) {
-  uint32_t width = canvas->width;
-  uint32_t height = canvas->height;
-
+    const struct PlzjClick *event, const struct PlzjSpanMask masks[2],
+    struct PlzjCanvas *canvas, struct PlzjRect *rect_out) {
   struct PlzjRect rect;
-  return_if_fail (PlzjClick_rect(event, width, height, &rect)) 1;
+  return_if_fail (
+    PlzjClick_rect(event, masks, canvas->width, canvas->height, &rect)) 1;
 
-  for (int32_t y = rect.p1.y; y < rect.p2.y; y++) {
-    for (int32_t x = rect.p1.x; x < rect.p2.x; x++) {
-      uint32_t dis2 = (x - event->p.x) * (x - event->p.x) +
-                      (y - event->p.y) * (y - event->p.y);
-      if ((event->type == 3 && 20 * 20 <= dis2 && dis2 < 22 * 22) ||
-          (14 * 14 <= dis2 && dis2 < 16 * 16)) {
-        canvas->pixels[width * y + x] = (struct PlzjColor) {
-          .r = 0xff, .g = event->type != 2 ? 0 : 0xff, .b = 0
-        };
-      }
-    }
-  }
+  PlzjSpanMask_fill(
+    &masks[event->type == 3], canvas, &event->p, (struct PlzjColor) {
+      .r = 0xff, .g = event->type != 2 ? 0 : 0xff, .b = 0
+    });
 
   if (rect_out != NULL) {
     *rect_out = rect;
@@ -456,14 +913,28 @@ static int PlzjClick_apply (
 
 static void PlzjCursorRes_destroy (const struct PlzjCursorRes *curres) {
   PlzjBuffer_destroy(&curres->buf);
+  free(curres->colors);
 }
 
 
+/**
+ * @brief Decode the ICO bit planes into a sprite and a pixel mask.
+ *
+ * Takes ownership of `buf` on success. If the icon is malformed, the sprite
+ * is left `NULL` and drawing the cursor fails.
+ */
 static int PlzjCursorRes_init (
     struct PlzjCursorRes *curres, const struct PlzjBuffer *buf,
     unsigned long tag) {
   curres->tag = tag;
   curres->buf = *buf;
+  curres->gray = false;
+  curres->colors = NULL;
+  curres->masks = NULL;
+  curres->width = 0;
+  curres->height = 0;
+
+  return_if_fail (plzj_cursor_valid(buf->data, buf->size)) 0;
 
   const ICONHEADER *header = buf->data;
   const ICONDIRENTRY *entry = (const void *) (header + 1);
@@ -473,7 +944,7 @@ static int PlzjCursorRes_init (
   uint16_t depth = le16toh(info->biBitCount);
   unsigned int shift = stdc_trailing_zeros(depth);
 
-  const uint32_t *colors = (const void *) (info + 1);
+  const struct BMPColor *colors = (const void *) (info + 1);
   const unsigned char *pixels = (const void *) (colors + (1 << depth));
   const unsigned char *alphas =
     (const void *) (pixels + le32toh(info->biSizeImage));
@@ -490,6 +961,45 @@ static int PlzjCursorRes_init (
       break;
     }
   }
+
+  size_t sprite_size = (size_t) cursor_width * cursor_height;
+  struct PlzjColor *sprite = malloc(2 * sizeof(*sprite) * sprite_size);
+  return_if_fail (sprite != NULL) ERR_STD(malloc);
+  struct PlzjColor *masks = sprite + sprite_size;
+
+  for (uint32_t y = 0; y < cursor_height; y++) {
+    for (uint32_t x = 0; x < cursor_width; x++) {
+      // bmp is upside down
+      size_t cursor_offset = cursor_width_h * (cursor_height - y - 1) + x;
+      unsigned char cursor_pixel = BIT_FIELD(
+        pixels[(cursor_offset << shift) / 8],
+        8 - depth - (cursor_offset << shift) % 8, depth);
+
+      struct PlzjColor color = {0};
+      bool draw;
+      if (curres->gray) {
+        // black
+        draw = cursor_pixel != 0;
+      } else {
+        draw = BIT_FIELD(
+          alphas[cursor_offset / 8], 7 - (cursor_offset % 8), 1) == 0;
+        if (draw) {
+          const struct BMPColor *bmp_color = &colors[cursor_pixel];
+          color = (struct PlzjColor) {
+            .r = bmp_color->r, .g = bmp_color->g, .b = bmp_color->b,
+          };
+        }
+      }
+
+      sprite[cursor_width * y + x] = color;
+      masks[cursor_width * y + x].color = draw ? UINT32_MAX : 0;
+    }
+  }
+
+  curres->colors = sprite;
+  curres->masks = masks;
+  curres->width = cursor_width;
+  curres->height = cursor_height;
   return 0;
 }
 
@@ -498,19 +1008,13 @@ static bool PlzjCursor_rect (
     const struct PlzjCursor *cursor, uint32_t width, uint32_t height,
     struct PlzjRect *rect_out) {
   return_if_fail (cursor->curres != NULL) false;
-  const struct PlzjBuffer *cursor_ico = &cursor->curres->buf;
-
-  const ICONHEADER *header = cursor_ico->data;
-  const ICONDIRENTRY *entry = (const void *) (header + 1);
-
-  uint16_t cursor_width = le16toh(entry->bWidth);
-  uint16_t cursor_height = le16toh(entry->bHeight);
+  const struct PlzjCursorRes *curres = cursor->curres;
 
   struct PlzjRect rect = {
     {clamp(cursor->p.x, 0, (int32_t) width),
      clamp(cursor->p.y, 0, (int32_t) height)},
-    {clamp(cursor->p.x + cursor_width, 0, (int32_t) width),
-     clamp(cursor->p.y + cursor_height, 0, (int32_t) height)}
+    {clamp(cursor->p.x + curres->width, 0, (int32_t) width),
+     clamp(cursor->p.y + curres->height, 0, (int32_t) height)}
   };
   return_if_fail (PlzjRect_width(&rect) > 0 && PlzjRect_height(&rect) > 0)
     false;
@@ -524,10 +1028,8 @@ static int PlzjCursor_apply (
     const struct PlzjCursor *cursor, struct PlzjCanvas *canvas,
     struct PlzjRect *rect_out) {
   return_if_fail (cursor->curres != NULL) 1;
-  const struct PlzjBuffer *cursor_ico = &cursor->curres->buf;
-
-  return_if_fail (plzj_cursor_valid(cursor_ico->data, cursor_ico->size))
-    ERR(PL_EINVAL);
+  const struct PlzjCursorRes *curres = cursor->curres;
+  return_if_fail (curres->colors != NULL) ERR(PL_EINVAL);
 
   uint32_t width = canvas->width;
   uint32_t height = canvas->height;
@@ -535,53 +1037,82 @@ static int PlzjCursor_apply (
   struct PlzjRect rect;
   return_if_fail (PlzjCursor_rect(cursor, width, height, &rect)) 1;
 
-  const ICONHEADER *header = cursor_ico->data;
-  const ICONDIRENTRY *entry = (const void *) (header + 1);
-  const BITMAPINFOHEADER *info = (const void *) (
-    (const unsigned char *) cursor_ico->data + le32toh(entry->dwDIBOffset));
-
-  uint16_t depth = le16toh(info->biBitCount);
-  unsigned int shift = stdc_trailing_zeros(depth);
+  uint32_t rect_width = PlzjRect_width(&rect);
+  for (int32_t y = rect.p1.y; y < rect.p2.y; y++) {
+    size_t sprite_offset =
+      (size_t) curres->width * (y - cursor->p.y) + rect.p1.x - cursor->p.x;
+    const uint32_t *restrict colors =
+      &curres->colors[sprite_offset].color;
+    const uint32_t *restrict masks = &curres->masks[sprite_offset].color;
+    uint32_t *restrict pixels =
+      &canvas->pixels[(size_t) width * y + rect.p1.x].color;
+
+    // branchless, so the compiler can vectorize it
+    for (uint32_t x = 0; x < rect_width; x++) {
+      pixels[x] = (pixels[x] & ~masks[x]) | colors[x];
+    }
+  }
 
-  const struct BMPColor *colors = (const void *) (info + 1);
-  const unsigned char *pixels = (const void *) (colors + (1 << depth));
-  const unsigned char *alphas =
-    (const void *) (pixels + le32toh(info->biSizeImage));
+  if (rect_out != NULL) {
+    *rect_out = rect;
+  }
+  return 0;
+}
 
-  uint16_t cursor_width = le16toh(entry->bWidth);
-  uint16_t cursor_height = le16toh(entry->bHeight);
-  uint16_t cursor_width_h =
-    (((cursor_width << shift) + 31) & ~31) >> shift;
 
-  for (uint32_t y = rect.p1.y - cursor->p.y;
-       y < (uint32_t) (rect.p2.y - cursor->p.y); y++) {
-    for (uint32_t x = rect.p1.x - cursor->p.x;
-         x < (uint32_t) (rect.p2.x - cursor->p.x); x++) {
-      // bmp is upside down
-      size_t cursor_offset = cursor_width_h * (cursor_height - y - 1) + x;
-      unsigned char cursor_pixel = BIT_FIELD(
-        pixels[(cursor_offset << shift) / 8],
-        8 - depth - (cursor_offset << shift) % 8, depth);
+/**
+ * @brief Shrink the sprite of `src` by `scale` in both directions.
+ *
+ * A pixel is drawn if at least half of its block is, in their average color.
+ */
+static int PlzjCursorRes_init_scaled (
+    struct PlzjCursorRes *curres, const struct PlzjCursorRes *src,
+    unsigned int scale) {
+  *curres = (struct PlzjCursorRes) {
+    .tag = src->tag, .gray = src->gray,
+    .width = max(src->width / scale, 1U),
+    .height = max(src->height / scale, 1U),
+  };
+  return_if_fail (src->colors != NULL) 0;
+
+  size_t sprite_size = (size_t) curres->width * curres->height;
+  struct PlzjColor *sprite = malloc(2 * sizeof(*sprite) * sprite_size);
+  return_if_fail (sprite != NULL) ERR_STD(malloc);
+  struct PlzjColor *masks = sprite + sprite_size;
+
+  for (uint32_t y = 0; y < curres->height; y++) {
+    for (uint32_t x = 0; x < curres->width; x++) {
+      uint32_t sums[3] = {0};
+      uint32_t area = 0;
+      uint32_t drawn = 0;
+      for (uint32_t sy = y * scale; sy < min((y + 1) * scale, src->height);
+           sy++) {
+        for (uint32_t sx = x * scale; sx < min((x + 1) * scale, src->width);
+             sx++) {
+          size_t offset = (size_t) src->width * sy + sx;
+          area++;
+          continue_if_fail (src->masks[offset].color != 0);
+          drawn++;
+          for (unsigned int c = 0; c < 3; c++) {
+            sums[c] += src->colors[offset].values[c];
+          }
+        }
+      }
 
-      struct PlzjColor *pixel =
-        canvas->pixels + width * (y + cursor->p.y) + x + cursor->p.x;
-      if (cursor->curres->gray) {
-        if (cursor_pixel != 0) {
-          *pixel = (struct PlzjColor) {0};  // black
+      struct PlzjColor color = {0};
+      bool draw = drawn > 0 && 2 * drawn >= area;
+      if (draw) {
+        for (unsigned int c = 0; c < 3; c++) {
+          color.values[c] = (sums[c] + drawn / 2) / drawn;
         }
-      } else if (BIT_FIELD(
-          alphas[cursor_offset / 8], 7 - (cursor_offset % 8), 1) == 0) {
-        const struct BMPColor *color = &colors[cursor_pixel];
-        *pixel = (struct PlzjColor) {
-          .r = color->r, .g = color->g, .b = color->b,
-        };
       }
+      sprite[curres->width * y + x] = color;
+      masks[curres->width * y + x].color = draw ? UINT32_MAX : 0;
     }
   }
 
-  if (rect_out != NULL) {
-    *rect_out = rect;
-  }
+  curres->colors = sprite;
+  curres->masks = masks;
   return 0;
 }
 
@@ -704,16 +1235,14 @@ end:
 
 
 static unsigned char *PlzjCanvas_get_png_scanline (
-    const struct PlzjCanvas *canvas, size_t *lenp) {
+    const struct PlzjCanvas *canvas, size_t *lenp,
+    struct PlzjBufPool *bufpool) {
   uint32_t scanline_width = canvas->width;
   uint32_t scanline_height = canvas->height;
 
   size_t scanline_len = (1 + 3 * scanline_width) * scanline_height;
-  unsigned char *scanline = malloc(scanline_len);
-  if_fail (scanline != NULL) {
-    (void) ERR_STD(malloc);
-    return NULL;
-  }
+  unsigned char *scanline = PlzjBufPool_alloc(bufpool, scanline_len);
+  return_if_fail (scanline != NULL) NULL;
 
   for (uint32_t y = 0; y < scanline_height; y++) {
     scanline[(1 + 3 * scanline_width) * y] = 0;
@@ -730,25 +1259,22 @@ static unsigned char *PlzjCanvas_get_png_scanline (
 
 static unsigned char *PlzjCanvas_get_png_diff (
     const struct PlzjCanvas *canvas, const struct PlzjCanvas *old,
-    const struct PlzjRect *rect, size_t *lenp) {
+    const struct PlzjRect *rect, size_t *lenp, struct PlzjBufPool *bufpool) {
   if_fail (PlzjCanvas_op2rect_valid(canvas, old, rect)) {
     (void) ERR(PL_EINVAL);
     return NULL;
   }
 
   if (rect == NULL) {
-    return PlzjCanvas_get_png_scanline(canvas, lenp);
+    return PlzjCanvas_get_png_scanline(canvas, lenp, bufpool);
   }
 
   uint32_t scanline_width = PlzjRect_width(rect);
   uint32_t scanline_height = PlzjRect_height(rect);
 
   size_t scanline_len = (1 + 3 * scanline_width) * scanline_height;
-  unsigned char *scanline = malloc(scanline_len);
-  if_fail (scanline != NULL) {
-    (void) ERR_STD(malloc);
-    return NULL;
-  }
+  unsigned char *scanline = PlzjBufPool_alloc(bufpool, scanline_len);
+  return_if_fail (scanline != NULL) NULL;
 
   for (uint32_t y = 0; y < scanline_height; y++) {
     scanline[(1 + 3 * scanline_width) * y] = 0;
@@ -809,12 +1335,86 @@ static int PlzjCanvas_init (
 }
 
 
-bool PlzjImage_valid (
-    const struct PlzjImage *image, uint32_t width, uint32_t height) {
-  return_if_fail (image->buf.data != NULL) false;
+__attribute_artificial__
+static inline int32_t plzj_div_floor (int32_t a, int32_t b) {
+  // b > 0
+  return a / b - (a % b < 0);
+}
 
-  return_if_fail (image->rect.p1.x >= 0 && image->rect.p2.x >= 0) false;
-  return_if_fail (PlzjRect_valid(&image->rect)) false;
+
+/**
+ * @brief Get the area of `rect` after shrinking by `scale`, including every
+ *   block it touches.
+ */
+static void PlzjRect_downscale (struct PlzjRect *rect, unsigned int scale) {
+  *rect = (struct PlzjRect) {
+    {plzj_div_floor(rect->p1.x, scale), plzj_div_floor(rect->p1.y, scale)},
+    {plzj_div_floor(rect->p2.x + scale - 1, scale),
+     plzj_div_floor(rect->p2.y + scale - 1, scale)}
+  };
+}
+
+
+/**
+ * @brief Box filter `rect` of `canvas` from `screen`, which is `scale` times
+ *   larger.
+ *
+ * Right and bottom pixels of `screen` not filling a block are dropped.
+ */
+int PlzjCanvas_downscale (
+    struct PlzjCanvas *canvas, const struct PlzjCanvas *screen,
+    const struct PlzjRect *rect, unsigned int scale) {
+  return_if_fail (PlzjCanvas_op1rect_valid(canvas, rect)) ERR(PL_EINVAL);
+  return_if_fail (scale > 0 && scale <= PLZJ_DOWNSCALE_MAX) ERR(PL_EINVAL);
+  return_if_fail (
+    (uint64_t) canvas->width * scale <= screen->width &&
+    (uint64_t) canvas->height * scale <= screen->height) ERR(PL_EINVAL);
+
+  uint32_t area = scale * scale;
+  // one chunk of columns at a time, so the sums stay small
+  uint32_t sums[3 * PLZJ_DOWNSCALE_CHUNK];
+
+  for (int32_t y = rect->p1.y; y < rect->p2.y; y++) {
+    struct PlzjColor *pixels = canvas->pixels + (size_t) canvas->width * y;
+    for (int32_t left = rect->p1.x; left < rect->p2.x;
+         left += PLZJ_DOWNSCALE_CHUNK) {
+      uint32_t chunk_width = min(
+        (uint32_t) (rect->p2.x - left), (uint32_t) PLZJ_DOWNSCALE_CHUNK);
+
+      memset(sums, 0, sizeof(*sums) * 3 * chunk_width);
+      for (unsigned int dy = 0; dy < scale; dy++) {
+        const struct PlzjColor *row = screen->pixels +
+          (size_t) screen->width * ((size_t) y * scale + dy) +
+          (size_t) left * scale;
+        for (uint32_t x = 0; x < chunk_width; x++) {
+          for (unsigned int dx = 0; dx < scale; dx++) {
+            const struct PlzjColor *pixel = row + (size_t) x * scale + dx;
+            sums[3 * x] += pixel->r;
+            sums[3 * x + 1] += pixel->g;
+            sums[3 * x + 2] += pixel->b;
+          }
+        }
+      }
+
+      for (uint32_t x = 0; x < chunk_width; x++) {
+        pixels[left + x] = (struct PlzjColor) {
+          .r = (sums[3 * x] + area / 2) / area,
+          .g = (sums[3 * x + 1] + area / 2) / area,
+          .b = (sums[3 * x + 2] + area / 2) / area,
+        };
+      }
+    }
+  }
+  return 0;
+}
+
+
+bool PlzjImage_valid (
+    const struct PlzjImage *image, uint32_t width, uint32_t height) {
+  return_if_fail (image->buf.data != NULL) false;
+
+  return_if_fail (image->rect.p1.x >= 0 && image->rect.p2.x >= 0) false;
+  return_if_fail (PlzjRect_valid(&image->rect)) false;
   return_if_fail ((unsigned int) image->rect.p2.x <= width &&
                   (unsigned int) image->rect.p2.y <= height) false;
 
@@ -836,11 +1436,20 @@ bool PlzjImage_valid (
 }
 
 
-int PlzjImage_apply (const struct PlzjImage *image, struct PlzjCanvas *canvas) {
+/**
+ * @brief Apply the part of `image` covered by `canvas`, whose top-left pixel
+ *   is at `origin` of the screen.
+ *
+ * Only the overlapping rows and columns are converted.
+ */
+static int PlzjImage_apply_at (
+    const struct PlzjImage *image, struct PlzjCanvas *canvas,
+    const struct PlzjPoint *origin) {
   uint32_t width = canvas->width;
-  uint32_t height = canvas->height;
 
-  return_if_fail (PlzjImage_valid(image, width, height)) ERR(PL_EINVAL);
+  // the image may extend out of the canvas, clipped below
+  return_if_fail (PlzjImage_valid(image, UINT32_MAX, UINT32_MAX))
+    ERR(PL_EINVAL);
 
   const BITMAPFILEHEADER *header = (const void *) image->buf.data;
   const BITMAPINFOHEADER *info = (const void *) (header + 1);
@@ -887,12 +1496,20 @@ int PlzjImage_apply (const struct PlzjImage *image, struct PlzjCanvas *canvas) {
   const uint16_t *bmp_canvas = (const void *) (
     (const unsigned char *) image->buf.data + le32toh(header->bfOffBits));
 
-  for (uint32_t y = 0; y < bmp_height; y++) {
-    for (uint32_t x = 0; x < bmp_width; x++) {
+  // overlap, relative to the image
+  int32_t left = image->rect.p1.x - origin->x;
+  int32_t top = image->rect.p1.y - origin->y;
+  uint32_t x1 = max(-left, 0);
+  uint32_t y1 = max(-top, 0);
+  uint32_t x2 = clamp((int64_t) width - left, 0, (int64_t) bmp_width);
+  uint32_t y2 = clamp((int64_t) canvas->height - top, 0, (int64_t) bmp_height);
+
+  for (uint32_t y = y1; y < y2; y++) {
+    for (uint32_t x = x1; x < x2; x++) {
       // bmp is upside down
       size_t bmp_offset = bmp_width_h * (bmp_height - y - 1) + x;
       struct PlzjColor *pixel =
-        canvas->pixels + width * (y + image->rect.p1.y) + x + image->rect.p1.x;
+        canvas->pixels + (size_t) width * (y + top) + x + left;
 
       for (unsigned int c = 0; c < 3; c++) {
         pixel->values[c] = to_depth8(
@@ -907,6 +1524,13 @@ int PlzjImage_apply (const struct PlzjImage *image, struct PlzjCanvas *canvas) {
 }
 
 
+int PlzjImage_apply (const struct PlzjImage *image, struct PlzjCanvas *canvas) {
+  return_if_fail (PlzjImage_valid(image, canvas->width, canvas->height))
+    ERR(PL_EINVAL);
+  return PlzjImage_apply_at(image, canvas, &(struct PlzjPoint) {0, 0});
+}
+
+
 int PlzjImage_print (
     const struct PlzjImage *image, FILE *out, off_t offset) {
   int ret = fputs("  Type: image\n", out);
@@ -981,7 +1605,7 @@ static int PlzjImage_uncompress_zlib (
 // lxefileplay::jieyasuobmp()
 static int PlzjImage_uncompress_type (
     void *dst, size_t *dstlenp, void *src, size_t srclen, const void *key,
-    unsigned int video_type) {
+    unsigned int video_type, struct PlzjBufPool *bufpool) {
   return_if_fail (video_type <= (PLZJ_VIDEO_ZLIB | PLZJ_VIDEO_ENC))
     ERR(PL_ENOTSUP);
 
@@ -994,8 +1618,8 @@ static int PlzjImage_uncompress_type (
 
   if ((video_type & PLZJ_VIDEO_ZLIB) != 0) {
     size_t buflen = le32toh(*(uint32_t *) src);
-    buf = malloc(buflen);
-    return_if_fail (buf != NULL) ERR_STD(malloc);
+    buf = PlzjBufPool_alloc(bufpool, buflen);
+    return_if_fail (buf != NULL) -sc_exc.code;
 
     ret = PlzjImage_uncompress_zlib(buf, &buflen, src, srclen);
     goto_if_fail (ret == 0) fail;
@@ -1006,14 +1630,17 @@ static int PlzjImage_uncompress_type (
 
   ret = PlzjImage_uncompress_rle(dst, dstlenp, src, srclen);
 fail:
-  free(buf);
+  if (buf != NULL) {
+    PlzjBufPool_free(bufpool, buf);
+  }
   return ret;
 }
 
 
 // lxefileplay::jkjieyasuobmp()
 static int PlzjImage_uncompress_jk (
-    void *dst, size_t *dstlenp, void *src, size_t srclen, const void *key) {
+    void *dst, size_t *dstlenp, void *src, size_t srclen, const void *key,
+    struct PlzjBufPool *bufpool) {
   return_if_fail (*(uint64_t *) src == (uint64_t) -1) ERR(PL_EFORMAT);
 
   unsigned int video_type = le32toh(((uint32_t *) src)[2]);
@@ -1030,16 +1657,17 @@ static int PlzjImage_uncompress_jk (
         PRIuSIZE "", buflen, *dstlenp);
     }
     return PlzjImage_uncompress_type(
-      dst, dstlenp, src_, srclen_, key, video_type);
+      dst, dstlenp, src_, srclen_, key, video_type, bufpool);
   }
 
   return_if_fail (*dstlenp >= 54 && buflen > 0) ERR(PL_EINVAL);
 
-  void *buf = malloc(buflen);
-  return_if_fail (buf != NULL) ERR_STD(malloc);
+  void *buf = PlzjBufPool_alloc(bufpool, buflen);
+  return_if_fail (buf != NULL) -sc_exc.code;
 
   int ret = PlzjImage_uncompress_type(
-    buf, &buflen, src_, srclen_, key, video_type / PLZJ_VIDEO_JK_MUL);
+    buf, &buflen, src_, srclen_, key, video_type / PLZJ_VIDEO_JK_MUL,
+    bufpool);
   goto_if_fail (ret == 0 && buflen > 8) fail;
 
   // lxefileplay::buildbmpfilehead()
@@ -1112,43 +1740,51 @@ static int PlzjImage_uncompress_jk (
 
   ret = 0;
 fail:
-  free(buf);
+  PlzjBufPool_free(bufpool, buf);
   return ret;
 }
 
 
 static int PlzjImage_uncompress (
     void *dst, size_t *dstlenp, void *src, size_t srclen, const void *key,
-    unsigned int video_type) {
+    unsigned int video_type, struct PlzjBufPool *bufpool) {
   return *(uint64_t *) src == (uint64_t) -1 ?
-    PlzjImage_uncompress_jk(dst, dstlenp, src, srclen, key) :
-    PlzjImage_uncompress_type(dst, dstlenp, src, srclen, key, video_type);
+    PlzjImage_uncompress_jk(dst, dstlenp, src, srclen, key, bufpool) :
+    PlzjImage_uncompress_type(
+      dst, dstlenp, src, srclen, key, video_type, bufpool);
 }
 
 
-int PlzjImage_read (
+/**
+ * @brief Read and decode an image, with all buffers taken from `bufpool`.
+ *
+ * If `bufpool` is not `NULL`, `image->buf.data` must be given back with
+ * PlzjBufPool_put() instead of PlzjImage_destroy().
+ */
+static int PlzjImage_read_pool (
     struct PlzjImage *image, FILE *file, unsigned int video_type,
-    const void *key, bool temp_use) {
+    const void *key, bool temp_use, struct PlzjBufPool *bufpool) {
   return_if_fail (image->seg.size > 0) 0;
   return_if_fail (PlzjRect_valid(&image->rect)) ERR(PL_EFORMAT);
 
   size_t size = bmp_max_size(
     PlzjRect_width(&image->rect), PlzjRect_height(&image->rect));
-  unsigned char *data = malloc(size);
-  return_if_fail (data != NULL) ERR_STD(malloc);
+  unsigned char *data = PlzjBufPool_alloc(bufpool, size);
+  return_if_fail (data != NULL) -sc_exc.code;
 
   int ret;
 
   {
     struct PlzjBuffer raw;
-    ret = PlzjBuffer_init_file_seg(&raw, file, &image->seg);
+    ret = PlzjBuffer_init_file_pool(
+      &raw, file, image->seg.size, image->seg.offset, bufpool);
     goto_if_fail (ret == 0) fail;
     promise(raw.size > 0);
 
     ret = PlzjImage_uncompress(
-      data, &size, raw.data, raw.size, key, video_type);
+      data, &size, raw.data, raw.size, key, video_type, bufpool);
 
-    PlzjBuffer_destroy(&raw);
+    PlzjBufPool_free(bufpool, raw.data);
   }
   goto_if_fail (ret == 0) fail;
 
@@ -1161,7 +1797,7 @@ int PlzjImage_read (
     goto fail;
   }
 
-  if (!temp_use) {
+  if (!temp_use && bufpool == NULL) {
     unsigned char *new_data = realloc(data, size);
     if (new_data != NULL) {
       data = new_data;
@@ -1173,11 +1809,18 @@ int PlzjImage_read (
   return 0;
 
 fail:
-  free(data);
+  PlzjBufPool_free(bufpool, data);
   return ret;
 }
 
 
+int PlzjImage_read (
+    struct PlzjImage *image, FILE *file, unsigned int video_type,
+    const void *key, bool temp_use) {
+  return PlzjImage_read_pool(image, file, video_type, key, temp_use, NULL);
+}
+
+
 int PlzjImage_init_file (struct PlzjImage *image, FILE *file) {
   struct PlzjLxeImage h_image;
   return_if_fail (fread(&h_image, sizeof(h_image), 1, file) == 1)
@@ -1198,11 +1841,266 @@ int PlzjFrame_apply (const struct PlzjFrame *frame, struct PlzjCanvas *canvas) {
 }
 
 
+int PlzjVideo_apply_frame (
+    const struct PlzjVideo *video, size_t i, struct PlzjCanvas *canvas) {
+  return_if_fail (i < video->frames_cnt) ERR(PL_EINVAL);
+
+  const struct PlzjImage *patches = PlzjVideo_frame_patches(video, i);
+  size_t patches_cnt = PlzjVideo_frame_patches_cnt(video, i);
+
+  int ret = 0;
+  for (size_t j = 0; j < patches_cnt; j++) {
+    ret = PlzjImage_apply(patches + j, canvas);
+    break_if_fail (ret == 0);
+  }
+
+  return ret;
+}
+
+
+static bool PlzjImage_full (
+    const struct PlzjImage *image, uint32_t width, uint32_t height) {
+  return image->rect.p1.x == 0 && image->rect.p1.y == 0 &&
+    image->rect.p2.x == (int32_t) width && image->rect.p2.y == (int32_t) height;
+}
+
+
+static void PlzjFrameCache_destroy (struct PlzjFrameCache *cache) {
+  for (size_t i = 0; i < cache->slots_cnt; i++) {
+    free(cache->slots[i].pixels);
+  }
+  free(cache->slots);
+  free(cache->keyframes);
+  PlzjBufPool_destroy(&cache->bufpool);
+}
+
+
+static int PlzjFrameCache_init (
+    struct PlzjFrameCache *cache, const struct PlzjVideo *video) {
+  uint32_t width = le32toh(video->pl->video.width);
+  uint32_t height = le32toh(video->pl->video.height);
+
+  size_t canvas_size = sizeof(struct PlzjColor) * width * height;
+  size_t slots_cnt = PLZJ_FRAME_CACHE_SIZE_MAX / plzj_max(canvas_size, 1);
+  slots_cnt = plzj_clamp(
+    slots_cnt, PLZJ_FRAME_CACHE_SLOTS_MIN, PLZJ_FRAME_CACHE_SLOTS_MAX);
+
+  cache->slots = malloc(sizeof(*cache->slots) * slots_cnt);
+  return_if_fail (cache->slots != NULL) ERR_STD(malloc);
+  for (size_t i = 0; i < slots_cnt; i++) {
+    cache->slots[i] = (struct PlzjFrameSlot) {.frame_i = SIZE_MAX};
+  }
+  cache->slots_cnt = slots_cnt;
+  cache->tick = 0;
+
+  int ret;
+
+  cache->keyframes = malloc(sizeof(*cache->keyframes) * video->frames_cnt);
+  if_fail (cache->keyframes != NULL || video->frames_cnt == 0) {
+    ret = ERR_STD(malloc);
+    goto fail_keyframes;
+  }
+  cache->keyframes_cnt = 0;
+  for (size_t i = 0; i < video->frames_cnt; i++) {
+    const struct PlzjImage *patches = PlzjVideo_frame_patches(video, i);
+    size_t patches_cnt = PlzjVideo_frame_patches_cnt(video, i);
+    for (size_t j = 0; j < patches_cnt; j++) {
+      if (PlzjImage_full(patches + j, width, height)) {
+        cache->keyframes[cache->keyframes_cnt] = i;
+        cache->keyframes_cnt++;
+        break;
+      }
+    }
+  }
+
+  ret = PlzjBufPool_init(&cache->bufpool);
+  goto_if_fail (ret == 0) fail_bufpool;
+  return 0;
+
+fail_bufpool:
+  free(cache->keyframes);
+fail_keyframes:
+  free(cache->slots);
+  return ret;
+}
+
+
+/**
+ * @brief Apply patches of frame `i` to `canvas`, starting from `begin`-th.
+ */
+static int PlzjVideo_replay_frame (
+    const struct PlzjVideo *video, size_t i, size_t begin,
+    struct PlzjCanvas *canvas, struct PlzjBufPool *bufpool) {
+  const struct Plzj *pl = video->pl;
+  const struct PlzjImage *patches = PlzjVideo_frame_patches(video, i);
+  size_t patches_cnt = PlzjVideo_frame_patches_cnt(video, i);
+
+  for (size_t j = begin; j < patches_cnt; j++) {
+    const struct PlzjImage *patch = patches + j;
+
+    if (patch->buf.data != NULL) {
+      return_with_nonzero (PlzjImage_apply(patch, canvas));
+      continue;
+    }
+
+    struct PlzjImage patch_tmp = *patch;
+    return_with_nonzero (PlzjImage_read_pool(
+      &patch_tmp, pl->file, le32toh(pl->player.video_type),
+      pl->key_set <= 0 ? NULL : pl->key, true, bufpool));
+    int ret = PlzjImage_apply(&patch_tmp, canvas);
+    PlzjBufPool_put(bufpool, patch_tmp.buf.data);
+    return_if_fail (ret == 0) ret;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief Reconstruct `slot` at frame `i`, from the nearest keyframe or cached
+ *   canvas before it, whichever is closer.
+ *
+ * @param base Cached canvas at or before `i`, can be `NULL`.
+ */
+static int PlzjVideo_reconstruct (
+    const struct PlzjVideo *video, size_t i, struct PlzjFrameSlot *slot,
+    const struct PlzjFrameSlot *base) {
+  struct PlzjFrameCache *cache = video->frame_cache;
+  struct PlzjCanvas canvas = {
+    .pixels = slot->pixels,
+    .width = le32toh(video->pl->video.width),
+    .height = le32toh(video->pl->video.height),
+  };
+
+  // number of keyframes at or before `i`
+  size_t lo = 0;
+  size_t hi = cache->keyframes_cnt;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (cache->keyframes[mid] <= i) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  size_t from;
+  if (base != NULL && (lo == 0 || base->frame_i >= cache->keyframes[lo - 1])) {
+    if (base != slot) {
+      memcpy(canvas.pixels, base->pixels,
+             sizeof(*canvas.pixels) * canvas.width * canvas.height);
+    }
+    from = base->frame_i + 1;
+  } else if (lo == 0) {
+    PlzjCanvas_set(&canvas, PLZJ_PNG_TRANSPARENT);
+    from = 0;
+  } else {
+    size_t key = cache->keyframes[lo - 1];
+    const struct PlzjImage *patches = PlzjVideo_frame_patches(video, key);
+
+    // patches before the last full one of the keyframe are covered anyway
+    size_t begin = PlzjVideo_frame_patches_cnt(video, key);
+    do {
+      begin--;
+    } while (!PlzjImage_full(patches + begin, canvas.width, canvas.height));
+
+    return_with_nonzero (PlzjVideo_replay_frame(
+      video, key, begin, &canvas, &cache->bufpool));
+    from = key + 1;
+  }
+
+  for (size_t j = from; j <= i; j++) {
+    return_with_nonzero (PlzjVideo_replay_frame(
+      video, j, 0, &canvas, &cache->bufpool));
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Get the canvas at frame `i`.
+ *
+ * The canvas is replayed from the nearest keyframe, or from a recently
+ * reconstructed canvas before `i` if that is closer, so sequential and nearby
+ * requests only apply the patches in between.
+ *
+ * Not thread-safe, since reconstructed canvases are cached in `video`.
+ *
+ * @param[out] canvas Canvas of the video size.
+ */
+int PlzjVideo_get_frame (
+    struct PlzjVideo *video, size_t i, struct PlzjCanvas *canvas) {
+  return_if_fail (i < video->frames_cnt) ERR(PL_EINVAL);
+  return_if_fail (video->pl->key_set >= 0) ERR(PL_EKEY);
+  return_if_fail (
+    canvas->width == le32toh(video->pl->video.width) &&
+    canvas->height == le32toh(video->pl->video.height)) ERR(PL_EINVAL);
+
+  if (video->frame_cache == NULL) {
+    struct PlzjFrameCache *cache = malloc(sizeof(*cache));
+    return_if_fail (cache != NULL) ERR_STD(malloc);
+    int ret = PlzjFrameCache_init(cache, video);
+    if_fail (ret == 0) {
+      free(cache);
+      return ret;
+    }
+    video->frame_cache = cache;
+  }
+
+  struct PlzjFrameCache *cache = video->frame_cache;
+  size_t canvas_size = sizeof(*canvas->pixels) * canvas->width * canvas->height;
+  cache->tick++;
+
+  // nearest cached canvas at or before `i`, and the least recently used slot
+  struct PlzjFrameSlot *base = NULL;
+  struct PlzjFrameSlot *slot = cache->slots;
+  for (size_t j = 0; j < cache->slots_cnt; j++) {
+    struct PlzjFrameSlot *s = cache->slots + j;
+    if (s->frame_i <= i && (base == NULL || s->frame_i > base->frame_i)) {
+      base = s;
+    }
+    if (s->used < slot->used) {
+      slot = s;
+    }
+  }
+
+  if (base == NULL || base->frame_i != i) {
+    if (slot->pixels == NULL) {
+      slot->pixels = malloc(canvas_size);
+      return_if_fail (slot->pixels != NULL) ERR_STD(malloc);
+    }
+
+    int ret = PlzjVideo_reconstruct(video, i, slot, base);
+    if_fail (ret == 0) {
+      slot->frame_i = SIZE_MAX;
+      slot->used = 0;
+      return ret;
+    }
+    slot->frame_i = i;
+    base = slot;
+  }
+
+  base->used = cache->tick;
+  memcpy(canvas->pixels, base->pixels, canvas_size);
+  return 0;
+}
+
+
+/**
+ * @brief Write compressed frames in order.
+ *
+ * @param final All frames have been appended.
+ */
+static int PlzjEncoder_write_frames (struct PlzjEncoder *encoder, bool final) {
+  return encoder->to_mkv ? plzj_mkv_write_frames(encoder) :
+    plzj_png_write_frames(encoder->png_ptr, encoder, final);
+}
+
+
 static int PlzjEncoder_stop (
     struct PlzjEncoder *encoder, uint32_t timecode_ms) {
   // append end frame
-  struct PlzjPngFrame *frame_end = ptrarray_new(
-    &encoder->frames, &encoder->frames_len, sizeof(*frame_end));
+  struct PlzjPngFrame *frame_end = PlzjEncoder_new_frame(encoder);
   return_if_fail (frame_end != NULL) -sc_exc.code;
   encoder->frames_len--;
 
@@ -1211,10 +2109,10 @@ static int PlzjEncoder_stop (
   frame_end->fdAT = NULL;
   frame_end->size = 0;
 
-  // set patches counts
+  // set patches counts, streaming counts them while writing
   uint32_t last_timecode_ms = timecode_ms;
   uint32_t patches_remain = 0;
-  for (size_t i = encoder->frames_len; i > 0; ) {
+  for (size_t i = encoder->streaming ? 0 : encoder->frames_len; i > 0; ) {
     i--;
     struct PlzjPngFrame *frame = encoder->frames[i];
     if (frame->timecode_ms == last_timecode_ms) {
@@ -1233,7 +2131,7 @@ static int PlzjEncoder_stop (
     goto fail;
   }
 
-  ret = plzj_png_write_frames(encoder->png_ptr, encoder);
+  ret = PlzjEncoder_write_frames(encoder, true);
   goto_if_fail (ret == 0) fail;
 
   if_fail (encoder->frame_i == encoder->frames_len) {
@@ -1242,17 +2140,167 @@ static int PlzjEncoder_stop (
       " expected\n", encoder->frame_i, encoder->frames_len);
   }
 
-  ret = plzj_png_write_timecodes(
-    encoder->png_ptr, encoder->frames, encoder->frames_len,
-    encoder->acTL_offset);
+  ret = encoder->to_mkv ? PlzjMkv_finish(&encoder->mkv, timecode_ms) :
+    encoder->streaming ? plzj_png_finish_stream(
+      encoder->png_ptr, encoder->frame_i, encoder->frames_total) :
+    plzj_png_write_timecodes(
+      encoder->png_ptr, encoder->frames, encoder->frames_len,
+      encoder->acTL_offset);
+  goto_if_fail (ret == 0) fail;
+
+  if (!encoder->to_mkv) {
+    ret = PlzjOutBuf_flush(&encoder->outbuf);
+    goto_if_fail (ret == 0) fail;
+  }
+
+fail:
+  PlzjEncoder_free_frame(encoder, frame_end);
+  return ret;
+}
+
+
+/**
+ * @brief Wait until all appended frames are written.
+ */
+static int PlzjEncoder_flush (struct PlzjEncoder *encoder) {
+  while (true) {
+    // sample before writing, so a frame finished meanwhile is not missed
+    unsigned long done = ThreadPool_done(&encoder->pool);
+    return_with_nonzero (PlzjEncoder_write_frames(encoder, false));
+    if (encoder->frame_i >= encoder->frames_len) {
+      break;
+    }
+
+    const struct ScException *exc;
+    int ret = ThreadPool_get_err(&encoder->pool, &exc);
+    if_fail (ret == 0) {
+      sc_exc = *exc;
+      return ret;
+    }
+    return_with_nonzero (ThreadPool_wait(&encoder->pool, done));
+  }
+  return 0;
+}
+
+
+static void *PlzjCanvas_compress (
+    const struct PlzjCanvas *canvas, size_t *lenp) {
+  uLong size =
+    sizeof(*canvas->pixels) * (uLong) canvas->width * canvas->height;
+  uLongf len = compressBound(size);
+  Bytef *dst = malloc(len);
+  if_fail (dst != NULL) {
+    (void) ERR_STD(malloc);
+    return NULL;
+  }
+
+  int res = compress2(
+    dst, &len, (const Bytef *) canvas->pixels, size, Z_BEST_SPEED);
+  if_fail (res == Z_OK) {
+    (void) ERR_ZLIB(compress2, res);
+    free(dst);
+    return NULL;
+  }
+  *lenp = len;
+  return dst;
+}
+
+
+static int PlzjCanvas_uncompress (
+    struct PlzjCanvas *canvas, const void *src, size_t srclen) {
+  uLong size =
+    sizeof(*canvas->pixels) * (uLong) canvas->width * canvas->height;
+  uLongf len = size;
+  int res = uncompress((Bytef *) canvas->pixels, &len, src, srclen);
+  return_if_fail (res == Z_OK) ERR_ZLIB(uncompress, res);
+  return_if_fail (len == size) ERR(PL_EFORMAT);
+  return 0;
+}
+
+
+/**
+ * @brief Save the state of encoder into checkpoint file.
+ *
+ * @param ckpt Checkpoint with the state of caller, filled with the state of
+ *   encoder and destroyed.
+ */
+static int PlzjEncoder_save_checkpoint (
+    struct PlzjEncoder *encoder, struct PlzjCheckpoint *ckpt,
+    const char *path) {
+  int ret;
+
+  ret = PlzjEncoder_flush(encoder);
   goto_if_fail (ret == 0) fail;
 
+  ret = PlzjOutBuf_flush(&encoder->outbuf);
+  goto_if_fail (ret == 0) fail;
+  // the checkpoint must not survive a crash that loses the data it refers to
+  if_fail (sync_fd(encoder->outbuf.fd) == 0) {
+    ret = ERR_STD(sync_fd);
+    goto fail;
+  }
+  ckpt->out_offset = PlzjOutBuf_tell(&encoder->outbuf);
+  ckpt->acTL_offset = encoder->acTL_offset;
+
+  ckpt->frames = malloc(sizeof(*ckpt->frames) * (encoder->frames_len + 1));
+  if_fail (ckpt->frames != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail;
+  }
+  ckpt->frames_cnt = encoder->frames_len;
+  for (size_t i = 0; i < encoder->frames_len; i++) {
+    const struct PlzjPngFrame *png_frame = encoder->frames[i];
+    ckpt->frames[i] = (struct PlzjCheckpointFrame) {
+      png_frame->rect, png_frame->timecode_ms, png_frame->size};
+  }
+
+  ckpt->canvas = PlzjCanvas_compress(&encoder->canvas, &ckpt->canvas_len);
+  if_fail (ckpt->canvas != NULL) {
+    ret = -sc_exc.code;
+    goto fail;
+  }
+  ckpt->canvas_last = PlzjCanvas_compress(
+    &encoder->canvas_last, &ckpt->canvas_last_len);
+  if_fail (ckpt->canvas_last != NULL) {
+    ret = -sc_exc.code;
+    goto fail;
+  }
+
+  ret = PlzjCheckpoint_save(ckpt, path);
+
 fail:
-  free(frame_end);
+  PlzjCheckpoint_destroy(ckpt);
   return ret;
 }
 
 
+/**
+ * @brief Restore the state of encoder from checkpoint.
+ */
+static int PlzjEncoder_restore (
+    struct PlzjEncoder *encoder, const struct PlzjCheckpoint *ckpt) {
+  return_with_nonzero (PlzjCanvas_uncompress(
+    &encoder->canvas, ckpt->canvas, ckpt->canvas_len));
+  return_with_nonzero (PlzjCanvas_uncompress(
+    &encoder->canvas_last, ckpt->canvas_last, ckpt->canvas_last_len));
+
+  for (size_t i = 0; i < ckpt->frames_cnt; i++) {
+    struct PlzjPngFrame *frame = PlzjEncoder_new_frame(encoder);
+    return_if_fail (frame != NULL) -sc_exc.code;
+
+    const struct PlzjCheckpointFrame *ckpt_frame = &ckpt->frames[i];
+    frame->rect = ckpt_frame->rect;
+    frame->timecode_ms = ckpt_frame->timecode_ms;
+    frame->patches_remain = 0;
+    frame->fdAT = NULL;
+    frame->size = ckpt_frame->size;
+  }
+  encoder->frame_i = encoder->frames_len;
+  encoder->acTL_offset = ckpt->acTL_offset;
+  return 0;
+}
+
+
 static int PlzjEncoder_append (
     struct PlzjEncoder *encoder, uint32_t timecode_ms,
     const struct PlzjRect *rect_hint, struct PlzjRect *rect_out) {
@@ -1260,6 +2308,16 @@ static int PlzjEncoder_append (
   return_if_fail (PlzjCanvas_diff(
     &encoder->canvas, &encoder->canvas_last, rect_hint, &rect)) 1;
 
+  if (encoder->counting) {
+    encoder->frames_total++;
+    return_with_nonzero (PlzjCanvas_copy(
+      &encoder->canvas_last, &encoder->canvas, &rect));
+    if (rect_out != NULL) {
+      *rect_out = rect;
+    }
+    return 0;
+  }
+
   sc_verbose(
     "Drawing frame %" PRIuSIZE " at %" PRIu32 " ms from (%" PRId32 ", %" PRId32
     ") to (%" PRId32 ", %" PRId32 ")\n",
@@ -1269,22 +2327,29 @@ static int PlzjEncoder_append (
   size_t size;
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
-  unsigned char *scanline = PlzjCanvas_get_png_diff(
-    &encoder->canvas, &encoder->canvas_last, &rect, &size);
+  // Matroska blocks are independent, always store the whole canvas
+  unsigned char *scanline = encoder->to_mkv ?
+    PlzjCanvas_get_png_scanline(&encoder->canvas, &size, &encoder->bufpool) :
+    PlzjCanvas_get_png_diff(
+      &encoder->canvas, &encoder->canvas_last, &rect, &size,
+      &encoder->bufpool);
   return_if_fail (scanline != NULL) -sc_exc.code;
 
   int ret;
 
-  struct PlzjPngFrame *frame = ptrarray_new(
-    &encoder->frames, &encoder->frames_len, sizeof(*frame));
+  int level = PlzjZLevel_pick(
+    &encoder->zlevel, size, encoder->frames_len - encoder->frame_i,
+    encoder->nproc);
+
+  struct PlzjPngFrame *frame = PlzjEncoder_new_frame(encoder);
   if_fail (frame != NULL) {
     ret = -sc_exc.code;
     goto fail_frame;
   }
 
   ret = plzj_compress_bg(
-    scanline, size, 4, &frame->fdAT, &frame->size, encoder->compression_level,
-    &encoder->pool);
+    &frame->worker, scanline, size, 4, &frame->fdAT, &frame->size, level,
+    &encoder->pool, &encoder->bufpool, &encoder->zcache);
   goto_if_fail (ret == 0) fail_compress;
   frame->rect = rect;
   frame->timecode_ms = timecode_ms;
@@ -1292,7 +2357,7 @@ static int PlzjEncoder_append (
   ret = PlzjCanvas_copy(&encoder->canvas_last, &encoder->canvas, &rect);
   goto_if_fail (ret == 0) fail;
 
-  ret = plzj_png_write_frames(encoder->png_ptr, encoder);
+  ret = PlzjEncoder_write_frames(encoder, false);
   goto_if_fail (ret == 0) fail;
 
   if (rect_out != NULL) {
@@ -1303,14 +2368,89 @@ fail:
 #pragma GCC diagnostic pop
 
 fail_compress:
-  free(frame);
+  PlzjEncoder_free_frame(encoder, frame);
   encoder->frames_len--;
 fail_frame:
-  free(scanline);
+  PlzjBufPool_put(&encoder->bufpool, scanline);
   return ret;
 }
 
 
+/**
+ * @brief Get the position of highlight circle of cursor.
+ */
+static bool PlzjEncoder_highlight_rect (
+    const struct PlzjEncoder *encoder, const struct PlzjCursor *cursor,
+    uint32_t width, uint32_t height, struct PlzjPoint *center_out,
+    struct PlzjRect *rect_out) {
+  return_if_fail (encoder->highlight) false;
+
+  struct PlzjPoint center = cursor->p;
+  if (!encoder->highlight_at_corner && cursor->curres != NULL) {
+    center.x += cursor->curres->width / 2;
+    center.y += cursor->curres->height / 2;
+  }
+  return_if_fail (PlzjSpanMask_rect(
+    &encoder->highlight_mask, &center, width, height, rect_out)) false;
+
+  *center_out = center;
+  return true;
+}
+
+
+/**
+ * @brief Get the area covered by cursor and its highlight circle.
+ */
+static bool PlzjEncoder_cursor_rect (
+    const struct PlzjEncoder *encoder, const struct PlzjCursor *cursor,
+    uint32_t width, uint32_t height, struct PlzjRect *rect_out) {
+  struct PlzjRect rect_cursor;
+  bool draw_cursor = PlzjCursor_rect(cursor, width, height, &rect_cursor);
+
+  struct PlzjPoint highlight_center;
+  struct PlzjRect rect_highlight;
+  bool draw_highlight = PlzjEncoder_highlight_rect(
+    encoder, cursor, width, height, &highlight_center, &rect_highlight);
+
+  return_if_fail (draw_cursor || draw_highlight) false;
+  if (!draw_cursor) {
+    rect_cursor = rect_highlight;
+  } else if (draw_highlight) {
+    PlzjRect_iadd(&rect_cursor, &rect_highlight);
+  }
+
+  *rect_out = rect_cursor;
+  return true;
+}
+
+
+/**
+ * @brief Draw highlight circle, cursor and click rings onto `canvas`.
+ */
+static int PlzjEncoder_draw_cursor (
+    const struct PlzjEncoder *encoder, struct PlzjCanvas *canvas,
+    const struct PlzjCursor *cursor, bool draw_click) {
+  struct PlzjPoint highlight_center;
+  struct PlzjRect rect_highlight;
+  if (PlzjEncoder_highlight_rect(
+      encoder, cursor, canvas->width, canvas->height, &highlight_center,
+      &rect_highlight)) {
+    PlzjSpanMask_blend(
+      &encoder->highlight_mask, canvas, &highlight_center,
+      encoder->highlight_color, encoder->highlight_alpha);
+  }
+
+  int ret = PlzjCursor_apply(cursor, canvas, NULL);
+  return_if_fail (ret >= 0) ret;
+
+  if (draw_click) {
+    ret = PlzjClick_apply(&cursor->event, encoder->click_masks, canvas, NULL);
+    return_if_fail (ret >= 0) ret;
+  }
+  return 0;
+}
+
+
 static int PlzjEncoder_append_cursor (
     struct PlzjEncoder *encoder, uint32_t timecode_ms,
     const struct PlzjRect *rect_hint, struct PlzjRect *rect_out,
@@ -1319,9 +2459,12 @@ static int PlzjEncoder_append_cursor (
   uint32_t width = encoder->canvas_last.width;
   uint32_t height = encoder->canvas_last.height;
 
+  // area of highlight circle is restored together with the cursor, empty if
+  // the cursor is out of the canvas
   struct PlzjRect rect_cursor;
-
-  bool draw_cursor = PlzjCursor_rect(cursor, width, height, &rect_cursor);
+  PlzjRect_init(&rect_cursor);
+  bool draw_cursor = PlzjEncoder_cursor_rect(
+    encoder, cursor, width, height, &rect_cursor);
   bool draw_click = rect_click != NULL;
   int ret;
 
@@ -1331,14 +2474,8 @@ static int PlzjEncoder_append_cursor (
     goto_if_fail (ret == 0) fail;
   }
 
-  if (draw_cursor) {
-    ret = PlzjCursor_apply(cursor, &encoder->canvas, NULL);
-    goto_if_fail (ret >= 0) fail;
-  }
-  if (draw_click) {
-    ret = PlzjClick_apply(&cursor->event, &encoder->canvas, NULL);
-    goto_if_fail (ret >= 0) fail;
-  }
+  ret = PlzjEncoder_draw_cursor(encoder, &encoder->canvas, cursor, draw_click);
+  goto_if_fail (ret >= 0) fail;
 
   struct PlzjRect rect;
   if (rect_hint != NULL) {
@@ -1377,30 +2514,155 @@ fail:
 }
 
 
+static void PlzjEncoder_destroy_masks (const struct PlzjEncoder *encoder) {
+  PlzjSpanMask_destroy(&encoder->click_masks[0]);
+  PlzjSpanMask_destroy(&encoder->click_masks[1]);
+  if (encoder->highlight) {
+    PlzjSpanMask_destroy(&encoder->highlight_mask);
+  }
+}
+
+
 static void PlzjEncoder_destroy (struct PlzjEncoder *encoder) {
+  // workers may still hold frames and buffers
+  ThreadPool_destroy(&encoder->pool);
+
   PlzjCanvas_destroy(&encoder->canvas);
   PlzjCanvas_destroy(&encoder->canvas_last);
   PlzjCanvas_destroy(&encoder->canvas_swap);
+  if (encoder->scale > 1) {
+    PlzjCanvas_destroy(&encoder->screen);
+  }
+  for (size_t i = 0; i < encoder->curreses_cnt; i++) {
+    PlzjCursorRes_destroy(&encoder->curreses[i]);
+  }
+  free(encoder->curreses);
   for (size_t i = 0; i < encoder->frames_len; i++) {
+    if (encoder->frames[i] == NULL) {
+      continue;
+    }
     if_fail (encoder->frames[i]->fdAT == NULL) {
       sc_warning("encoder left frame %" PRIuSIZE " unprocessed\n", i);
-      free(encoder->frames[i]->fdAT);
+      PlzjBufPool_put(&encoder->bufpool, encoder->frames[i]->fdAT);
     }
-    free(encoder->frames[i]);
+    PlzjEncoder_free_frame(encoder, encoder->frames[i]);
   }
   free(encoder->frames);
-  png_destroy_write_struct(&encoder->png_ptr, NULL);
-  ThreadPool_destroy(&encoder->pool);
+  PlzjBufPool_destroy(&encoder->framepool);
+  PlzjEncoder_destroy_masks(encoder);
+  if (encoder->to_mkv) {
+    PlzjMkv_destroy(&encoder->mkv);
+  } else {
+    png_destroy_write_struct(&encoder->png_ptr, NULL);
+    PlzjOutBuf_destroy(&encoder->outbuf);
+  }
+  PlzjZCache_destroy(&encoder->zcache);
+  PlzjBufPool_destroy(&encoder->bufpool);
 }
 
 
+/**
+ * @brief Precompute shapes of click rings and cursor highlight.
+ *
+ * @param highlight Draw highlight circle, if enabled by the player.
+ */
+static int PlzjEncoder_init_masks (
+    struct PlzjEncoder *encoder, const struct PlzjLxePlayer *player,
+    bool highlight) {
+  uint32_t scale = encoder->scale;
+  uint32_t area = scale * scale;
+  const uint32_t ring_single[][2] = {{14 * 14 / area, 16 * 16 / area}};
+  const uint32_t ring_double[][2] = {
+    {14 * 14 / area, 16 * 16 / area}, {20 * 20 / area, 22 * 22 / area}
+  };
+  return_with_nonzero (PlzjSpanMask_init(
+    &encoder->click_masks[0], (16 + scale - 1) / scale, ring_single, 1));
+  int ret = PlzjSpanMask_init(
+    &encoder->click_masks[1], (22 + scale - 1) / scale, ring_double, 2);
+  goto_if_fail (ret == 0) fail_double;
+
+  encoder->highlight = highlight && (player->cursor_highlight & 1) != 0;
+  if (!encoder->highlight) {
+    return 0;
+  }
+
+  encoder->highlight_at_corner = (player->cursor_highlight & 2) != 0;
+  switch (player->cursor_highlight_color) {
+    case PLZJ_CURSOR_HIGHLIGHT_GREEN:
+      encoder->highlight_color = (struct PlzjColor) {.g = 0xff};
+      break;
+    case PLZJ_CURSOR_HIGHLIGHT_BLUE:
+      encoder->highlight_color = (struct PlzjColor) {.b = 0xff};
+      break;
+    case PLZJ_CURSOR_HIGHLIGHT_RED:
+      encoder->highlight_color = (struct PlzjColor) {.r = 0xff};
+      break;
+    default:
+      sc_debug(
+        "Unknown cursor highlight color %u\n",
+        player->cursor_highlight_color);
+      // fall through
+    case PLZJ_CURSOR_HIGHLIGHT_YELLOW:
+      encoder->highlight_color = (struct PlzjColor) {.r = 0xff, .g = 0xff};
+      break;
+  }
+
+  uint32_t transparency = min(
+    le16toh(player->cursor_highlight_transparency), 10000);
+  encoder->highlight_alpha = (10000 - transparency) * 256 / 10000;
+
+  int32_t radius = max(PLZJ_CURSOR_HIGHLIGHT_RADIUS / (int32_t) scale, 1);
+  const uint32_t disc[][2] = {{0, radius * radius}};
+  ret = PlzjSpanMask_init(&encoder->highlight_mask, radius, disc, 1);
+  goto_if_fail (ret == 0) fail_highlight;
+  return 0;
+
+fail_highlight:
+  PlzjSpanMask_destroy(&encoder->click_masks[1]);
+fail_double:
+  PlzjSpanMask_destroy(&encoder->click_masks[0]);
+  return ret;
+}
+
+
+/**
+ * @brief Clear the canvases to the state before the first frame.
+ */
+static void PlzjEncoder_clear (struct PlzjEncoder *encoder) {
+  PlzjCanvas_set(&encoder->canvas, PLZJ_PNG_TRANSPARENT);
+  PlzjCanvas_set(&encoder->canvas_last, PLZJ_PNG_TRANSPARENT);
+  if (encoder->scale > 1) {
+    PlzjCanvas_set(&encoder->screen, PLZJ_PNG_TRANSPARENT);
+  }
+}
+
+
+/**
+ * @param width,height Size of the screen, before downscaling.
+ * @param scale Output is `scale` times smaller in both directions.
+ */
 static int PlzjEncoder_init (
     struct PlzjEncoder *encoder, FILE *out, uint32_t width, uint32_t height,
-    const struct Plzj *pl, int compression_level, unsigned int nproc) {
+    unsigned int scale, const struct Plzj *pl, int compression_level,
+    float target_fps, float target_mbps, unsigned int nproc, bool to_mkv,
+    bool with_audio, bool highlight, bool streaming, bool resume) {
+  return_if_fail (scale > 0 && width >= scale && height >= scale)
+    ERR(PL_EINVAL);
+
   int ret;
 
+  encoder->scale = scale;
+  encoder->curreses = NULL;
+  encoder->curreses_cnt = 0;
+  if (scale > 1) {
+    ret = PlzjCanvas_init(&encoder->screen, width, height);
+    return_if_fail (ret == 0) ret;
+    width /= scale;
+    height /= scale;
+  }
+
   ret = PlzjCanvas_init(&encoder->canvas, width, height);
-  return_if_fail (ret == 0) ret;
+  goto_if_fail (ret == 0) fail_canvas;
 
   ret = PlzjCanvas_init(&encoder->canvas_last, width, height);
   goto_if_fail (ret == 0) fail_canvas_last;
@@ -1408,66 +2670,222 @@ static int PlzjEncoder_init (
   ret = PlzjCanvas_init(&encoder->canvas_swap, width, height);
   goto_if_fail (ret == 0) fail_canvas_swap;
 
+  encoder->to_mkv = to_mkv;
+  if (to_mkv) {
+    encoder->png_ptr = NULL;
+    encoder->acTL_offset = -1;
+    ret = PlzjMkv_init(&encoder->mkv, out, width, height, pl, with_audio);
+    goto_if_fail (ret == 0) fail_png_ptr;
+    goto init_pool;
+  }
+
+  ret = PlzjOutBuf_init(&encoder->outbuf, out);
+  goto_if_fail (ret == 0) fail_png_ptr;
+
   encoder->png_ptr = png_create_write_struct(
     PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if_fail (encoder->png_ptr != NULL) {
-    (void) ERR_PNG(png_create_write_struct);
-    goto fail_png_ptr;
+    ret = ERR_PNG(png_create_write_struct);
+    goto fail_outbuf;
   }
-  png_init_io(encoder->png_ptr, out);
+  png_set_write_fn(
+    encoder->png_ptr, &encoder->outbuf, plzj_png_write_data, plzj_png_flush);
+
+  // header has been written before the checkpoint
+  encoder->acTL_offset = -1;
+  if (!resume) {
+    ret = plzj_png_write_info(encoder->png_ptr, width, height, pl);
+    goto_if_fail (ret == 0) fail_png_ptr_scope;
+  }
+
+  // acTL of streaming goes before the first frame
+  if (!streaming && !resume) {
+    ret = plzj_png_save_acTL(encoder->png_ptr, &encoder->acTL_offset);
+    goto_if_fail (ret == 0) fail_png_ptr_scope;
+  }
+
+init_pool:
+  ret = PlzjBufPool_init(&encoder->bufpool);
+  goto_if_fail (ret == 0) fail_bufpool;
+
+  ret = PlzjZCache_init(&encoder->zcache, PLZJ_ZCACHE_SIZE_MAX);
+  goto_if_fail (ret == 0) fail_zcache;
 
-  ret = plzj_png_write_info(encoder->png_ptr, width, height, pl);
-  goto_if_fail (ret == 0) fail_png_ptr_scope;
+  ret = PlzjBufPool_init(&encoder->framepool);
+  goto_if_fail (ret == 0) fail_framepool;
 
-  ret = plzj_png_save_acTL(encoder->png_ptr, &encoder->acTL_offset);
-  goto_if_fail (ret == 0) fail_png_ptr_scope;
+  ret = PlzjEncoder_init_masks(encoder, &pl->player, highlight);
+  goto_if_fail (ret == 0) fail_masks;
 
   ret = ThreadPool_init(&encoder->pool, nproc, "png");
   goto_if_fail (ret == 0) fail_pool;
 
-  PlzjCanvas_set(&encoder->canvas_last, PLZJ_PNG_TRANSPARENT);
+  PlzjEncoder_clear(encoder);
   encoder->frames = NULL;
   encoder->frames_len = 0;
+  encoder->frames_cap = 0;
   encoder->frame_i = 0;
-  encoder->compression_level = compression_level;
+  encoder->streaming = !to_mkv && streaming;
+  encoder->counting = false;
+  encoder->frames_total = 0;
+  PlzjZLevel_init(
+    &encoder->zlevel, compression_level, target_fps, target_mbps);
+  if (nproc == 0) {
+    // pool has checked it
+    nproc = get_nproc();
+  }
+  encoder->nproc = nproc;
   return 0;
 
 fail_pool:
+  PlzjEncoder_destroy_masks(encoder);
+fail_masks:
+  PlzjBufPool_destroy(&encoder->framepool);
+fail_framepool:
+  PlzjZCache_destroy(&encoder->zcache);
+fail_zcache:
+  PlzjBufPool_destroy(&encoder->bufpool);
+fail_bufpool:
+  if (to_mkv) {
+    PlzjMkv_destroy(&encoder->mkv);
+    goto fail_png_ptr;
+  }
 fail_png_ptr_scope:
   png_destroy_write_struct(&encoder->png_ptr, NULL);
+fail_outbuf:
+  PlzjOutBuf_destroy(&encoder->outbuf);
 fail_png_ptr:
   PlzjCanvas_destroy(&encoder->canvas_swap);
 fail_canvas_swap:
   PlzjCanvas_destroy(&encoder->canvas_last);
 fail_canvas_last:
   PlzjCanvas_destroy(&encoder->canvas);
+fail_canvas:
+  if (scale > 1) {
+    PlzjCanvas_destroy(&encoder->screen);
+  }
   return ret;
 }
 
 
-#define DIM (2 * KERNEL_SIZE)
+/**
+ * @brief Prepare cursor sprites at the output size.
+ */
+static int PlzjEncoder_init_curreses (
+    struct PlzjEncoder *encoder, const struct PlzjVideo *video) {
+  return_if_fail (encoder->scale > 1 && video->curreses_cnt > 0) 0;
 
-#if 0
+  encoder->curreses = malloc(
+    sizeof(*encoder->curreses) * video->curreses_cnt);
+  return_if_fail (encoder->curreses != NULL) ERR_STD(malloc);
+
+  for (size_t i = 0; i < video->curreses_cnt; i++) {
+    return_with_nonzero (PlzjCursorRes_init_scaled(
+      &encoder->curreses[i], video->curreses[i], encoder->scale));
+    encoder->curreses_cnt++;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Map a point of the screen onto the output.
+ *
+ * Positions come from the file unchecked, so the result is clamped to
+ * `PLZJ_COORD_MAX`, leaving room for adding sizes of sprites and rings.
+ * Unknown positions (`INT32_MIN`) stay far out of the output.
+ *
+ * @param origin Top-left of the extracted region.
+ */
+static void PlzjEncoder_map_point (
+    const struct PlzjEncoder *encoder, const struct PlzjPoint *origin,
+    struct PlzjPoint *p) {
+  int64_t x = (int64_t) p->x - origin->x;
+  int64_t y = (int64_t) p->y - origin->y;
+  p->x = plzj_div_floor(
+    (int32_t) clamp(x, -PLZJ_COORD_MAX, PLZJ_COORD_MAX), encoder->scale);
+  p->y = plzj_div_floor(
+    (int32_t) clamp(y, -PLZJ_COORD_MAX, PLZJ_COORD_MAX), encoder->scale);
+}
 
-#include <math.h>
 
-#define KERNEL_SIZE 2
+/**
+ * @brief Map a cursor of the screen onto the output, with sprite of the
+ *   output size.
+ */
+static void PlzjEncoder_map_cursor (
+    const struct PlzjEncoder *encoder, const struct PlzjPoint *origin,
+    struct PlzjCursor *cursor) {
+  // invalid cursors are never drawn
+  return_if_fail (PlzjCursor_valid(cursor));
+  PlzjEncoder_map_point(encoder, origin, &cursor->p);
+  PlzjEncoder_map_point(encoder, origin, &cursor->event.p);
+  return_if_fail (encoder->curreses != NULL && cursor->curres != NULL);
+  for (size_t i = 0; i < encoder->curreses_cnt; i++) {
+    if (encoder->curreses[i].tag == cursor->curres->tag) {
+      cursor->curres = &encoder->curreses[i];
+      break;
+    }
+  }
+}
+
+
+/**
+ * @brief Apply a patch onto the output canvas.
+ *
+ * @param origin Top-left of the extracted region.
+ * @param[in,out] rect Area of the patch relative to `origin`, clamped to the
+ *   region; area changed on the output canvas on return.
+ * @return 0 on success, 1 if the output canvas does not change.
+ */
+static int PlzjEncoder_apply (
+    struct PlzjEncoder *encoder, const struct PlzjImage *patch,
+    const struct PlzjPoint *origin, struct PlzjRect *rect) {
+  unsigned int scale = encoder->scale;
+  if (scale <= 1) {
+    return PlzjImage_apply_at(patch, &encoder->canvas, origin);
+  }
 
+  return_with_nonzero (PlzjImage_apply_at(patch, &encoder->screen, origin));
 
+  struct PlzjRect box;
+  PlzjRect_init_box(&box, encoder->canvas.width, encoder->canvas.height);
+  PlzjRect_downscale(rect, scale);
+  PlzjRect_clamp(rect, rect, &box);
+  return_if_fail (PlzjRect_width(rect) > 0 && PlzjRect_height(rect) > 0) 1;
+  return PlzjCanvas_downscale(&encoder->canvas, &encoder->screen, rect, scale);
+}
+
+
+#define DIM 4
+/// fractional bits of kernel coefficients
+#define IPL_KERNEL_SHIFT 16
+
+
+/// resampling kernel in fixed point, `DIM` taps for each transition
 struct IplKernel {
-  float *coeffs;
+  int32_t *coeffs;
 };
 
 
+/**
+ * @brief Interpolate transition `i` between `samples[DIM / 2 - 1]` and
+ *   `samples[DIM / 2]`.
+ */
 static int32_t IplKernel_evaluate (
     const struct IplKernel *kern, const int32_t *samples, unsigned int i) {
-  const float *coeff = kern->coeffs + DIM * (i - 1);
-
-  float ret = 0;
-  for (unsigned int i = 0; i < DIM; i++) {
-    ret += coeff[i] * samples[i];
+  const int32_t *coeff = kern->coeffs + DIM * (i - 1);
+
+  // relative to the left sample, so equal samples give it back exactly;
+  // distant samples and overshooting kernels need 64 bits
+  int64_t base = samples[DIM / 2 - 1];
+  int64_t sum = 0;
+  for (unsigned int r = 0; r < DIM; r++) {
+    sum += coeff[r] * (samples[r] - base);
   }
-  return ret + .5;
+  int64_t ret =
+    base + ((sum + (1 << (IPL_KERNEL_SHIFT - 1))) >> IPL_KERNEL_SHIFT);
+  return clamp(ret, INT32_MIN, INT32_MAX);
 }
 
 
@@ -1476,7 +2894,49 @@ static void IplKernel_destroy (struct IplKernel *kern) {
 }
 
 
-static int IplKernel_init (struct IplKernel *kern, unsigned int k) {
+/**
+ * @brief Weights of the samples at offsets -1, 0, 1 and 2 for position `t`.
+ */
+static void plzj_interp_weights (
+    enum PlzjInterp interp, double t, double weights[DIM]) {
+  switch (interp) {
+    case PLZJ_INTERP_LINEAR:
+      weights[0] = 0;
+      weights[1] = 1 - t;
+      weights[2] = t;
+      weights[3] = 0;
+      break;
+    case PLZJ_INTERP_LANCZOS: {
+      double sum = 0;
+      for (unsigned int r = 0; r < DIM; r++) {
+        double x = (int) r - (DIM / 2 - 1) - t;
+        double pix = M_PI * x;
+        weights[r] = x == 0 ? 1 :
+          sin(pix) * sin(pix / (DIM / 2)) * (DIM / 2) / (pix * pix);
+        sum += weights[r];
+      }
+      for (unsigned int r = 0; r < DIM; r++) {
+        weights[r] /= sum;
+      }
+      break;
+    }
+    default:
+      // Catmull-Rom
+      weights[0] = (-t + 2 * t * t - t * t * t) / 2;
+      weights[1] = (2 - 5 * t * t + 3 * t * t * t) / 2;
+      weights[2] = (t + 4 * t * t - 3 * t * t * t) / 2;
+      weights[3] = (-t * t + t * t * t) / 2;
+      break;
+  }
+}
+
+
+/**
+ * @brief Precompute coefficients for `k - 1` transitions between two
+ *   samples.
+ */
+static int IplKernel_init (
+    struct IplKernel *kern, enum PlzjInterp interp, unsigned int k) {
   if_fail (k > 1) {
     kern->coeffs = NULL;
     return 0;
@@ -1485,231 +2945,743 @@ static int IplKernel_init (struct IplKernel *kern, unsigned int k) {
   kern->coeffs = malloc(sizeof(*kern->coeffs) * DIM * (k - 1));
   return_if_fail (kern->coeffs != NULL) ERR_STD(malloc);
 
-  unsigned int j;
-
-  for (j = 1; j <= (k + 1) / 2; j++) {
-    float *coeff = kern->coeffs + DIM * (j - 1);
-    float jk = - DIM / 2 + 1 - j / (float) k;
-
-    for (unsigned int r = 0; r < DIM; r++) {
-      float pix = M_PI * ((int) r + jk);
-      coeff[r] = sin(pix) * sin(pix / (DIM / 2)) / pix / pix;
-    }
-
-    for (unsigned int r = 0; r < DIM; r++) {
-      coeff[r] *= (DIM / 2);
-    }
-  }
+  for (unsigned int j = 1; j < k; j++) {
+    int32_t *coeff = kern->coeffs + DIM * (j - 1);
 
-  for (; j < k; j++) {
-    float *coeff = kern->coeffs + DIM * (j - 1);
-    float *coeff_ref = kern->coeffs + DIM * (k - j - 1);
+    double weights[DIM];
+    plzj_interp_weights(interp, j / (double) k, weights);
     for (unsigned int r = 0; r < DIM; r++) {
-      coeff[r] = coeff_ref[DIM - 1 - r];
+      coeff[r] = lround(weights[r] * (1 << IPL_KERNEL_SHIFT));
     }
   }
 
-  if (sc_log_begin(SC_LOG_DEBUG)) {
-    sc_log_print("Resampling kernel (row %u, dim %u):\n", k - 1, DIM);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-use-of-uninitialized-value"
+  if (sc_log_begin(SC_LOG_VERBOSE)) {
+    sc_log_print(
+      "Resampling kernel %d (row %u, dim %d, Q%d):\n", interp, k - 1, DIM,
+      IPL_KERNEL_SHIFT);
     for (unsigned int j = 1; j < k; j++) {
-      float *coeff = kern->coeffs + DIM * (j - 1);
+      int32_t *coeff = kern->coeffs + DIM * (j - 1);
       for (unsigned int r = 0; r < DIM; r++) {
-        sc_log_print(r == 0 ? "%f" : " %f", (float) coeff[r]);
+        sc_log_print(r == 0 ? "%" PRId32 : " %" PRId32, coeff[r]);
       }
       sc_log_print("\n");
     }
-    sc_log_end(SC_LOG_DEBUG);
+    sc_log_end(SC_LOG_VERBOSE);
   }
+#pragma GCC diagnostic pop
 
   return 0;
 }
 
-#elif 1
 
-#define KERNEL_SIZE 2
+/// cursor position of a transition frame
+struct PlzjCursorStep {
+  uint32_t timecode_ms;
+  struct PlzjPoint p;
+};
+
+
+/// interpolated cursor positions of all transition frames
+struct PlzjTrajectory {
+  struct PlzjCursorStep *steps;
+  /// steps of frame `i` are `steps[frame_steps[i]]` to
+  /// `steps[frame_steps[i + 1]]` (exclusive)
+  size_t *frame_steps;
+};
 
 
 __attribute_artificial__
-static inline int32_t dotII (const int32_t *v1, const int32_t *v2) {
-  int32_t ret = 0;
-  for (unsigned int i = 0; i < DIM; i++) {
-    ret += v1[i] * v2[i];
-  }
-  return ret;
+static inline size_t PlzjTrajectory_frame_steps_cnt (
+    const struct PlzjTrajectory *traj, size_t i) {
+  return traj->frame_steps[i + 1] - traj->frame_steps[i];
 }
 
 
-struct IplKernel {
-  int32_t *coeffs;
-  float magnitude;
-};
+static void PlzjTrajectory_destroy (struct PlzjTrajectory *traj) {
+  free(traj->steps);
+  free(traj->frame_steps);
+}
 
 
-static int32_t IplKernel_evaluate (
-    const struct IplKernel *kern, const int32_t *samples, unsigned int i) {
-  return kern->magnitude * dotII(kern->coeffs + DIM * (i - 1), samples) + .5;
+/**
+ * @brief Resample one coordinate track with kernel row `j`.
+ *
+ * @param track Coordinates of a run of valid cursors, padded with
+ *   `DIM / 2 - 1` copies of the first one and `DIM / 2` copies of the last
+ *   one.
+ * @param n Number of frames to evaluate.
+ * @param[out] out Coordinates of transition `j` of each frame.
+ */
+static void IplKernel_sweep (
+    const struct IplKernel *kern, const int32_t *restrict track, size_t n,
+    unsigned int j, int32_t *restrict out) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = IplKernel_evaluate(kern, track + i, j);
+  }
 }
 
 
-static void IplKernel_destroy (struct IplKernel *kern) {
-  free(kern->coeffs);
+/**
+ * @brief Pad the coordinates of cursors `[begin, end)` for
+ *   IplKernel_sweep().
+ */
+static void plzj_cursor_track (
+    const struct PlzjCursor *cursors, size_t begin, size_t end,
+    int32_t *restrict xs, int32_t *restrict ys) {
+  size_t n = end - begin;
+  for (size_t k = 0; k < n + DIM - 1; k++) {
+    size_t src = begin + (
+      k < DIM / 2 - 1 ? 0 : min(k - (DIM / 2 - 1), n - 1));
+    xs[k] = cursors[src].p.x;
+    ys[k] = cursors[src].p.y;
+  }
 }
 
 
-static int IplKernel_init (struct IplKernel *kern, unsigned int k) {
-  if_fail (k > 1) {
-    kern->coeffs = NULL;
-    kern->magnitude = 0;
+/**
+ * @brief Compute cursor positions of all transition frames.
+ *
+ * Cursor tracks are extracted per run of valid cursors, with positions at
+ * the edges of a run repeated into the gaps, then resampled with each
+ * kernel row in one pass over the whole run.
+ */
+static int PlzjTrajectory_init (
+    struct PlzjTrajectory *traj, const struct PlzjVideo *video,
+    const struct IplKernel *kern, unsigned int transitions_cnt) {
+  const struct PlzjCursor *cursors = video->cursors;
+  size_t frames_cnt = video->frames_cnt;
+
+  traj->frame_steps = malloc(sizeof(*traj->frame_steps) * (frames_cnt + 1));
+  return_if_fail (traj->frame_steps != NULL) ERR_STD(malloc);
+
+  // frames which move the cursor to a valid position
+  size_t steps_cnt = 0;
+  for (size_t i = 0; i < frames_cnt; i++) {
+    traj->frame_steps[i] = steps_cnt;
+    if (transitions_cnt > 0 && i + 1 < frames_cnt &&
+        PlzjCursor_valid(&cursors[i]) && cursors[i].curres != NULL &&
+        PlzjCursor_valid(&cursors[i + 1]) && (
+          cursors[i].p.x != cursors[i + 1].p.x ||
+          cursors[i].p.y != cursors[i + 1].p.y)) {
+      steps_cnt += transitions_cnt;
+    }
+  }
+  traj->frame_steps[frames_cnt] = steps_cnt;
+
+  traj->steps = NULL;
+  if (steps_cnt == 0) {
     return 0;
   }
 
-  kern->coeffs = malloc(sizeof(*kern->coeffs) * DIM * (k - 1));
-  return_if_fail (kern->coeffs != NULL) ERR_STD(malloc);
+  int ret;
 
-  int32_t ks[DIM];
-  int32_t kk = 1;
-  for (unsigned int r = DIM; r > 0; ) {
-    r--;
-    ks[r] = kk;
-    if (r == 0) {
-      break;
+  traj->steps = malloc(sizeof(*traj->steps) * steps_cnt);
+  if_fail (traj->steps != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail;
+  }
+
+  // padded x and y tracks, then x and y of one kernel row
+  int32_t *buf = malloc(sizeof(*buf) * 4 * (frames_cnt + DIM));
+  if_fail (buf != NULL) {
+    ret = ERR_STD(malloc);
+    goto fail;
+  }
+  int32_t *track_xs = buf;
+  int32_t *track_ys = track_xs + frames_cnt + DIM;
+  int32_t *row_xs = track_ys + frames_cnt + DIM;
+  int32_t *row_ys = row_xs + frames_cnt + DIM;
+
+  for (size_t begin = 0; begin < frames_cnt; ) {
+    if (!PlzjCursor_valid(&cursors[begin])) {
+      begin++;
+      continue;
     }
-    kk *= k;
+    size_t end = begin + 1;
+    while (end < frames_cnt && PlzjCursor_valid(&cursors[end])) {
+      end++;
+    }
+
+    // the last cursor of a run has no transitions
+    size_t n = end - begin - 1;
+    if (traj->frame_steps[end - 1] != traj->frame_steps[begin]) {
+      plzj_cursor_track(cursors, begin, end, track_xs, track_ys);
+
+      for (unsigned int j = 0; j < transitions_cnt; j++) {
+        IplKernel_sweep(kern, track_xs, n, j + 1, row_xs);
+        IplKernel_sweep(kern, track_ys, n, j + 1, row_ys);
+
+        uint32_t timecode_ipl =
+          video->frame_ms * (j + 1) / (transitions_cnt + 1);
+        for (size_t k = 0; k < n; k++) {
+          size_t i = begin + k;
+          if (PlzjTrajectory_frame_steps_cnt(traj, i) == 0) {
+            continue;
+          }
+
+          const struct PlzjCursor *cursor = &cursors[i];
+          const struct PlzjCursor *cursor_next = &cursors[i + 1];
+          traj->steps[traj->frame_steps[i] + j] = (struct PlzjCursorStep) {
+            video->frame_ms * i + timecode_ipl, {
+              cursor_next->p.x != cursor->p.x ? row_xs[k] : cursor->p.x,
+              cursor_next->p.y != cursor->p.y ? row_ys[k] : cursor->p.y
+            }
+          };
+        }
+      }
+    }
+
+    begin = end;
   }
-  kern->magnitude = .5 / kk;
 
-  for (unsigned int j = 1; j < k; j++) {
-    int32_t *coeff = kern->coeffs + DIM * (j - 1);
+  free(buf);
+  return 0;
 
-    int32_t js[DIM];
-    int32_t jj = 1;
-    for (unsigned int r = 0; r < DIM; r++) {
-      js[r] = jj;
-      if (r >= DIM) {
-        break;
+fail:
+  PlzjTrajectory_destroy(traj);
+  return ret;
+}
+
+
+/// transition frames of one source frame, drawn and compressed in one task
+struct PlzjTransitionBatch {
+  const struct PlzjEncoder *encoder;
+  struct PlzjBufPool *bufpool;
+  struct PlzjZCache *zcache;
+  bool draw_click;
+
+  /// area touched by all transitions
+  struct PlzjRect rect;
+  /// background of `rect`, without cursor
+  struct PlzjCanvas background;
+
+  size_t steps_cnt;
+  /// `[steps_cnt + 1]`, cursor of the source frame and of each transition,
+  /// relative to `rect`
+  struct PlzjCursor *cursors;
+  /// `[steps_cnt]`, `NULL` if transition changes nothing
+  struct PlzjPngFrame **frames;
+  /// `[steps_cnt + 1]`, area of the cursor before and after each transition
+  struct PlzjRect *rects;
+  /// `[steps_cnt]`, zlib level of each frame
+  int *levels;
+  /// `[steps_cnt + 1]`, whether the cursor is drawn, i.e. `rects` is valid
+  bool *draws;
+};
+
+
+static void PlzjTransitionBatch_destroy (struct PlzjTransitionBatch *batch) {
+  PlzjCanvas_destroy(&batch->background);
+  free(batch);
+}
+
+
+static int PlzjTransitionBatch_run (void *arg) {
+  struct PlzjTransitionBatch *batch = arg;
+  const struct PlzjEncoder *encoder = batch->encoder;
+  int ret;
+
+  struct PlzjCanvas canvases[2];
+  ret = PlzjCanvas_init(
+    &canvases[0], batch->background.width, batch->background.height);
+  goto_if_fail (ret == 0) fail_canvas;
+  ret = PlzjCanvas_init(
+    &canvases[1], batch->background.width, batch->background.height);
+  goto_if_fail (ret == 0) fail_canvas_2;
+
+  size_t size = sizeof(*batch->background.pixels) *
+    batch->background.width * batch->background.height;
+  struct PlzjCanvas *old = &canvases[0];
+  struct PlzjCanvas *canvas = &canvases[1];
+
+  memcpy(old->pixels, batch->background.pixels, size);
+  ret = PlzjEncoder_draw_cursor(
+    encoder, old, &batch->cursors[0], batch->draw_click);
+  goto_if_fail (ret >= 0) fail;
+
+  for (size_t j = 0; j < batch->steps_cnt; j++) {
+    memcpy(canvas->pixels, batch->background.pixels, size);
+    ret = PlzjEncoder_draw_cursor(
+      encoder, canvas, &batch->cursors[j + 1], batch->draw_click);
+    goto_if_fail (ret >= 0) fail;
+
+    struct PlzjPngFrame *frame = batch->frames[j];
+    if (frame != NULL) {
+      struct PlzjRect rect_hint = {
+        {frame->rect.p1.x - batch->rect.p1.x,
+         frame->rect.p1.y - batch->rect.p1.y},
+        {frame->rect.p2.x - batch->rect.p1.x,
+         frame->rect.p2.y - batch->rect.p1.y}
+      };
+
+      // trim transparent borders of the sprites, or leave a single
+      // transparent pixel if nothing changed
+      struct PlzjRect rect;
+      if (!PlzjCanvas_diff(canvas, old, &rect_hint, &rect)) {
+        rect = (struct PlzjRect) {
+          rect_hint.p1, {rect_hint.p1.x + 1, rect_hint.p1.y + 1}
+        };
       }
-      jj *= j;
+      // only read by the main thread after the pool stops
+      frame->rect = (struct PlzjRect) {
+        {rect.p1.x + batch->rect.p1.x, rect.p1.y + batch->rect.p1.y},
+        {rect.p2.x + batch->rect.p1.x, rect.p2.y + batch->rect.p1.y}
+      };
+
+      size_t scanline_len;
+      unsigned char *scanline = PlzjCanvas_get_png_diff(
+        canvas, old, &rect, &scanline_len, batch->bufpool);
+      if_fail (scanline != NULL) {
+        ret = -sc_exc.code;
+        goto fail;
+      }
+
+      void *fdAT = plzj_compress(
+        scanline, scanline_len, 4, &frame->size, batch->levels[j],
+        batch->bufpool, batch->zcache);
+      PlzjBufPool_free(batch->bufpool, scanline);
+      if_fail (fdAT != NULL) {
+        ret = -sc_exc.code;
+        goto fail;
+      }
+      atomic_store_explicit(&frame->fdAT, fdAT, memory_order_release);
     }
 
-    for (unsigned int r = 0; r < DIM; r++) {
-      js[r] *= ks[r];
+    struct PlzjCanvas *tmp = old;
+    old = canvas;
+    canvas = tmp;
+  }
+  ret = 0;
+
+fail:
+  PlzjCanvas_destroy(&canvases[1]);
+fail_canvas_2:
+  PlzjCanvas_destroy(&canvases[0]);
+fail_canvas:
+  PlzjTransitionBatch_destroy(batch);
+  return ret;
+}
+
+
+/**
+ * @brief Append cursor transitions of one source frame.
+ *
+ * The background is the same for all transitions, so only the areas of the
+ * cursor before and after each transition can change. Frames are created
+ * with these areas directly, and drawn and compressed together in a single
+ * task.
+ *
+ * @param cursor Cursor of the source frame, already drawn.
+ * @param[in,out] rect_cursor_inout Area of the last drawn cursor.
+ */
+static int PlzjEncoder_append_transitions (
+    struct PlzjEncoder *encoder, const struct PlzjCursor *cursor,
+    const struct PlzjCursorStep *steps, size_t steps_cnt,
+    const struct PlzjRect *rect_click, struct PlzjRect *rect_cursor_inout) {
+  return_if_fail (steps_cnt > 0) 0;
+
+  uint32_t width = encoder->canvas.width;
+  uint32_t height = encoder->canvas.height;
+  bool draw_click = rect_click != NULL;
+  int ret;
+
+  // Matroska needs whole frames, and broken icons should fail as before
+  if (encoder->to_mkv || cursor->curres == NULL ||
+      cursor->curres->colors == NULL) {
+    struct PlzjCursor cursor_mid = *cursor;
+    for (size_t j = 0; j < steps_cnt; j++) {
+      cursor_mid.p = steps[j].p;
+      ret = PlzjEncoder_append_cursor(
+        encoder, steps[j].timecode_ms, rect_cursor_inout, NULL, &cursor_mid,
+        rect_click, rect_cursor_inout);
+      return_if_fail (ret >= 0) ret;
     }
+    return 0;
+  }
 
-    static const int32_t m[][DIM] = {
-      { 0, -1,  2, -1},
-      { 2,  0, -5,  3},
-      { 0,  1,  4, -3},
-      { 0,  0, -1,  1},
-    };
+  struct PlzjTransitionBatch *batch;
+  size_t step_size =
+    sizeof(*batch->cursors) + sizeof(*batch->frames) +
+    sizeof(*batch->rects) + sizeof(*batch->levels) + sizeof(*batch->draws);
+  return_if_fail (steps_cnt < (SIZE_MAX - sizeof(*batch)) / step_size - 1)
+    ERR(PL_EINVAL);
+  batch = malloc(sizeof(*batch) + step_size * (steps_cnt + 1));
+  return_if_fail (batch != NULL) ERR_STD(malloc);
+
+  batch->cursors = (void *) (batch + 1);
+  batch->frames = (void *) (batch->cursors + steps_cnt + 1);
+  batch->rects = (void *) (batch->frames + steps_cnt);
+  batch->levels = (void *) (batch->rects + steps_cnt + 1);
+  batch->draws = (void *) (batch->levels + steps_cnt);
+  struct PlzjRect *rects = batch->rects;
+  bool *draws = batch->draws;
+
+  // areas of cursor before and after each transition
+  struct PlzjRect rect_batch;
+  PlzjRect_init(&rect_batch);
+  if (draw_click) {
+    rect_batch = *rect_click;
+  }
 
-    for (unsigned int r = 0; r < DIM; r++) {
-      coeff[r] = dotII(m[r], js);
+  struct PlzjCursor cursor_mid = *cursor;
+  for (size_t j = 0; j <= steps_cnt; j++) {
+    if (j > 0) {
+      cursor_mid.p = steps[j - 1].p;
+    }
+    draws[j] = PlzjEncoder_cursor_rect(
+      encoder, &cursor_mid, width, height, &rects[j]);
+    if (draws[j]) {
+      PlzjRect_iadd(&rect_batch, &rects[j]);
     }
   }
+  if_fail (
+      PlzjRect_valid(&rect_batch) && PlzjRect_width(&rect_batch) > 0 &&
+      PlzjRect_height(&rect_batch) > 0) {
+    free(batch);
+    return 0;
+  }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wanalyzer-use-of-uninitialized-value"
-  if (sc_log_begin(SC_LOG_VERBOSE)) {
-    sc_log_print("Resampling kernel (row %u, dim %d):\n", k - 1, DIM);
-    for (unsigned int j = 1; j < k; j++) {
-      int32_t *coeff = kern->coeffs + DIM * (j - 1);
-      for (unsigned int r = 0; r < DIM; r++) {
-        sc_log_print(r == 0 ? "%" PRId32 : " %" PRId32, coeff[r]);
-      }
-      sc_log_print("\n");
+  uint32_t batch_width = PlzjRect_width(&rect_batch);
+  uint32_t batch_height = PlzjRect_height(&rect_batch);
+  ret = PlzjCanvas_init(&batch->background, batch_width, batch_height);
+  if_fail (ret == 0) {
+    free(batch);
+    return ret;
+  }
+
+  batch->encoder = encoder;
+  batch->bufpool = &encoder->bufpool;
+  batch->zcache = &encoder->zcache;
+  batch->draw_click = draw_click;
+  batch->rect = rect_batch;
+  batch->steps_cnt = steps_cnt;
+
+  // cursor and click are not on the canvas at this point
+  for (uint32_t y = 0; y < batch_height; y++) {
+    memcpy(
+      batch->background.pixels + (size_t) batch_width * y,
+      encoder->canvas.pixels +
+        (size_t) width * (rect_batch.p1.y + y) + rect_batch.p1.x,
+      sizeof(*batch->background.pixels) * batch_width);
+  }
+
+  for (size_t j = 0; j <= steps_cnt; j++) {
+    struct PlzjCursor *cursor_rel = &batch->cursors[j];
+    *cursor_rel = *cursor;
+    if (j > 0) {
+      cursor_rel->p = steps[j - 1].p;
     }
-    sc_log_end(SC_LOG_VERBOSE);
+    cursor_rel->p.x -= rect_batch.p1.x;
+    cursor_rel->p.y -= rect_batch.p1.y;
+    cursor_rel->event.p.x -= rect_batch.p1.x;
+    cursor_rel->event.p.y -= rect_batch.p1.y;
   }
-#pragma GCC diagnostic pop
 
-  return 0;
-}
+  // create frames with areas known beforehand
+  for (size_t j = 0; j < steps_cnt; j++) {
+    batch->frames[j] = NULL;
 
-#elif 1
+    const struct PlzjPoint *p_before = j == 0 ? &cursor->p : &steps[j - 1].p;
+    if ((steps[j].p.x == p_before->x && steps[j].p.y == p_before->y) ||
+        (!draws[j] && !draws[j + 1])) {
+      continue;
+    }
 
-#define KERNEL_SIZE 1
+    if (encoder->counting) {
+      encoder->frames_total++;
+      continue;
+    }
 
+    struct PlzjRect rect;
+    PlzjRect_init(&rect);
+    if (draws[j]) {
+      PlzjRect_iadd(&rect, &rects[j]);
+    }
+    if (draws[j + 1]) {
+      PlzjRect_iadd(&rect, &rects[j + 1]);
+    }
 
-struct IplKernel {
-  unsigned int k;
-};
+    struct PlzjPngFrame *frame = PlzjEncoder_new_frame(encoder);
+    if_fail (frame != NULL) {
+      ret = -sc_exc.code;
+      goto fail;
+    }
+    frame->rect = rect;
+    frame->timecode_ms = steps[j].timecode_ms;
+    frame->size = 0;
+    batch->levels[j] = PlzjZLevel_pick(
+      &encoder->zlevel,
+      (3 * (size_t) PlzjRect_width(&rect) + 1) * PlzjRect_height(&rect),
+      encoder->frames_len - 1 - encoder->frame_i, encoder->nproc);
+    atomic_store_explicit(&frame->fdAT, NULL, memory_order_release);
+    batch->frames[j] = frame;
+
+    sc_verbose(
+      "Drawing frame %" PRIuSIZE " at %" PRIu32 " ms from (%" PRId32 ", %"
+      PRId32 ") to (%" PRId32 ", %" PRId32 ")\n",
+      encoder->frames_len - 1, frame->timecode_ms,
+      rect.p1.x, rect.p1.y, rect.p2.x, rect.p2.y);
+  }
+
+  // the canvas of the last transition is what players see afterwards
+  ret = PlzjCanvas_copy(
+    &encoder->canvas_last, &encoder->canvas, &rect_batch);
+  goto_if_fail (ret == 0) fail;
+  cursor_mid.p = steps[steps_cnt - 1].p;
+  ret = PlzjEncoder_draw_cursor(
+    encoder, &encoder->canvas_last, &cursor_mid, draw_click);
+  goto_if_fail (ret >= 0) fail;
+
+  for (size_t j = steps_cnt + 1; j > 0; ) {
+    j--;
+    if (draws[j]) {
+      *rect_cursor_inout = rects[j];
+      break;
+    }
+  }
 
+  if (encoder->counting) {
+    PlzjTransitionBatch_destroy(batch);
+    return 0;
+  }
 
-static int32_t IplKernel_evaluate (
-    const struct IplKernel *kern, const int32_t *samples, unsigned int i) {
-  int32_t left = samples[DIM / 2 - 1];
-  int32_t right = samples[DIM / 2];
-  return left + ((right - left) * (int) i + (int) kern->k / 2) / (int) kern->k;
-}
+  const struct ScException *exc;
+  ret = ThreadPool_get_err(&encoder->pool, &exc);
+  if_fail (ret == 0) {
+    sc_exc = *exc;
+    goto fail;
+  }
+  ret = ThreadPool_run(&encoder->pool, PlzjTransitionBatch_run, batch);
+  goto_if_fail (ret == 0) fail;
 
+  return PlzjEncoder_write_frames(encoder, false);
 
-static void IplKernel_destroy (struct IplKernel *kern) {
-  (void) kern;
+fail:
+  PlzjTransitionBatch_destroy(batch);
+  return ret;
 }
 
 
-static int IplKernel_init (struct IplKernel *kern, unsigned int k) {
-  kern->k = k;
-  return 0;
+/**
+ * @brief Check whether `rect` is fully covered by the union of `patches`.
+ *
+ * @param[in,out] budget Number of rectangles left to examine, not covered
+ *   when exhausted.
+ */
+static bool PlzjRect_occluded (
+    const struct PlzjRect *rect, const struct PlzjImage *patches,
+    size_t patches_cnt, unsigned int *budget) {
+  for (size_t k = 0; k < patches_cnt; k++) {
+    return_if_fail (*budget > 0) false;
+    (*budget)--;
+
+    const struct PlzjRect *cover = &patches[k].rect;
+    continue_if_fail (
+      cover->p1.x < rect->p2.x && rect->p1.x < cover->p2.x &&
+      cover->p1.y < rect->p2.y && rect->p1.y < cover->p2.y);
+    if (cover->p1.x <= rect->p1.x && rect->p2.x <= cover->p2.x &&
+        cover->p1.y <= rect->p1.y && rect->p2.y <= cover->p2.y) {
+      return true;
+    }
+
+    // parts left uncovered, above, below, to the left and to the right
+    int32_t y1 = max(rect->p1.y, cover->p1.y);
+    int32_t y2 = min(rect->p2.y, cover->p2.y);
+    const struct PlzjRect rests[4] = {
+      {rect->p1, {rect->p2.x, y1}},
+      {{rect->p1.x, y2}, rect->p2},
+      {{rect->p1.x, y1}, {cover->p1.x, y2}},
+      {{cover->p2.x, y1}, {rect->p2.x, y2}},
+    };
+    for (unsigned int l = 0; l < 4; l++) {
+      continue_if_fail (
+        rests[l].p1.x < rests[l].p2.x && rests[l].p1.y < rests[l].p2.y);
+      return_if_fail (PlzjRect_occluded(
+        &rests[l], patches + k + 1, patches_cnt - k - 1, budget)) false;
+    }
+    return true;
+  }
+  return false;
 }
 
-#endif
 
-int PlzjVideo_write_apng (
-    const struct PlzjVideo *video, FILE *out, unsigned int flags,
-    unsigned int transitions_cnt, int compression_level, unsigned int nproc) {
-  return_if_fail (
-    video->frames != NULL && video->frames[0] != NULL &&
-    video->frames[0]->patches != NULL &&
-    video->frames[0]->patches[0] != NULL) ERR(PL_EINVAL);
+/**
+ * @brief Write one frame every `decimate` source frames, and the last one.
+ *
+ * Patches overwritten by later ones before the next output frame are culled
+ * without being read. Cursor is drawn without transitions.
+ *
+ * @param roi Region of the screen to extract.
+ */
+static int PlzjVideo_encode_decimated (
+    const struct PlzjVideo *video, struct PlzjEncoder *encoder,
+    const struct PlzjRect *roi, bool with_cursor, unsigned int decimate) {
   const struct Plzj *pl = video->pl;
-  return_if_fail (pl != NULL && pl->key_set >= 0) ERR(PL_EKEY);
-
-  bool use_subframes = (flags & 1) != 0;
-  bool with_cursor = (flags & 2) != 0;
-  if (video->curreses_cnt <= 0) {
-    with_cursor = false;
+  const struct PlzjPoint *origin = &roi->p1;
+  uint32_t width = encoder->canvas.width;
+  uint32_t height = encoder->canvas.height;
+
+  if (!encoder->counting) {
+    sc_info(
+      "Output frames: one every %u original frames, %u ms\n", decimate,
+      decimate * video->frame_ms);
   }
 
-  const struct PlzjImage *first = video->frames[0]->patches[0];
-  uint32_t width = first->rect.p2.x;
-  uint32_t height = first->rect.p2.y;
+  size_t patches_culled = 0;
+  size_t patch_begin = 0;
+  for (size_t i = 0; i < video->frames_cnt; i++) {
+    continue_if_fail (i % decimate == 0 || i + 1 >= video->frames_cnt);
 
-  // acquire resources
-  struct PlzjEncoder encoder;
-  return_with_nonzero (PlzjEncoder_init(
-    &encoder, out, width, height, pl, compression_level, nproc));
+    if (!encoder->counting) {
+      sc_notice(
+        sc_log_level < SC_LOG_DEBUG ?
+        "[%3.f%%] %" PRIuSIZE " / %" PRIuSIZE " frames, %" PRIuSIZE
+        " APNG fs\r" :
+        "[%3.f%%] %" PRIuSIZE " / %" PRIuSIZE " frames, %" PRIuSIZE
+        " APNG fs\n",
+        (i + 1) * 100. / video->frames_cnt, i + 1, video->frames_cnt,
+        encoder->frames_len);
+    }
 
-  int ret;
+    // all patches since the previous output frame
+    struct PlzjImage *patches = video->patches + patch_begin;
+    size_t patches_cnt = video->frame_patches[i + 1] - patch_begin;
+    patch_begin = video->frame_patches[i + 1];
+
+    int ret;
+
+    for (size_t j = 0; j < patches_cnt; j++) {
+      struct PlzjImage *patch = patches + j;
+
+      struct PlzjRect rect_patch;
+      PlzjRect_clamp(&rect_patch, &patch->rect, roi);
+      continue_if_fail (
+        PlzjRect_width(&rect_patch) > 0 && PlzjRect_height(&rect_patch) > 0);
+
+      unsigned int budget = PLZJ_OCCLUSION_BUDGET;
+      if (PlzjRect_occluded(
+          &rect_patch, patch + 1, patches_cnt - j - 1, &budget)) {
+        patches_culled++;
+        continue;
+      }
+
+      struct PlzjRect rect = {
+        {rect_patch.p1.x - origin->x, rect_patch.p1.y - origin->y},
+        {rect_patch.p2.x - origin->x, rect_patch.p2.y - origin->y}
+      };
+      if (patch->buf.data != NULL) {
+        ret = PlzjEncoder_apply(encoder, patch, origin, &rect);
+      } else {
+        struct PlzjImage patch_tmp = *patch;
+
+        ret = PlzjImage_read_pool(
+          &patch_tmp, pl->file, le32toh(pl->player.video_type),
+          pl->key_set <= 0 ? NULL : pl->key, true, &encoder->bufpool);
+        return_if_fail (ret == 0) ret;
+
+        ret = PlzjEncoder_apply(encoder, &patch_tmp, origin, &rect);
 
-  uint32_t *timecodes_ipl = NULL;  // [transitions_cnt]
-  if (with_cursor && transitions_cnt > 0) {
-    timecodes_ipl = malloc(sizeof(*timecodes_ipl) * transitions_cnt);
-    if_fail (timecodes_ipl != NULL) {
-      ret = ERR_STD(malloc);
-      goto fail_timecodes_ipl;
+        PlzjBufPool_put(&encoder->bufpool, patch_tmp.buf.data);
+      }
+      return_if_fail (ret >= 0) ret;
     }
-    for (unsigned int j = 0; j < transitions_cnt; j++) {
-      timecodes_ipl[j] = video->frame_ms * (j + 1) / (transitions_cnt + 1);
+
+    uint32_t timecode = video->frame_ms * i;
+    struct PlzjCursor cursor = video->cursors[i];
+    if (with_cursor && PlzjCursor_valid(&cursor) && cursor.curres != NULL) {
+      PlzjEncoder_map_cursor(encoder, origin, &cursor);
+
+      struct PlzjRect rect_click;
+      bool draw_click =
+        PlzjClick_rect(
+          &cursor.event, encoder->click_masks, width, height, &rect_click);
+      if (draw_click) {
+        return_with_nonzero (PlzjCanvas_copy(
+          &encoder->canvas_swap, &encoder->canvas, &rect_click));
+      }
+      ret = PlzjEncoder_append_cursor(
+        encoder, timecode, NULL, NULL, &cursor,
+        !draw_click ? NULL : &rect_click, NULL);
+    } else {
+      ret = PlzjEncoder_append(encoder, timecode, NULL, NULL);
     }
+    return_if_fail (ret >= 0) ret;
   }
 
-  struct IplKernel kern;
-  ret = IplKernel_init(&kern, !with_cursor ? 0 : transitions_cnt + 1);
-  goto_if_fail (ret >= 0) fail_kern;
-
-  // process frames
-  if (with_cursor) {
-    sc_info("Transition frames: %u\n", transitions_cnt);
+  if (!encoder->counting) {
+    sc_info(
+      "Patches culled: %" PRIuSIZE " of %" PRIuSIZE "\n", patches_culled,
+      video->patches_cnt);
   }
-  sc_info("Original frames: %" PRIuSIZE "\n", video->frames_cnt);
+  return 0;
+}
+
+
+/**
+ * @brief Encode frames with cursor transitions.
+ *
+ * @param ckpt_path Path to save checkpoints periodically, can be `NULL`.
+ * @param resume Checkpoint to resume from, can be `NULL`.
+ */
+static int PlzjVideo_encode_frames (
+    const struct PlzjVideo *video, struct PlzjEncoder *encoder,
+    const struct PlzjVideoOptions *options, const struct PlzjRect *roi,
+    const struct PlzjTrajectory *traj, bool with_cursor, bool use_subframes,
+    const char *ckpt_path, const struct PlzjCheckpoint *resume) {
+  const struct Plzj *pl = video->pl;
+  const struct PlzjPoint *origin = &roi->p1;
+  struct PlzjRect canvas_box;
+  PlzjRect_init_box(&canvas_box, PlzjRect_width(roi), PlzjRect_height(roi));
+  // size of output
+  uint32_t width = encoder->canvas.width;
+  uint32_t height = encoder->canvas.height;
+
+  int ret;
 
   struct PlzjRect rect_cursor = {0};
   struct PlzjRect rect_click = {0};
   bool draw_cursor = false;
   bool draw_click = false;
-  for (size_t i = 0; i < video->frames_cnt; i++) {
-    if (i % 64 == 0 || i + 1 >= video->frames_cnt) {
+  size_t frame_begin = 0;
+  if (resume != NULL) {
+    rect_cursor = resume->rect_cursor;
+    rect_click = resume->rect_click;
+    draw_cursor = resume->draw_cursor;
+    draw_click = resume->draw_click;
+    frame_begin = resume->frame_i;
+  }
+  time_t ckpt_time = time(NULL);
+  for (size_t i = frame_begin; i < video->frames_cnt; i++) {
+    if (ckpt_path != NULL && i > frame_begin &&
+        time(NULL) - ckpt_time >= PLZJ_CHECKPOINT_INTERVAL) {
+      struct PlzjCheckpoint ckpt = {
+        .left = origin->x,
+        .top = origin->y,
+        .width = width,
+        .height = height,
+        .flags = options->flags,
+        .interp = options->interp,
+        .transitions_cnt = options->transitions_cnt,
+        .compression_level = options->compression_level,
+        .target_fps = options->target_fps,
+        .target_mbps = options->target_mbps,
+        .video_frames_cnt = video->frames_cnt,
+        .video_patches_cnt = video->patches_cnt,
+        .frame_i = i,
+        .rect_cursor = rect_cursor,
+        .rect_click = rect_click,
+        .draw_cursor = draw_cursor,
+        .draw_click = draw_click,
+      };
+      ret = PlzjEncoder_save_checkpoint(encoder, &ckpt, ckpt_path);
+      return_if_fail (ret == 0) ret;
+      sc_debug("Checkpoint saved at frame %" PRIuSIZE "\n", i);
+      ckpt_time = time(NULL);
+    }
+
+    if (!encoder->counting && (i % 64 == 0 || i + 1 >= video->frames_cnt)) {
       sc_notice(
         sc_log_level < SC_LOG_DEBUG ?
         "[%3.f%%] %" PRIuSIZE " / %" PRIuSIZE " frames, %" PRIuSIZE
@@ -1717,11 +3689,12 @@ int PlzjVideo_write_apng (
         "[%3.f%%] %" PRIuSIZE " / %" PRIuSIZE " frames, %" PRIuSIZE
         " APNG fs\n",
         (i + 1) * 100. / video->frames_cnt, i + 1, video->frames_cnt,
-        encoder.frames_len);
+        encoder->frames_len);
     }
 
     // reset previous cursor area
     struct PlzjRect rect_frame;
+    PlzjRect_init(&rect_frame);
     if (draw_cursor) {
       PlzjRect_iadd(&rect_frame, &rect_cursor);
       if (draw_click) {
@@ -1729,13 +3702,14 @@ int PlzjVideo_write_apng (
       }
     }
 
-    struct PlzjFrame *frame = video->frames[i];
+    struct PlzjImage *patches = PlzjVideo_frame_patches(video, i);
+    size_t patches_cnt = PlzjVideo_frame_patches_cnt(video, i);
     uint32_t timecode_base = video->frame_ms * i;
 
     // revert cursor subframe
     if (use_subframes && draw_cursor) {
-      ret = PlzjEncoder_append(&encoder, timecode_base, &rect_frame, NULL);
-      goto_if_fail (ret >= 0) fail_frame;
+      ret = PlzjEncoder_append(encoder, timecode_base, &rect_frame, NULL);
+      return_if_fail (ret >= 0) ret;
       draw_cursor = false;
     }
 
@@ -1744,43 +3718,60 @@ int PlzjVideo_write_apng (
       PlzjRect_init(&rect_frame);
     }
 
-    const struct PlzjCursor *cursor = &frame->cursor;
+    // validity is judged on the screen, drawing is clipped to the region
+    struct PlzjCursor cursor_roi = video->cursors[i];
     bool cursor_valid =
-      with_cursor && PlzjCursor_valid(cursor) && cursor->curres != NULL;
+      with_cursor && PlzjCursor_valid(&cursor_roi) &&
+      cursor_roi.curres != NULL;
+    PlzjEncoder_map_cursor(encoder, origin, &cursor_roi);
+    const struct PlzjCursor *cursor = &cursor_roi;
+
+    size_t patches_applied = 0;
+    for (size_t j = 0; j < patches_cnt; j++) {
+      struct PlzjImage *patch = patches + j;
+
+      // patches out of the region are not even read
+      struct PlzjRect rect_patch = {
+        {patch->rect.p1.x - origin->x, patch->rect.p1.y - origin->y},
+        {patch->rect.p2.x - origin->x, patch->rect.p2.y - origin->y}
+      };
+      PlzjRect_clamp(&rect_patch, &rect_patch, &canvas_box);
+      continue_if_fail (
+        PlzjRect_width(&rect_patch) > 0 && PlzjRect_height(&rect_patch) > 0);
 
-    for (size_t j = 0; j < frame->patches_cnt; j++) {
-      struct PlzjImage *patch = frame->patches[j];
       bool read = patch->buf.data == NULL;
 
       if (!read) {
-        ret = PlzjImage_apply(patch, &encoder.canvas);
+        ret = PlzjEncoder_apply(encoder, patch, origin, &rect_patch);
       } else {
         struct PlzjImage patch_tmp = *patch;
 
-        ret = PlzjImage_read(
+        ret = PlzjImage_read_pool(
           &patch_tmp, pl->file, le32toh(pl->player.video_type),
-          pl->key_set <= 0 ? NULL : pl->key, true);
-        goto_if_fail (ret == 0) fail_frame;
+          pl->key_set <= 0 ? NULL : pl->key, true, &encoder->bufpool);
+        return_if_fail (ret == 0) ret;
 
-        ret = PlzjImage_apply(&patch_tmp, &encoder.canvas);
+        ret = PlzjEncoder_apply(encoder, &patch_tmp, origin, &rect_patch);
 
-        PlzjImage_destroy(&patch_tmp);
+        PlzjBufPool_put(&encoder->bufpool, patch_tmp.buf.data);
       }
-      goto_if_fail (ret == 0) fail_frame;
+      return_if_fail (ret >= 0) ret;
+      continue_if_fail (ret == 0);
+      patches_applied++;
 
       if (!use_subframes) {
-        PlzjRect_iadd(&rect_frame, &patch->rect);
+        PlzjRect_iadd(&rect_frame, &rect_patch);
       } else {
-        ret = PlzjEncoder_append(&encoder, timecode_base, &patch->rect, NULL);
-        goto_if_fail (ret >= 0) fail_frame;
+        ret = PlzjEncoder_append(encoder, timecode_base, &rect_patch, NULL);
+        return_if_fail (ret >= 0) ret;
       }
     }
 
     // draw frame without cursor
     if (!cursor_valid) {
-      if (!use_subframes && (frame->patches_cnt > 0 || draw_cursor)) {
-        ret = PlzjEncoder_append(&encoder, timecode_base, &rect_frame, NULL);
-        goto_if_fail (ret >= 0) fail_frame;
+      if (!use_subframes && (patches_applied > 0 || draw_cursor)) {
+        ret = PlzjEncoder_append(encoder, timecode_base, &rect_frame, NULL);
+        return_if_fail (ret >= 0) ret;
       }
       draw_cursor = false;
       continue;
@@ -1788,104 +3779,185 @@ int PlzjVideo_write_apng (
 
     // backup click area
     draw_cursor = true;
-    draw_click = PlzjClick_rect(&cursor->event, width, height, &rect_click);
+    draw_click = PlzjClick_rect(
+      &cursor->event, encoder->click_masks, width, height, &rect_click);
     if (draw_click) {
-      PlzjCanvas_copy(&encoder.canvas_swap, &encoder.canvas, &rect_click);
+      return_with_nonzero (PlzjCanvas_copy(
+        &encoder->canvas_swap, &encoder->canvas, &rect_click));
     }
 
     // draw frame with cursor
     sc_verbose("Cursor %" PRIuSIZE ": %d %d\n", i, cursor->p.x, cursor->p.y);
     ret = PlzjEncoder_append_cursor(
-      &encoder, timecode_base, &rect_frame, NULL, cursor,
+      encoder, timecode_base, &rect_frame, NULL, cursor,
       !draw_click ? NULL : &rect_click, &rect_cursor);
-    goto_if_fail (ret >= 0) fail_frame;
+    return_if_fail (ret >= 0) ret;
 
     // draw cursor transitions
-    if (transitions_cnt <= 0 || i + 1 >= video->frames_cnt) {
-      continue;
-    }
+    ret = PlzjEncoder_append_transitions(
+      encoder, cursor, traj->steps + traj->frame_steps[i],
+      PlzjTrajectory_frame_steps_cnt(traj, i),
+      !draw_click ? NULL : &rect_click, &rect_cursor);
+    return_if_fail (ret >= 0) ret;
+  }
+  return 0;
+}
 
-    const struct PlzjCursor *cursor_next = &video->frames[i + 1]->cursor;
-    if (!PlzjCursor_valid(cursor_next)) {
-      continue;
-    }
 
-    bool diff_x = cursor_next->p.x != cursor->p.x;
-    bool diff_y = cursor_next->p.y != cursor->p.y;
-    if (!diff_x && !diff_y) {
-      continue;
-    }
+/**
+ * @brief Check whether checkpoint was saved by the same extraction.
+ */
+static bool PlzjCheckpoint_match (
+    const struct PlzjCheckpoint *ckpt, const struct PlzjVideo *video,
+    const struct PlzjVideoOptions *options, const struct PlzjRect *roi) {
+  return
+    ckpt->left == roi->p1.x && ckpt->top == roi->p1.y &&
+    ckpt->width == PlzjRect_width(roi) &&
+    ckpt->height == PlzjRect_height(roi) &&
+    ckpt->flags == options->flags && ckpt->interp == options->interp &&
+    ckpt->transitions_cnt == options->transitions_cnt &&
+    ckpt->compression_level == options->compression_level &&
+    ckpt->target_fps == options->target_fps &&
+    ckpt->target_mbps == options->target_mbps &&
+    ckpt->video_frames_cnt == video->frames_cnt &&
+    ckpt->video_patches_cnt == video->patches_cnt &&
+    ckpt->frame_i < video->frames_cnt && ckpt->frames_cnt > 0 &&
+    ckpt->acTL_offset > 0 && ckpt->out_offset > ckpt->acTL_offset;
+}
 
-    int32_t xs[DIM];
-    int32_t ys[DIM];
 
-    xs[DIM / 2 - 1] = cursor->p.x;
-    ys[DIM / 2 - 1] = cursor->p.y;
-    for (unsigned int a = 1; a < DIM / 2; a++) {
-      const struct PlzjCursor *cursor_bw = &video->frames[i - a]->cursor;
-      if (i < a || !PlzjCursor_valid(cursor_bw)) {
-        int32_t x = xs[DIM / 2 - a];
-        int32_t y = ys[DIM / 2 - a];
-        for (unsigned int b = a; b < DIM / 2; b++) {
-          xs[DIM / 2 - (b + 1)] = x;
-        }
-        for (unsigned int b = a; b < DIM / 2; b++) {
-          ys[DIM / 2 - (b + 1)] = y;
-        }
-        break;
-      }
-      xs[DIM / 2 - (a + 1)] = cursor_bw->p.x;
-      ys[DIM / 2 - (a + 1)] = cursor_bw->p.y;
-    }
-
-    xs[DIM / 2] = cursor_next->p.x;
-    ys[DIM / 2] = cursor_next->p.y;
-    for (unsigned int a = 1; a < DIM / 2; a++) {
-      const struct PlzjCursor *cursor_fw = &video->frames[i + a + 1]->cursor;
-      if (i + a + 1 >= video->frames_cnt || !PlzjCursor_valid(cursor_fw)) {
-        int32_t x = xs[DIM / 2 + a - 1];
-        int32_t y = ys[DIM / 2 + a - 1];
-        for (unsigned int b = a; b < DIM / 2; b++) {
-          xs[DIM / 2 + b] = x;
-        }
-        for (unsigned int b = a; b < DIM / 2; b++) {
-          ys[DIM / 2 + b] = y;
-        }
-        break;
-      }
-      xs[DIM / 2 + a] = cursor_fw->p.x;
-      ys[DIM / 2 + a] = cursor_fw->p.y;
-    }
+/**
+ * @brief Get the region of the screen to extract, as cropped by `options`.
+ */
+static int PlzjVideo_get_roi (
+    const struct PlzjVideo *video, const struct PlzjVideoOptions *options,
+    struct PlzjRect *roi) {
+  const struct PlzjImage *first = &video->patches[0];
+  PlzjRect_init_box(roi, first->rect.p2.x, first->rect.p2.y);
+  if (options->crop_width > 0) {
+    struct PlzjRect crop = {
+      {options->crop_left, options->crop_top},
+      {(int32_t) min(
+         (int64_t) options->crop_left + options->crop_width, INT32_MAX),
+       (int32_t) min(
+         (int64_t) options->crop_top + options->crop_height, INT32_MAX)}
+    };
+    PlzjRect_clamp(roi, &crop, roi);
+    return_if_fail (
+      PlzjRect_width(roi) > 0 && PlzjRect_height(roi) > 0) ERR(PL_EINVAL);
+  }
+  return 0;
+}
 
-    if (sc_log_begin(SC_LOG_VERBOSE)) {
-      sc_log_print("X samples:");
-      for (unsigned int r = 0; r < DIM; r++) {
-        sc_log_print(" %" PRId32, xs[r]);
-      }
-      sc_log_print(", Y samples:");
-      for (unsigned int r = 0; r < DIM; r++) {
-        sc_log_print(" %" PRId32, ys[r]);
-      }
-      sc_log_print("\n");
-      sc_log_end(SC_LOG_VERBOSE);
-    }
 
-    struct PlzjCursor cursor_mid = frame->cursor;
-    for (unsigned int j = 0; j < transitions_cnt; j++) {
-      if (diff_x) {
-        cursor_mid.p.x = IplKernel_evaluate(&kern, xs, j + 1);
-      }
-      if (diff_y) {
-        cursor_mid.p.y = IplKernel_evaluate(&kern, ys, j + 1);
-      }
-      sc_verbose(
-        "Cursor %" PRIuSIZE " + %u: %d %d\n", i, j + 1,
-        cursor_mid.p.x, cursor_mid.p.y);
+/**
+ * @brief Write APNG or Matroska, saving checkpoints periodically.
+ *
+ * @param roi Region of the screen to extract.
+ * @param ckpt_path Path of checkpoint file, can be `NULL`.
+ * @param resume Checkpoint to resume from, can be `NULL`. `out` must be
+ *   positioned at its `PlzjCheckpoint::out_offset`.
+ * @return 0 on success, 1 if `PLZJ_VIDEO_MKV_AUDIO` is set but audio was not
+ *   muxed.
+ */
+static int PlzjVideo_write_apng_checkpoint (
+    const struct PlzjVideo *video, FILE *out,
+    const struct PlzjVideoOptions *options, const struct PlzjRect *roi,
+    const char *ckpt_path, const struct PlzjCheckpoint *resume) {
+  return_if_fail (
+    video->frames_cnt > 0 && PlzjVideo_frame_patches_cnt(video, 0) > 0)
+    ERR(PL_EINVAL);
+  const struct Plzj *pl = video->pl;
+  return_if_fail (pl != NULL && pl->key_set >= 0) ERR(PL_EKEY);
 
-      ret = PlzjEncoder_append_cursor(
-        &encoder, timecode_base + timecodes_ipl[j], &rect_cursor, NULL,
-        &cursor_mid, !draw_click ? NULL : &rect_click, &rect_cursor);
-      goto_if_fail (ret >= 0) fail_frame;
+  unsigned int flags = options->flags;
+  bool to_mkv = (flags & PLZJ_VIDEO_MKV) != 0;
+  // subframes only make sense for APNG composition
+  bool use_subframes = !to_mkv && (flags & PLZJ_VIDEO_SUBFRAMES) != 0;
+  bool with_cursor = (flags & PLZJ_VIDEO_CURSOR) != 0;
+  if (video->curreses_cnt <= 0) {
+    with_cursor = false;
+  }
+  // pipes and sockets cannot seek back to fill in frame control chunks
+  bool streaming =
+    !to_mkv && ((flags & PLZJ_VIDEO_STREAM) != 0 || ftello(out) == -1);
+  unsigned int decimate = options->decimate;
+  unsigned int scale = clamp(options->scale, 1U, 15U);
+  if (ckpt_path != NULL &&
+      (to_mkv || streaming || decimate > 1 || scale > 1)) {
+    sc_warning(
+      "Checkpoints need seekable APNG output of every frame in full size, "
+      "disabled\n");
+    ckpt_path = NULL;
+  }
+  return_if_fail (resume == NULL || ckpt_path != NULL) ERR(PL_EINVAL);
+
+  // canvases cover the region only, positions are translated into it
+  const struct PlzjPoint *origin = &roi->p1;
+  struct PlzjRect canvas_box;
+  PlzjRect_init_box(&canvas_box, PlzjRect_width(roi), PlzjRect_height(roi));
+
+  // acquire resources
+  struct PlzjEncoder encoder;
+  return_with_nonzero (PlzjEncoder_init(
+    &encoder, out, canvas_box.p2.x, canvas_box.p2.y, scale, pl,
+    options->compression_level, options->target_fps, options->target_mbps,
+    options->nproc, to_mkv, (flags & PLZJ_VIDEO_MKV_AUDIO) != 0,
+    (flags & PLZJ_VIDEO_HIGHLIGHT) != 0, streaming, resume != NULL));
+  // has_audio is cleared again once all audio is written
+  bool audio_skipped =
+    to_mkv && (flags & PLZJ_VIDEO_MKV_AUDIO) != 0 && !encoder.mkv.has_audio;
+
+  int ret;
+
+  ret = PlzjEncoder_init_curreses(&encoder, video);
+  goto_if_fail (ret == 0) fail_kern;
+
+  if (resume != NULL) {
+    ret = PlzjEncoder_restore(&encoder, resume);
+    goto_if_fail (ret == 0) fail_kern;
+    sc_notice(
+      "Resuming from frame %" PRIu64 ", %" PRIuSIZE " APNG fs\n",
+      resume->frame_i, encoder.frames_len);
+  }
+
+  // decimated output has no transitions
+  unsigned int steps_cnt =
+    !with_cursor || decimate > 1 ? 0 : options->transitions_cnt;
+
+  struct IplKernel kern;
+  ret = IplKernel_init(
+    &kern, options->interp,
+    !with_cursor ? 0 : steps_cnt + 1);
+  goto_if_fail (ret >= 0) fail_kern;
+
+  struct PlzjTrajectory traj;
+  ret = PlzjTrajectory_init(&traj, video, &kern, steps_cnt);
+  IplKernel_destroy(&kern);
+  goto_if_fail (ret == 0) fail_kern;
+  for (size_t j = 0; j < traj.frame_steps[video->frames_cnt]; j++) {
+    PlzjEncoder_map_point(&encoder, origin, &traj.steps[j].p);
+  }
+
+  // process frames
+  if (with_cursor) {
+    sc_info("Transition frames: %u\n", steps_cnt);
+  }
+  sc_info("Original frames: %" PRIuSIZE "\n", video->frames_cnt);
+
+  // acTL precedes all frames, count them in a dry run first
+  for (int pass = streaming ? 0 : 1; pass < 2; pass++) {
+    encoder.counting = pass == 0;
+    ret = decimate > 1 ?
+      PlzjVideo_encode_decimated(
+        video, &encoder, roi, with_cursor, decimate) :
+      PlzjVideo_encode_frames(
+        video, &encoder, options, roi, &traj, with_cursor, use_subframes,
+        ckpt_path, resume);
+    goto_if_fail (ret == 0) fail_frame;
+    if (encoder.counting) {
+      PlzjEncoder_clear(&encoder);
+      sc_info("Streaming APNG, %" PRIuSIZE " frames\n", encoder.frames_total);
     }
   }
   if (sc_log_level < SC_LOG_DEBUG) {
@@ -1895,6 +3967,19 @@ int PlzjVideo_write_apng (
   ret = PlzjEncoder_stop(&encoder, video->frame_ms * video->frames_cnt);
   goto_if_fail (ret == 0) fail;
 
+  sc_info(
+    "Buffer allocations: %" PRIuSIZE ", reused: %" PRIuSIZE "\n",
+    atomic_load(&encoder.bufpool.allocs),
+    atomic_load(&encoder.bufpool.reuses));
+  sc_info(
+    "Compressed frame cache: %" PRIuSIZE " hits, %" PRIuSIZE " misses\n",
+    atomic_load(&encoder.zcache.hits), atomic_load(&encoder.zcache.misses));
+  PlzjZLevel_report(&encoder.zlevel);
+
+  if (audio_skipped) {
+    ret = 1;
+  }
+
   if (0) {
 fail_frame:
     if (sc_log_level < SC_LOG_DEBUG) {
@@ -1902,30 +3987,104 @@ fail_frame:
     }
   }
 fail:
-  IplKernel_destroy(&kern);
+  PlzjTrajectory_destroy(&traj);
 fail_kern:
-  free(timecodes_ipl);
-fail_timecodes_ipl:
   PlzjEncoder_destroy(&encoder);
   return ret;
 }
 
 
+int PlzjVideo_write_apng (
+    const struct PlzjVideo *video, FILE *out,
+    const struct PlzjVideoOptions *options) {
+  return_if_fail (
+    video->frames_cnt > 0 && PlzjVideo_frame_patches_cnt(video, 0) > 0)
+    ERR(PL_EINVAL);
+
+  struct PlzjRect roi;
+  return_with_nonzero (PlzjVideo_get_roi(video, options, &roi));
+  return PlzjVideo_write_apng_checkpoint(video, out, options, &roi, NULL, NULL);
+}
+
+
 int PlzjVideo_save_apng (
-    const struct PlzjVideo *video, const char *path, unsigned int flags,
-    unsigned int transitions_cnt, int compression_level, unsigned int nproc) {
+    const struct PlzjVideo *video, const char *path,
+    const struct PlzjVideoOptions *options) {
   return_if_fail (
-    video->frames != NULL && video->frames[0] != NULL &&
-    video->frames[0]->patches != NULL &&
-    video->frames[0]->patches[0] != NULL) ERR(PL_EINVAL);
+    video->frames_cnt > 0 && PlzjVideo_frame_patches_cnt(video, 0) > 0)
+    ERR(PL_EINVAL);
   const struct Plzj *pl = video->pl;
   return_if_fail (pl != NULL && pl->key_set >= 0) ERR(PL_EKEY);
 
-  FILE *out = mfopen(path, "wb");
-  return_if_fail (out != NULL) ERR_STD(mfopen);
-  int ret = PlzjVideo_write_apng(
-    video, out, flags, transitions_cnt, compression_level, nproc);
-  fclose(out);
+  struct PlzjRect roi;
+  return_with_nonzero (PlzjVideo_get_roi(video, options, &roi));
+
+  // Matroska, decimated and downscaled output cannot be resumed
+  bool checkpoint =
+    (options->flags & PLZJ_VIDEO_CHECKPOINT) != 0 &&
+    (options->flags & PLZJ_VIDEO_MKV) == 0 && options->decimate <= 1 &&
+    options->scale <= 1;
+  size_t path_len = strlen(path);
+  char *ckpt_path = malloc(path_len + 6);
+  return_if_fail (ckpt_path != NULL) ERR_STD(malloc);
+  memcpy(ckpt_path, path, path_len);
+  memcpy(ckpt_path + path_len, ".ckpt", 6);
+
+  struct PlzjCheckpoint resume;
+  bool resuming = false;
+  FILE *out = NULL;
+  struct stat statbuf;
+  if (checkpoint && mstat(ckpt_path, &statbuf) == 0) {
+    if (PlzjCheckpoint_init_file(&resume, ckpt_path) != 0) {
+      sc_warning("Cannot load checkpoint, starting over\n");
+    } else if (!PlzjCheckpoint_match(
+                 &resume, video, options, &roi) ||
+               mstat(path, &statbuf) != 0 ||
+               statbuf.st_size < resume.out_offset) {
+      sc_warning("Checkpoint does not match the output, starting over\n");
+      PlzjCheckpoint_destroy(&resume);
+    } else {
+      out = mfopen(path, "r+b");
+      if (out != NULL && (
+            truncate_fd(fileno(out), resume.out_offset) != 0 ||
+            fseeko(out, resume.out_offset, SEEK_SET) != 0)) {
+        fclose(out);
+        out = NULL;
+      }
+      if (out != NULL) {
+        resuming = true;
+      } else {
+        sc_warning("Cannot reopen the output, starting over\n");
+        PlzjCheckpoint_destroy(&resume);
+      }
+    }
+  }
+
+  int ret;
+  if (out == NULL) {
+    out = mfopen(path, "wb");
+    if_fail (out != NULL) {
+      ret = ERR_STD(mfopen);
+      goto fail;
+    }
+  }
+  ret = PlzjVideo_write_apng_checkpoint(
+    video, out, options, &roi, checkpoint ? ckpt_path : NULL,
+    resuming ? &resume : NULL);
+  if_fail (fclose(out) == 0) {
+    if (ret >= 0) {
+      ret = ERR_STD(fclose);
+    }
+  }
+
+  if (resuming) {
+    PlzjCheckpoint_destroy(&resume);
+  }
+  if (ret == 0 && checkpoint) {
+    mremove(ckpt_path);
+  }
+fail:
+  free(ckpt_path);
   return ret;
 }
 
@@ -1964,7 +4123,7 @@ int PlzjVideo_save_cursors (const struct PlzjVideo *video, const char *dir) {
   }
 
   for (size_t i = 0; i < video->frames_cnt; i++) {
-    struct PlzjCursor *cursor = &video->frames[i]->cursor;
+    struct PlzjCursor *cursor = &video->cursors[i];
     if (cursor->seg.offset <= 0) {
       sc_warning("cursor info missing for frame %" PRIuSIZE "\n", i);
       ret = fputs(".\n", out_cursors);
@@ -1987,6 +4146,63 @@ fail:
 }
 
 
+__attribute_artificial__
+static inline size_t plzj_curres_hash (unsigned long tag, size_t cap) {
+  return ((uint32_t) tag * UINT32_C(0x9e3779b1)) & (cap - 1);
+}
+
+
+static struct PlzjCursorRes *PlzjVideo_find_curres (
+    const struct PlzjVideo *video, unsigned long tag) {
+  return_if_fail (video->curres_map_cap > 0) NULL;
+
+  for (size_t i = plzj_curres_hash(tag, video->curres_map_cap); ;
+       i = (i + 1) & (video->curres_map_cap - 1)) {
+    struct PlzjCursorRes *curres = video->curres_map[i];
+    if (curres == NULL || curres->tag == tag) {
+      return curres;
+    }
+  }
+}
+
+
+/**
+ * @brief Make sure the map stays at most half full after one more insertion.
+ */
+static int PlzjVideo_reserve_curres_map (struct PlzjVideo *video) {
+  return_if_fail (2 * (video->curreses_cnt + 1) > video->curres_map_cap) 0;
+
+  size_t cap = video->curres_map_cap == 0 ? 64 : 2 * video->curres_map_cap;
+  struct PlzjCursorRes **map = calloc(cap, sizeof(*map));
+  return_if_fail (map != NULL) ERR_STD(calloc);
+
+  for (size_t i = 0; i < video->curres_map_cap; i++) {
+    struct PlzjCursorRes *curres = video->curres_map[i];
+    continue_if_fail (curres != NULL);
+    size_t j = plzj_curres_hash(curres->tag, cap);
+    while (map[j] != NULL) {
+      j = (j + 1) & (cap - 1);
+    }
+    map[j] = curres;
+  }
+
+  free(video->curres_map);
+  video->curres_map = map;
+  video->curres_map_cap = cap;
+  return 0;
+}
+
+
+static void PlzjVideo_map_curres (
+    struct PlzjVideo *video, struct PlzjCursorRes *curres) {
+  size_t i = plzj_curres_hash(curres->tag, video->curres_map_cap);
+  while (video->curres_map[i] != NULL) {
+    i = (i + 1) & (video->curres_map_cap - 1);
+  }
+  video->curres_map[i] = curres;
+}
+
+
 static int PlzjVideo_read_cursor (
     struct PlzjVideo *video, FILE *in, struct PlzjCursor *cursor,
     struct PlzjCursorRes **curresp) {
@@ -1997,33 +4213,36 @@ static int PlzjVideo_read_cursor (
 
   int ret;
 
-  struct PlzjBuffer buf;
+  struct PlzjBuffer buf = {0};
   ret = PlzjBuffer_init_file_seg(&buf, in, &cursor->seg);
   return_if_fail (ret == 0) ret;
 
   unsigned long tag = plzj_crc32(buf.data, buf.size);
 
-  struct PlzjCursorRes *curres;
-  for (size_t j = 0; j < video->curreses_cnt; j++) {
-    curres = video->curreses[j];
-    if (curres->tag == tag) {
-      cursor->curres = curres;
-      *curresp = curres;
-
-      ret = 0;
-      goto fail;
-    }
+  struct PlzjCursorRes *curres = PlzjVideo_find_curres(video, tag);
+  if (curres != NULL) {
+    cursor->curres = curres;
+    *curresp = curres;
+    PlzjBuffer_destroy(&buf);
+    return 0;
   }
 
+  ret = PlzjVideo_reserve_curres_map(video);
+  goto_if_fail (ret == 0) fail;
+
   curres = ptrarray_new(
     &video->curreses, &video->curreses_cnt, sizeof(*curres));
   if_fail (curres != NULL) {
     ret = -sc_exc.code;
     goto fail;
   }
-  PlzjCursorRes_init(curres, &buf, tag);
-  curres->tag = tag;
-  curres->buf = buf;
+  ret = PlzjCursorRes_init(curres, &buf, tag);
+  if_fail (ret == 0) {
+    free(curres);
+    video->curreses_cnt--;
+    goto fail;
+  }
+  PlzjVideo_map_curres(video, curres);
 
   cursor->curres = curres;
   *curresp = curres;
@@ -2040,7 +4259,7 @@ int PlzjVideo_read_cursors (struct PlzjVideo *video, FILE *in) {
   int ret;
 
   for (size_t i = 0; i < video->frames_cnt; i++) {
-    struct PlzjCursor *cursor = &video->frames[i]->cursor;
+    struct PlzjCursor *cursor = &video->cursors[i];
     ret = PlzjVideo_read_cursor(video, in, cursor, &curres);
     goto_if_fail (ret == 0) fail;
   }
@@ -2075,7 +4294,7 @@ static int PlzjVideo_parse_clicks (
       if (buf[0] < 0 || (unsigned long) buf[0] >= video->frames_cnt) {
         break;
       }
-      struct PlzjClick *event = &video->frames[buf[0]]->cursor.event;
+      struct PlzjClick *event = &video->cursors[buf[0]].event;
       event->p.x = buf[1];
       event->p.y = buf[2];
       event->type = buf[3];
@@ -2084,7 +4303,7 @@ static int PlzjVideo_parse_clicks (
         break;
       }
       // additional hint for double click
-      struct PlzjClick *event_before = &video->frames[buf[0] - 1]->cursor.event;
+      struct PlzjClick *event_before = &video->cursors[buf[0] - 1].event;
       event_before->p.x = buf[1];
       event_before->p.y = buf[2];
       event_before->type = 1;
@@ -2118,16 +4337,63 @@ fail:
 
 
 void PlzjVideo_destroy (const struct PlzjVideo *video) {
+  if (video->frame_cache != NULL) {
+    PlzjFrameCache_destroy(video->frame_cache);
+    free(video->frame_cache);
+  }
   for (size_t i = 0; i < video->curreses_cnt; i++) {
     PlzjCursorRes_destroy(video->curreses[i]);
     free(video->curreses[i]);
   }
   free(video->curreses);
-  for (size_t i = 0; i < video->frames_cnt; i++) {
-    PlzjFrame_destroy(video->frames[i]);
-    free(video->frames[i]);
+  free(video->curres_map);
+  for (size_t i = 0; i < video->patches_cnt; i++) {
+    PlzjImage_destroy(&video->patches[i]);
   }
-  free(video->frames);
+  free(video->patches);
+  free(video->frame_patches);
+  free(video->cursors);
+}
+
+
+/**
+ * @brief Make room for one more frame.
+ */
+static int PlzjVideo_grow_frames (struct PlzjVideo *video, size_t *capp) {
+  return_if_fail (video->frames_cnt >= *capp) 0;
+
+  size_t cap = *capp == 0 ? 256 : 2 * *capp;
+
+  struct PlzjCursor *cursors =
+    realloc(video->cursors, sizeof(*cursors) * cap);
+  return_if_fail (cursors != NULL) ERR_STD(realloc);
+  video->cursors = cursors;
+
+  size_t *frame_patches =
+    realloc(video->frame_patches, sizeof(*frame_patches) * (cap + 1));
+  return_if_fail (frame_patches != NULL) ERR_STD(realloc);
+  video->frame_patches = frame_patches;
+
+  *capp = cap;
+  return 0;
+}
+
+
+/**
+ * @brief Make room for one more patch.
+ */
+static int PlzjVideo_grow_patches (struct PlzjVideo *video, size_t *capp) {
+  return_if_fail (video->patches_cnt >= *capp) 0;
+
+  size_t cap = *capp == 0 ? 1024 : 2 * *capp;
+
+  struct PlzjImage *patches =
+    realloc(video->patches, sizeof(*patches) * cap);
+  return_if_fail (patches != NULL) ERR_STD(realloc);
+  video->patches = patches;
+
+  *capp = cap;
+  return 0;
 }
 
 
@@ -2137,12 +4403,19 @@ int PlzjVideo_init (
   struct PlzjLxePacketIter iter;
   PlzjLxePacketIter_init(&iter, pl, frames_limit);
 
-  video->frames = NULL;
+  video->patches = NULL;
+  video->patches_cnt = 0;
+  video->frame_patches = NULL;
+  video->cursors = NULL;
   video->frames_cnt = 0;
   video->curreses = NULL;
   video->curreses_cnt = 0;
+  video->curres_map = NULL;
+  video->curres_map_cap = 0;
+  video->frame_cache = NULL;
 
-  struct PlzjFrame *frame = NULL;
+  size_t frames_cap = 0;
+  size_t patches_cap = 0;
   struct PlzjCursorRes *curres = NULL;
   int ret;
 
@@ -2155,24 +4428,26 @@ int PlzjVideo_init (
 
     if (state == PlzjLxePacketIter_NEXT_FRAME) {
       break_if_fail (iter.frame_no < iter.frames_cnt);
-      frame = ptrarray_new(&video->frames, &video->frames_cnt, sizeof(*frame));
-      if_fail (frame != NULL) {
-        ret = -sc_exc.code;
-        goto fail;
-      }
-      PlzjFrame_init(frame);
-    } else if (frame != NULL) {
+      ret = PlzjVideo_grow_frames(video, &frames_cap);
+      goto_if_fail (ret == 0) fail;
+
+      video->cursors[video->frames_cnt] =
+        (struct PlzjCursor) {.p = {INT32_MIN, INT32_MIN}};
+      video->frame_patches[video->frames_cnt] = video->patches_cnt;
+      video->frames_cnt++;
+      video->frame_patches[video->frames_cnt] = video->patches_cnt;
+    } else if (video->frames_cnt > 0) {
       if (state == PlzjLxePacketIter_NEXT_IMAGE) {
-        struct PlzjImage *patch = ptrarray_new(
-          &frame->patches, &frame->patches_cnt, sizeof(*patch));
-        if_fail (patch != NULL) {
-          ret = -sc_exc.code;
-          goto fail;
-        }
+        ret = PlzjVideo_grow_patches(video, &patches_cap);
+        goto_if_fail (ret == 0) fail;
+
+        struct PlzjImage *patch = &video->patches[video->patches_cnt];
         PlzjImage_init(patch, &iter.packet.image);
         patch->seg.offset = iter.offset;
+        video->patches_cnt++;
+        video->frame_patches[video->frames_cnt] = video->patches_cnt;
       } else {
-        struct PlzjCursor *cursor = &frame->cursor;
+        struct PlzjCursor *cursor = &video->cursors[video->frames_cnt - 1];
         PlzjCursor_init(cursor, &iter.packet.cursor);
         cursor->seg.offset = iter.offset;
 
@@ -2195,18 +4470,20 @@ fail:
 
 
 int Plzj_extract_video_or_cursor (
-    const struct Plzj *pl, const char *dir, int32_t frames_limit,
-    unsigned int flags, unsigned int transitions_cnt, int compression_level,
-    unsigned int nproc, bool extract_video, bool extract_cursor) {
-  return_if_fail (extract_video || extract_cursor) 0;
+    const struct Plzj *pl, const char *dir,
+    const struct PlzjVideoExtractOptions *options) {
+  return_if_fail (options->extract_video || options->extract_cursor) 0;
 
   struct PlzjVideo video;
-  return_with_nonzero (PlzjVideo_init(&video, pl, frames_limit, true));
+  return_with_nonzero (PlzjVideo_init(
+    &video, pl, options->frames_limit, true));
 
   int ret;
+  int audio_skipped = 0;
 
-  if (extract_video) {
-    bool with_cursor = (flags & 2) != 0;
+  if (options->extract_video) {
+    unsigned int flags = options->video.flags;
+    bool with_cursor = (flags & PLZJ_VIDEO_CURSOR) != 0;
 
     if (with_cursor && pl->clicks_offset != -1) {
       ret = PlzjVideo_read_clicks(&video, pl);
@@ -2219,18 +4496,20 @@ int Plzj_extract_video_or_cursor (
     char *filename = path + dir_len;
     filename[0] = DIR_SEP;
     filename++;
-    snprintf(filename, 64, with_cursor ? "video.apng" : "video_raw.apng");
+    snprintf(
+      filename, 64, "%s.%s", with_cursor ? "video" : "video_raw",
+      (flags & PLZJ_VIDEO_MKV) != 0 ? "mkv" : "apng");
 
-    ret = PlzjVideo_save_apng(
-      &video, path, flags, transitions_cnt, compression_level, nproc);
-    goto_if_fail (ret == 0) fail;
+    ret = PlzjVideo_save_apng(&video, path, &options->video);
+    goto_if_fail (ret >= 0) fail;
+    audio_skipped = ret;
   }
-  if (extract_cursor) {
+  if (options->extract_cursor) {
     ret = PlzjVideo_save_cursors(&video, dir);
     goto_if_fail (ret == 0) fail;
   }
 
-  ret = 0;
+  ret = audio_skipped;
 fail:
   PlzjVideo_destroy(&video);
   return ret;
@@ -0,0 +1,265 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zcache.h"
+#include "macro.h"
+#include "log.h"
+
+
+#define PLZJ_ZCACHE_BUCKETS 4096
+
+
+struct PlzjZCacheEntry {
+  /// next entry in the same bucket
+  struct PlzjZCacheEntry *chain;
+  /// neighbours in the LRU list
+  struct PlzjZCacheEntry *prev;
+  struct PlzjZCacheEntry *next;
+
+  uint64_t hash;
+  size_t srclen;
+  int level;
+
+  /// compressed data, followed by a copy of the uncompressed data
+  size_t len;
+  unsigned char data[];
+};
+
+
+static void PlzjZCache_lock (struct PlzjZCache *cache) {
+#ifndef NO_THREADS
+  mtx_lock(&cache->mutex);
+#else
+  (void) cache;
+#endif
+}
+
+
+static void PlzjZCache_unlock (struct PlzjZCache *cache) {
+#ifndef NO_THREADS
+  mtx_unlock(&cache->mutex);
+#else
+  (void) cache;
+#endif
+}
+
+
+__attribute_artificial__
+static inline uint64_t plzj_fmix64 (uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
+/**
+ * @brief Hash `src` for looking up the cache.
+ *
+ * Four independent lanes of 64-bit multiply-xorshift, enough to spread
+ * scanlines over buckets at memory speed; collisions are caught by comparing
+ * the data.
+ */
+uint64_t PlzjZCache_hash (const void *src, size_t srclen, int level) {
+  static const uint64_t k = 0x9e3779b97f4a7c15ULL;
+  const unsigned char *p = src;
+
+  uint64_t h[4] = {
+    srclen ^ k, (uint64_t) level, k * 3, k * 5
+  };
+  size_t i = 0;
+  for (; i + 32 <= srclen; i += 32) {
+    for (unsigned int j = 0; j < 4; j++) {
+      uint64_t w;
+      memcpy(&w, p + i + 8 * j, sizeof(w));
+      h[j] = (h[j] ^ w) * k;
+      h[j] ^= h[j] >> 29;
+    }
+  }
+
+  uint64_t ret = plzj_fmix64(h[0]) ^ plzj_fmix64(h[1] + 1) ^
+    plzj_fmix64(h[2] + 2) ^ plzj_fmix64(h[3] + 3);
+  for (; i < srclen; i++) {
+    ret = (ret ^ p[i]) * k;
+  }
+  return plzj_fmix64(ret);
+}
+
+
+static void PlzjZCache_unlink (
+    struct PlzjZCache *cache, struct PlzjZCacheEntry *entry) {
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    cache->head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    cache->tail = entry->prev;
+  }
+}
+
+
+static void PlzjZCache_link_head (
+    struct PlzjZCache *cache, struct PlzjZCacheEntry *entry) {
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if (cache->head != NULL) {
+    cache->head->prev = entry;
+  } else {
+    cache->tail = entry;
+  }
+  cache->head = entry;
+}
+
+
+/**
+ * @brief Find the entry of `src`.
+ *
+ * The hash only narrows down the candidates, the uncompressed data is
+ * compared in full so a collision never returns data of something else.
+ */
+static struct PlzjZCacheEntry **PlzjZCache_find (
+    struct PlzjZCache *cache, uint64_t hash, const void *src, size_t srclen,
+    int level) {
+  struct PlzjZCacheEntry **entryp =
+    &cache->buckets[hash & (cache->buckets_cnt - 1)];
+  for (; *entryp != NULL; entryp = &(*entryp)->chain) {
+    const struct PlzjZCacheEntry *entry = *entryp;
+    if (entry->hash == hash && entry->srclen == srclen &&
+        entry->level == level &&
+        memcmp(entry->data + entry->len, src, srclen) == 0) {
+      break;
+    }
+  }
+  return entryp;
+}
+
+
+/**
+ * @brief Look up compressed data.
+ *
+ * @param dstlen_before Bytes to reserve in front of the data.
+ * @return Buffer from `bufpool` holding a copy of the data, or `NULL` if not
+ *   cached.
+ */
+void *PlzjZCache_get (
+    struct PlzjZCache *cache, uint64_t hash, const void *src, size_t srclen,
+    int level, size_t dstlen_before, size_t *dstlenp,
+    struct PlzjBufPool *bufpool) {
+  unsigned char *dst = NULL;
+
+  PlzjZCache_lock(cache);
+  struct PlzjZCacheEntry *entry =
+    *PlzjZCache_find(cache, hash, src, srclen, level);
+  if (entry != NULL) {
+    dst = PlzjBufPool_alloc(bufpool, dstlen_before + entry->len);
+    if (dst != NULL) {
+      memcpy(dst + dstlen_before, entry->data, entry->len);
+      *dstlenp = dstlen_before + entry->len;
+
+      PlzjZCache_unlink(cache, entry);
+      PlzjZCache_link_head(cache, entry);
+    }
+  }
+  PlzjZCache_unlock(cache);
+
+  atomic_fetch_add_explicit(
+    dst != NULL ? &cache->hits : &cache->misses, 1, memory_order_relaxed);
+  return dst;
+}
+
+
+/**
+ * @brief Remember compressed data, dropping least recently used entries to
+ *   stay within the size limit.
+ */
+void PlzjZCache_put (
+    struct PlzjZCache *cache, uint64_t hash, const void *src, size_t srclen,
+    int level, const void *data, size_t len) {
+  return_if_fail (len <= cache->size_max / 4 && srclen <= cache->size_max / 4);
+
+  struct PlzjZCacheEntry *new_entry =
+    malloc(sizeof(*new_entry) + len + srclen);
+  return_if_fail (new_entry != NULL);
+  new_entry->hash = hash;
+  new_entry->srclen = srclen;
+  new_entry->level = level;
+  new_entry->len = len;
+  memcpy(new_entry->data, data, len);
+  memcpy(new_entry->data + len, src, srclen);
+
+  PlzjZCache_lock(cache);
+  struct PlzjZCacheEntry **entryp =
+    PlzjZCache_find(cache, hash, src, srclen, level);
+  if (*entryp != NULL) {
+    // compressed by another thread in the meantime
+    PlzjZCache_unlock(cache);
+    free(new_entry);
+    return;
+  }
+
+  new_entry->chain = NULL;
+  *entryp = new_entry;
+  PlzjZCache_link_head(cache, new_entry);
+  cache->size += len + srclen;
+
+  while (cache->size > cache->size_max) {
+    struct PlzjZCacheEntry *victim = cache->tail;
+    PlzjZCache_unlink(cache, victim);
+
+    struct PlzjZCacheEntry **victimp =
+      &cache->buckets[victim->hash & (cache->buckets_cnt - 1)];
+    while (*victimp != victim) {
+      victimp = &(*victimp)->chain;
+    }
+    *victimp = victim->chain;
+    cache->size -= victim->len + victim->srclen;
+    free(victim);
+  }
+  PlzjZCache_unlock(cache);
+}
+
+
+void PlzjZCache_destroy (struct PlzjZCache *cache) {
+  for (struct PlzjZCacheEntry *entry = cache->head; entry != NULL; ) {
+    struct PlzjZCacheEntry *next = entry->next;
+    free(entry);
+    entry = next;
+  }
+  free(cache->buckets);
+#ifndef NO_THREADS
+  mtx_destroy(&cache->mutex);
+#endif
+}
+
+
+/**
+ * @param size_max Limit of total size of cached data, compressed and
+ *   uncompressed.
+ */
+int PlzjZCache_init (struct PlzjZCache *cache, size_t size_max) {
+  cache->buckets = calloc(PLZJ_ZCACHE_BUCKETS, sizeof(*cache->buckets));
+  return_if_fail (cache->buckets != NULL) ERR_STD(calloc);
+
+#ifndef NO_THREADS
+  if_fail (mtx_init(&cache->mutex, mtx_plain) == thrd_success) {
+    free(cache->buckets);
+    return ERR_STD(mtx_init);
+  }
+#endif
+  cache->buckets_cnt = PLZJ_ZCACHE_BUCKETS;
+  cache->head = NULL;
+  cache->tail = NULL;
+  cache->size = 0;
+  cache->size_max = size_max;
+  atomic_init(&cache->hits, 0);
+  atomic_init(&cache->misses, 0);
+  return 0;
+}
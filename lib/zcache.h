@@ -0,0 +1,69 @@
+#ifndef ZCACHE_H
+#define ZCACHE_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef NO_THREADS
+#  include "platform/c11threads.h"
+#endif
+
+#include "include/defs.h"
+#include "bufpool.h"
+
+/** @file */
+
+
+struct PlzjZCacheEntry;
+
+
+/// LRU cache of compressed data, keyed by uncompressed data
+struct PlzjZCache {
+#ifndef NO_THREADS
+  mtx_t mutex;
+#endif
+  /// hash table with chaining
+  struct PlzjZCacheEntry **buckets;
+  size_t buckets_cnt;
+  /// most recently used entry
+  struct PlzjZCacheEntry *head;
+  /// least recently used entry
+  struct PlzjZCacheEntry *tail;
+  /// total size of compressed and uncompressed data held
+  size_t size;
+  size_t size_max;
+
+  atomic_size_t hits;
+  atomic_size_t misses;
+};
+
+__THROW __attribute_warn_unused_result__ __attribute_pure__ __nonnull()
+__attr_access((__read_only__, 1, 2))
+uint64_t PlzjZCache_hash (const void *src, size_t srclen, int level);
+__THROW __attribute_warn_unused_result__ __nonnull((1, 3, 7))
+__attr_access((__read_only__, 3, 4))
+void *PlzjZCache_get (
+  struct PlzjZCache *cache, uint64_t hash, const void *src, size_t srclen,
+  int level, size_t dstlen_before, size_t *dstlenp,
+  struct PlzjBufPool *bufpool);
+__THROW __nonnull() __attr_access((__read_only__, 3, 4))
+__attr_access((__read_only__, 6, 7))
+void PlzjZCache_put (
+  struct PlzjZCache *cache, uint64_t hash, const void *src, size_t srclen,
+  int level, const void *data, size_t len);
+__THROW __nonnull()
+void PlzjZCache_destroy (struct PlzjZCache *cache);
+__THROW __nonnull() __attr_access((__write_only__, 1))
+int PlzjZCache_init (struct PlzjZCache *cache, size_t size_max);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZCACHE_H */
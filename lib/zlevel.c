@@ -0,0 +1,186 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef _WIN32
+#  include <windows.h>
+#endif
+
+#include "zlevel.h"
+#include "macro.h"
+#include "log.h"
+
+
+/// frames up to this size are cheap to compress, always use the best level
+#define PLZJ_ZLEVEL_SMALL (64 * 1024)
+/// length of measuring window, in seconds
+#define PLZJ_ZLEVEL_WINDOW 0.25
+
+
+/**
+ * @brief Get the time of a monotonic clock, unaffected by changes of wall
+ *   clock.
+ */
+static void plzj_clock_now (struct timespec *ts) {
+#ifdef _WIN32
+  LARGE_INTEGER freq;
+  LARGE_INTEGER cnt;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&cnt);
+  ts->tv_sec = cnt.QuadPart / freq.QuadPart;
+  ts->tv_nsec = cnt.QuadPart % freq.QuadPart * 1000000000 / freq.QuadPart;
+#else
+  clock_gettime(CLOCK_MONOTONIC, ts);
+#endif
+}
+
+
+static double timespec_diff (
+    const struct timespec *end, const struct timespec *begin) {
+  return (end->tv_sec - begin->tv_sec) +
+    (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+
+/**
+ * @brief Move the level of large frames by one step towards the target.
+ *
+ * @param saturated All workers are busy, so compression is the bottleneck.
+ */
+static void PlzjZLevel_adjust (
+    struct PlzjZLevel *zlevel, double elapsed, bool saturated) {
+  double expected = 0;
+  if (zlevel->fps > 0) {
+    expected = zlevel->window_frames / zlevel->fps;
+  }
+  if (zlevel->mbps > 0) {
+    double expected_mb = zlevel->window_srclen / (zlevel->mbps * 1e6);
+    if (expected < expected_mb) {
+      expected = expected_mb;
+    }
+  }
+
+  zlevel->behind = elapsed > expected * 1.05;
+  if (zlevel->behind) {
+    // slower decoding is not helped by cheaper compression
+    if (saturated && zlevel->level > zlevel->level_min) {
+      zlevel->level--;
+      sc_debug(
+        "Behind target by %.0f%%, compression level %d\n",
+        (elapsed / expected - 1) * 100, zlevel->level);
+    }
+  } else if (elapsed < expected * 0.9 && zlevel->level < zlevel->level_max) {
+    zlevel->level++;
+    sc_debug(
+      "Ahead of target by %.0f%%, compression level %d\n",
+      (1 - elapsed / expected) * 100, zlevel->level);
+  }
+}
+
+
+/**
+ * @brief Pick the level of a new frame.
+ *
+ * @param srclen Size of uncompressed frame.
+ * @param inflight Number of frames submitted but not yet written.
+ * @param nproc Number of compression threads.
+ * @return zlib level.
+ */
+int PlzjZLevel_pick (
+    struct PlzjZLevel *zlevel, size_t srclen, size_t inflight,
+    unsigned int nproc) {
+  int level = zlevel->level_max;
+
+  if (zlevel->fps > 0 || zlevel->mbps > 0) {
+    zlevel->window_frames++;
+    zlevel->window_srclen += srclen;
+
+    struct timespec now;
+    plzj_clock_now(&now);
+    double elapsed = timespec_diff(&now, &zlevel->window_begin);
+    if (elapsed >= PLZJ_ZLEVEL_WINDOW) {
+      PlzjZLevel_adjust(zlevel, elapsed, inflight >= nproc);
+      zlevel->window_begin = now;
+      zlevel->window_frames = 0;
+      zlevel->window_srclen = 0;
+    }
+
+    if (srclen > PLZJ_ZLEVEL_SMALL) {
+      level = zlevel->level;
+      // a huge frame behind a full queue stalls the writer even longer
+      if (zlevel->behind && inflight >= 2 * nproc &&
+          level > zlevel->level_min) {
+        level--;
+      }
+    }
+  }
+
+  zlevel->level_frames[level]++;
+  return level;
+}
+
+
+/**
+ * @brief Account a written frame.
+ */
+void PlzjZLevel_done (
+    struct PlzjZLevel *zlevel, size_t srclen, size_t dstlen) {
+  zlevel->frames++;
+  zlevel->srclen += srclen;
+  zlevel->dstlen += dstlen;
+}
+
+
+/**
+ * @brief Print achieved throughput and compression ratio.
+ */
+void PlzjZLevel_report (const struct PlzjZLevel *zlevel) {
+  struct timespec now;
+  plzj_clock_now(&now);
+  double elapsed = timespec_diff(&now, &zlevel->begin);
+  if (elapsed <= 0) {
+    elapsed = 1e-9;
+  }
+
+  sc_info(
+    "Compression: %" PRIuSIZE " frames in %.2f s, %.1f fps, %.2f MB/s in, "
+    "%.2f MB/s out, ratio %.2f%%\n",
+    zlevel->frames, elapsed, zlevel->frames / elapsed,
+    zlevel->srclen / elapsed / 1e6, zlevel->dstlen / elapsed / 1e6,
+    zlevel->srclen == 0 ? 0. : zlevel->dstlen * 100. / zlevel->srclen);
+
+  if (zlevel->fps > 0 || zlevel->mbps > 0) {
+    for (int i = 0; i < 10; i++) {
+      if (zlevel->level_frames[i] > 0) {
+        sc_info(
+          "  level %d: %" PRIuSIZE " frames\n", i, zlevel->level_frames[i]);
+      }
+    }
+  }
+}
+
+
+/**
+ * @brief Initialize level picker.
+ *
+ * @param level_max Level of small frames, and the highest level of others.
+ * @param fps Target of frames per second, 0 if none.
+ * @param mbps Target of uncompressed megabytes per second, 0 if none.
+ */
+void PlzjZLevel_init (
+    struct PlzjZLevel *zlevel, int level_max, float fps, float mbps) {
+  if (level_max < 0 || level_max > 9) {
+    // Z_DEFAULT_COMPRESSION
+    level_max = 6;
+  }
+  *zlevel = (struct PlzjZLevel) {
+    .level_max = level_max,
+    .level_min = level_max < 1 ? level_max : 1,
+    .level = level_max,
+    .fps = fps,
+    .mbps = mbps,
+  };
+  plzj_clock_now(&zlevel->begin);
+  zlevel->window_begin = zlevel->begin;
+}
@@ -0,0 +1,64 @@
+#ifndef ZLEVEL_H
+#define ZLEVEL_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "include/defs.h"
+
+/** @file */
+
+
+/// Picks zlib level of each frame, to keep up with a throughput target
+struct PlzjZLevel {
+  /// level of small frames, and the highest level of others
+  int level_max;
+  int level_min;
+  /// level of large frames, adjusted to the target
+  int level;
+  /// last measuring window missed the target
+  bool behind;
+
+  /// target of frames per second, 0 if none
+  float fps;
+  /// target of uncompressed megabytes per second, 0 if none
+  float mbps;
+
+  struct timespec begin;
+  /// beginning of the current measuring window
+  struct timespec window_begin;
+  size_t window_frames;
+  uint64_t window_srclen;
+
+  /// frames compressed at each level
+  size_t level_frames[10];
+  /// written frames, their uncompressed and compressed size
+  size_t frames;
+  uint64_t srclen;
+  uint64_t dstlen;
+};
+
+__THROW __nonnull()
+int PlzjZLevel_pick (
+  struct PlzjZLevel *zlevel, size_t srclen, size_t inflight,
+  unsigned int nproc);
+__THROW __nonnull()
+void PlzjZLevel_done (struct PlzjZLevel *zlevel, size_t srclen, size_t dstlen);
+__THROW __nonnull() __attr_access((__read_only__, 1))
+void PlzjZLevel_report (const struct PlzjZLevel *zlevel);
+__THROW __nonnull() __attr_access((__write_only__, 1))
+void PlzjZLevel_init (
+  struct PlzjZLevel *zlevel, int level_max, float fps, float mbps);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZLEVEL_H */
@@ -0,0 +1,795 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/include/platform/endian.h"
+
+#include "lib/include/parser.h"
+#include "lib/include/video.h"
+#include "lib/macro.h"
+#include "lib/log.h"
+
+
+static PyObject *PlzjPyError;
+
+
+/// error of the library, formatted while the GIL is released
+struct PlzjPyErr {
+  int ret;
+  size_t len;
+  char msg[1024];
+};
+
+
+static int PlzjPyErr_printf (void *data, const char *format, ...) {
+  struct PlzjPyErr *err = data;
+  return_if_fail (err->len < sizeof(err->msg) - 1) 0;
+
+  va_list args;
+  va_start(args, format);
+  int ret = vsnprintf(
+    err->msg + err->len, sizeof(err->msg) - err->len, format, args);
+  va_end(args);
+  if (ret > 0) {
+    err->len = min(err->len + ret, sizeof(err->msg) - 1);
+  }
+  return ret;
+}
+
+
+/**
+ * @brief Save `sc_exc` of the calling thread into `err`.
+ */
+static void PlzjPyErr_save (struct PlzjPyErr *err, int ret) {
+  err->ret = ret;
+  err->len = 0;
+  err->msg[0] = '\0';
+  ScException_print(&sc_exc, PlzjPyErr_printf, err, "", "");
+  while (err->len > 0 && err->msg[err->len - 1] == '\n') {
+    err->len--;
+    err->msg[err->len] = '\0';
+  }
+}
+
+
+/**
+ * @brief Raise `plzj.Error(code, message)`.
+ */
+static PyObject *PlzjPyErr_raise (const struct PlzjPyErr *err) {
+  PyObject *args = Py_BuildValue(
+    "(iN)", -err->ret, PyUnicode_DecodeUTF8(err->msg, err->len, "replace"));
+  if (args != NULL) {
+    PyErr_SetObject(PlzjPyError, args);
+    Py_DECREF(args);
+  }
+  return NULL;
+}
+
+
+/// Run `stmt` without the GIL, holding the lock of `file`.
+#define PLZJPY_WITH_FILE(file, stmt) do { \
+  Py_BEGIN_ALLOW_THREADS \
+  PyThread_acquire_lock((file)->lock, WAIT_LOCK); \
+  stmt; \
+  PyThread_release_lock((file)->lock); \
+  Py_END_ALLOW_THREADS \
+} while (0)
+
+
+/* Canvas */
+
+typedef struct {
+  PyObject_HEAD
+  struct PlzjCanvas canvas;
+  /// height x width x RGBA, C-contiguous
+  Py_ssize_t shape[3];
+  Py_ssize_t strides[3];
+} PlzjPyCanvas;
+
+static PyTypeObject PlzjPyCanvas_Type;
+
+
+static PlzjPyCanvas *PlzjPyCanvas_new (uint32_t width, uint32_t height) {
+  PlzjPyCanvas *self = PyObject_New(PlzjPyCanvas, &PlzjPyCanvas_Type);
+  return_if_fail (self != NULL) NULL;
+
+  self->canvas.pixels = malloc(
+    sizeof(*self->canvas.pixels) * (size_t) width * height);
+  if_fail (self->canvas.pixels != NULL) {
+    Py_DECREF(self);
+    return (PlzjPyCanvas *) PyErr_NoMemory();
+  }
+  self->canvas.width = width;
+  self->canvas.height = height;
+  self->shape[0] = height;
+  self->shape[1] = width;
+  self->shape[2] = sizeof(*self->canvas.pixels);
+  self->strides[0] = sizeof(*self->canvas.pixels) * (Py_ssize_t) width;
+  self->strides[1] = sizeof(*self->canvas.pixels);
+  self->strides[2] = 1;
+  return self;
+}
+
+
+/**
+ * @brief Make all pixels opaque, since the library leaves the alpha byte as
+ *   padding.
+ */
+static void PlzjPyCanvas_set_opaque (PlzjPyCanvas *self) {
+  size_t cnt = (size_t) self->canvas.width * self->canvas.height;
+  for (size_t i = 0; i < cnt; i++) {
+    self->canvas.pixels[i].a = 0xff;
+  }
+}
+
+
+static void PlzjPyCanvas_dealloc (PlzjPyCanvas *self) {
+  free(self->canvas.pixels);
+  PyObject_Free(self);
+}
+
+
+static int PlzjPyCanvas_getbuffer (
+    PlzjPyCanvas *self, Py_buffer *view, int flags) {
+  view->obj = Py_NewRef(self);
+  view->buf = self->canvas.pixels;
+  view->len = self->strides[0] * self->shape[0];
+  view->readonly = 0;
+  view->itemsize = 1;
+  view->format = (flags & PyBUF_FORMAT) != 0 ? "B" : NULL;
+  bool nd = (flags & PyBUF_ND) == PyBUF_ND;
+  view->ndim = nd ? 3 : 1;
+  view->shape = nd ? self->shape : NULL;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ?
+    self->strides : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+  return 0;
+}
+
+
+static PyObject *PlzjPyCanvas_get_width (PlzjPyCanvas *self, void *closure) {
+  (void) closure;
+  return PyLong_FromUnsignedLong(self->canvas.width);
+}
+
+
+static PyObject *PlzjPyCanvas_get_height (PlzjPyCanvas *self, void *closure) {
+  (void) closure;
+  return PyLong_FromUnsignedLong(self->canvas.height);
+}
+
+
+static PyGetSetDef PlzjPyCanvas_getset[] = {
+  {"width", (getter) PlzjPyCanvas_get_width, NULL, "Width in pixels.", NULL},
+  {"height", (getter) PlzjPyCanvas_get_height, NULL, "Height in pixels.",
+   NULL},
+  {NULL}
+};
+
+static PyBufferProcs PlzjPyCanvas_as_buffer = {
+  .bf_getbuffer = (getbufferproc) PlzjPyCanvas_getbuffer,
+};
+
+static PyTypeObject PlzjPyCanvas_Type = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "plzj.Canvas",
+  .tp_doc = PyDoc_STR(
+    "Screen of one frame, exported through the buffer protocol as RGBA bytes "
+    "of shape (height, width, 4). Alpha is always 255.\n\n"
+    "numpy.asarray(canvas) is a view of the pixels, not a copy."),
+  .tp_basicsize = sizeof(PlzjPyCanvas),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_dealloc = (destructor) PlzjPyCanvas_dealloc,
+  .tp_as_buffer = &PlzjPyCanvas_as_buffer,
+  .tp_getset = PlzjPyCanvas_getset,
+};
+
+
+/* File */
+
+typedef struct {
+  PyObject_HEAD
+  struct PlzjFile pf;
+  bool pf_valid;
+  /// serializes all use of the file, which sections share
+  PyThread_type_lock lock;
+} PlzjPyFile;
+
+static PyTypeObject PlzjPyFile_Type;
+
+
+static PyObject *PlzjPyFile_set_password_impl (
+    PlzjPyFile *self, const char *password, int force) {
+  int ret;
+  struct PlzjPyErr err;
+  PLZJPY_WITH_FILE(self, {
+    ret = PlzjFile_set_password_iconv(&self->pf, password, force);
+    if_fail (ret >= 0) {
+      PlzjPyErr_save(&err, ret);
+    }
+  });
+  return_if_fail (ret >= 0) PlzjPyErr_raise(&err);
+  return PyBool_FromLong(ret == 0);
+}
+
+
+static PyObject *PlzjPyFile_new (
+    PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"path", "password", "force", NULL};
+  PyObject *path;
+  const char *password = NULL;
+  int force = 0;
+  return_if_fail (PyArg_ParseTupleAndKeywords(
+    args, kwds, "O&|zp", kwlist, PyUnicode_FSConverter, &path, &password,
+    &force)) NULL;
+
+  PlzjPyFile *self = (PlzjPyFile *) type->tp_alloc(type, 0);
+  if_fail (self != NULL) {
+    Py_DECREF(path);
+    return NULL;
+  }
+  self->pf_valid = false;
+  self->lock = PyThread_allocate_lock();
+  if_fail (self->lock != NULL) {
+    Py_DECREF(path);
+    Py_DECREF(self);
+    return PyErr_NoMemory();
+  }
+
+  int ret;
+  struct PlzjPyErr err;
+  PLZJPY_WITH_FILE(self, {
+    ret = PlzjFile_init_file(&self->pf, PyBytes_AS_STRING(path), "rb");
+    if_fail (ret == 0) {
+      PlzjPyErr_save(&err, ret);
+    }
+  });
+  Py_DECREF(path);
+  if_fail (ret == 0) {
+    Py_DECREF(self);
+    return PlzjPyErr_raise(&err);
+  }
+  self->pf_valid = true;
+
+  if (password != NULL) {
+    PyObject *ok = PlzjPyFile_set_password_impl(self, password, force);
+    if_fail (ok != NULL) {
+      Py_DECREF(self);
+      return NULL;
+    }
+    if (ok == Py_False &&
+        PyErr_WarnEx(PyExc_RuntimeWarning, "wrong password, forced", 1) < 0) {
+      Py_DECREF(ok);
+      Py_DECREF(self);
+      return NULL;
+    }
+    Py_DECREF(ok);
+  }
+  return (PyObject *) self;
+}
+
+
+static void PlzjPyFile_dealloc (PlzjPyFile *self) {
+  if (self->pf_valid) {
+    PlzjFile_destroy(&self->pf);
+  }
+  if (self->lock != NULL) {
+    PyThread_free_lock(self->lock);
+  }
+  Py_TYPE(self)->tp_free(self);
+}
+
+
+static PyObject *PlzjPyFile_set_password (
+    PlzjPyFile *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"password", "force", NULL};
+  const char *password;
+  int force = 0;
+  return_if_fail (PyArg_ParseTupleAndKeywords(
+    args, kwds, "s|p", kwlist, &password, &force)) NULL;
+  return PlzjPyFile_set_password_impl(self, password, force);
+}
+
+
+static PyObject *PlzjPyFile_get_extended (PlzjPyFile *self, void *closure) {
+  (void) closure;
+  return PyBool_FromLong(self->pf.extended);
+}
+
+
+static Py_ssize_t PlzjPyFile_length (PlzjPyFile *self) {
+  return self->pf.sections_cnt;
+}
+
+
+/* Section */
+
+typedef struct {
+  PyObject_HEAD
+  PlzjPyFile *file;
+  struct Plzj *pl;
+  uint32_t index;
+} PlzjPySection;
+
+static PyTypeObject PlzjPySection_Type;
+
+
+static PyObject *PlzjPyFile_item (PlzjPyFile *self, Py_ssize_t i) {
+  if_fail (i >= 0 && (uint32_t) i < self->pf.sections_cnt) {
+    PyErr_SetString(PyExc_IndexError, "section index out of range");
+    return NULL;
+  }
+
+  PlzjPySection *section = PyObject_New(PlzjPySection, &PlzjPySection_Type);
+  return_if_fail (section != NULL) NULL;
+  section->file = (PlzjPyFile *) Py_NewRef(self);
+  section->pl = self->pf.sections + i;
+  section->index = i;
+  return (PyObject *) section;
+}
+
+
+static PyMethodDef PlzjPyFile_methods[] = {
+  {"set_password", (PyCFunction) (void (*) (void)) PlzjPyFile_set_password,
+   METH_VARARGS | METH_KEYWORDS,
+   PyDoc_STR(
+     "set_password(password, force=False) -> bool\n\n"
+     "Set the play password of all sections. Return False if the password "
+     "is wrong but `force` is set.")},
+  {NULL}
+};
+
+static PyGetSetDef PlzjPyFile_getset[] = {
+  {"extended", (getter) PlzjPyFile_get_extended, NULL,
+   "Whether the file has the sectioned footer.", NULL},
+  {NULL}
+};
+
+static PySequenceMethods PlzjPyFile_as_sequence = {
+  .sq_length = (lenfunc) PlzjPyFile_length,
+  .sq_item = (ssizeargfunc) PlzjPyFile_item,
+};
+
+static PyTypeObject PlzjPyFile_Type = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "plzj.File",
+  .tp_doc = PyDoc_STR(
+    "File(path, password=None, force=False)\n\n"
+    "EXE / LXE video, a sequence of its sections."),
+  .tp_basicsize = sizeof(PlzjPyFile),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_new = PlzjPyFile_new,
+  .tp_dealloc = (destructor) PlzjPyFile_dealloc,
+  .tp_as_sequence = &PlzjPyFile_as_sequence,
+  .tp_methods = PlzjPyFile_methods,
+  .tp_getset = PlzjPyFile_getset,
+};
+
+
+static void PlzjPySection_dealloc (PlzjPySection *self) {
+  Py_DECREF(self->file);
+  PyObject_Free(self);
+}
+
+
+static PyObject *plzjpy_str (
+    size_t (*fn) (const struct Plzj *, char *, size_t),
+    const struct Plzj *pl) {
+  char buf[512];
+  size_t len = fn(pl, buf, sizeof(buf));
+  return PyUnicode_DecodeUTF8(buf, min(len, sizeof(buf) - 1), "replace");
+}
+
+
+static PyObject *PlzjPySection_get_index (PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyLong_FromUnsignedLong(self->index);
+}
+
+
+static PyObject *PlzjPySection_get_caption (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return plzjpy_str(Plzj_get_caption, self->pl);
+}
+
+
+static PyObject *PlzjPySection_get_title (PlzjPySection *self, void *closure) {
+  (void) closure;
+  return plzjpy_str(Plzj_get_title, self->pl);
+}
+
+
+static PyObject *PlzjPySection_get_infotext (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return plzjpy_str(Plzj_get_infotext, self->pl);
+}
+
+
+static PyObject *PlzjPySection_get_width (PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyLong_FromUnsignedLong(le32toh(self->pl->video.width));
+}
+
+
+static PyObject *PlzjPySection_get_height (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyLong_FromUnsignedLong(le32toh(self->pl->video.height));
+}
+
+
+static PyObject *PlzjPySection_get_frames_cnt (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyLong_FromUnsignedLong(le32toh(self->pl->video.frames_cnt));
+}
+
+
+static PyObject *PlzjPySection_get_frame_ms (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyLong_FromUnsignedLong(le32toh(self->pl->video.frame_ms));
+}
+
+
+static PyObject *PlzjPySection_get_duration (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyFloat_FromDouble(
+    le32toh(self->pl->video.frames_cnt) *
+    (double) le32toh(self->pl->video.frame_ms) / 1000);
+}
+
+
+static PyObject *PlzjPySection_get_has_audio (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyBool_FromLong(self->pl->audio_offset != -1);
+}
+
+
+static PyObject *PlzjPySection_get_registered (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyBool_FromLong(Plzj_is_registered(self->pl));
+}
+
+
+static PyObject *PlzjPySection_get_locked (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyBool_FromLong(self->pl->key_set != 0);
+}
+
+
+static PyObject *PlzjPySection_get_key_required (
+    PlzjPySection *self, void *closure) {
+  (void) closure;
+  return PyBool_FromLong(self->pl->key_set < 0);
+}
+
+
+static PyObject *PlzjPySection_extract_audio (
+    PlzjPySection *self, PyObject *args) {
+  PyObject *dir;
+  return_if_fail (PyArg_ParseTuple(
+    args, "O&", PyUnicode_FSConverter, &dir)) NULL;
+
+  int ret;
+  struct PlzjPyErr err;
+  PLZJPY_WITH_FILE(self->file, {
+    ret = Plzj_extract_audio(self->pl, PyBytes_AS_STRING(dir));
+    if_fail (ret >= 0) {
+      PlzjPyErr_save(&err, ret);
+    }
+  });
+  Py_DECREF(dir);
+  return_if_fail (ret >= 0) PlzjPyErr_raise(&err);
+  return PyLong_FromLong(ret);
+}
+
+
+/* Video */
+
+typedef struct {
+  PyObject_HEAD
+  PlzjPyFile *file;
+  struct PlzjVideo video;
+} PlzjPyVideo;
+
+static PyTypeObject PlzjPyVideo_Type;
+
+
+static PyObject *PlzjPySection_video (
+    PlzjPySection *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"frames_limit", NULL};
+  int frames_limit = -1;
+  return_if_fail (PyArg_ParseTupleAndKeywords(
+    args, kwds, "|i", kwlist, &frames_limit)) NULL;
+
+  PlzjPyVideo *video = PyObject_New(PlzjPyVideo, &PlzjPyVideo_Type);
+  return_if_fail (video != NULL) NULL;
+  video->file = NULL;
+
+  int ret;
+  struct PlzjPyErr err;
+  PLZJPY_WITH_FILE(self->file, {
+    ret = PlzjVideo_init(&video->video, self->pl, frames_limit, false);
+    if_fail (ret == 0) {
+      PlzjPyErr_save(&err, ret);
+    }
+  });
+  if_fail (ret == 0) {
+    Py_DECREF(video);
+    return PlzjPyErr_raise(&err);
+  }
+  video->file = (PlzjPyFile *) Py_NewRef(self->file);
+  return (PyObject *) video;
+}
+
+
+static PyMethodDef PlzjPySection_methods[] = {
+  {"video", (PyCFunction) (void (*) (void)) PlzjPySection_video,
+   METH_VARARGS | METH_KEYWORDS,
+   PyDoc_STR(
+     "video(frames_limit=-1) -> Video\n\n"
+     "Index the frames of the section, at most `frames_limit` if not "
+     "negative.")},
+  {"extract_audio", (PyCFunction) PlzjPySection_extract_audio, METH_VARARGS,
+   PyDoc_STR(
+     "extract_audio(dir) -> int\n\n"
+     "Write the audio track into `dir`, nothing if the section has none.")},
+  {NULL}
+};
+
+static PyGetSetDef PlzjPySection_getset[] = {
+  {"index", (getter) PlzjPySection_get_index, NULL, "Index in the file.",
+   NULL},
+  {"caption", (getter) PlzjPySection_get_caption, NULL, "Section caption.",
+   NULL},
+  {"title", (getter) PlzjPySection_get_title, NULL, "Player title.", NULL},
+  {"infotext", (getter) PlzjPySection_get_infotext, NULL, "Info watermark.",
+   NULL},
+  {"width", (getter) PlzjPySection_get_width, NULL, "Screen width.", NULL},
+  {"height", (getter) PlzjPySection_get_height, NULL, "Screen height.",
+   NULL},
+  {"frames_cnt", (getter) PlzjPySection_get_frames_cnt, NULL,
+   "Number of frames in the header.", NULL},
+  {"frame_ms", (getter) PlzjPySection_get_frame_ms, NULL,
+   "Duration of each frame in milliseconds.", NULL},
+  {"duration", (getter) PlzjPySection_get_duration, NULL,
+   "Duration in seconds.", NULL},
+  {"has_audio", (getter) PlzjPySection_get_has_audio, NULL,
+   "Whether the section has an audio track.", NULL},
+  {"registered", (getter) PlzjPySection_get_registered, NULL,
+   "Whether the recorder was registered.", NULL},
+  {"locked", (getter) PlzjPySection_get_locked, NULL,
+   "Whether the section is play locked.", NULL},
+  {"key_required", (getter) PlzjPySection_get_key_required, NULL,
+   "Whether the section is play locked and no password is set.", NULL},
+  {NULL}
+};
+
+static PyTypeObject PlzjPySection_Type = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "plzj.Section",
+  .tp_doc = PyDoc_STR("Section of a File, with metadata from its headers."),
+  .tp_basicsize = sizeof(PlzjPySection),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_dealloc = (destructor) PlzjPySection_dealloc,
+  .tp_methods = PlzjPySection_methods,
+  .tp_getset = PlzjPySection_getset,
+};
+
+
+static void PlzjPyVideo_dealloc (PlzjPyVideo *self) {
+  if (self->file != NULL) {
+    PlzjVideo_destroy(&self->video);
+    Py_DECREF(self->file);
+  }
+  PyObject_Free(self);
+}
+
+
+/**
+ * @brief Reconstruct frame `i` into `canvas`.
+ */
+static int PlzjPyVideo_fill (
+    PlzjPyVideo *self, Py_ssize_t i, PlzjPyCanvas *canvas) {
+  int ret;
+  struct PlzjPyErr err;
+  PLZJPY_WITH_FILE(self->file, {
+    ret = PlzjVideo_get_frame(&self->video, i, &canvas->canvas);
+    if_fail (ret == 0) {
+      PlzjPyErr_save(&err, ret);
+    } else {
+      PlzjPyCanvas_set_opaque(canvas);
+    }
+  });
+  if_fail (ret == 0) {
+    PlzjPyErr_raise(&err);
+  }
+  return ret;
+}
+
+
+static Py_ssize_t PlzjPyVideo_length (PlzjPyVideo *self) {
+  return self->video.frames_cnt;
+}
+
+
+static PyObject *PlzjPyVideo_item (PlzjPyVideo *self, Py_ssize_t i) {
+  if_fail (i >= 0 && (size_t) i < self->video.frames_cnt) {
+    PyErr_SetString(PyExc_IndexError, "frame index out of range");
+    return NULL;
+  }
+
+  const struct Plzj *pl = self->video.pl;
+  PlzjPyCanvas *canvas = PlzjPyCanvas_new(
+    le32toh(pl->video.width), le32toh(pl->video.height));
+  return_if_fail (canvas != NULL) NULL;
+  if_fail (PlzjPyVideo_fill(self, i, canvas) == 0) {
+    Py_DECREF(canvas);
+    return NULL;
+  }
+  return (PyObject *) canvas;
+}
+
+
+static PyObject *PlzjPyVideo_get_frame (
+    PlzjPyVideo *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"i", "out", NULL};
+  Py_ssize_t i;
+  PyObject *out = Py_None;
+  return_if_fail (PyArg_ParseTupleAndKeywords(
+    args, kwds, "n|O", kwlist, &i, &out)) NULL;
+
+  if (out == Py_None) {
+    return PlzjPyVideo_item(self, i);
+  }
+
+  if_fail (PyObject_TypeCheck(out, &PlzjPyCanvas_Type)) {
+    PyErr_SetString(PyExc_TypeError, "out must be a Canvas");
+    return NULL;
+  }
+  if_fail (i >= 0 && (size_t) i < self->video.frames_cnt) {
+    PyErr_SetString(PyExc_IndexError, "frame index out of range");
+    return NULL;
+  }
+  // size is checked by the library
+  return_if_fail (PlzjPyVideo_fill(self, i, (PlzjPyCanvas *) out) == 0) NULL;
+  return Py_NewRef(out);
+}
+
+
+static PyObject *PlzjPyVideo_cursor (PlzjPyVideo *self, PyObject *args) {
+  Py_ssize_t i;
+  return_if_fail (PyArg_ParseTuple(args, "n", &i)) NULL;
+  if_fail (i >= 0 && (size_t) i < self->video.frames_cnt) {
+    PyErr_SetString(PyExc_IndexError, "frame index out of range");
+    return NULL;
+  }
+
+  const struct PlzjCursor *cursor = &self->video.cursors[i];
+  return_if_fail (PlzjCursor_valid(cursor)) Py_NewRef(Py_None);
+  return Py_BuildValue("(ii)", cursor->p.x, cursor->p.y);
+}
+
+
+static PyObject *PlzjPyVideo_get_frame_ms (PlzjPyVideo *self, void *closure) {
+  (void) closure;
+  return PyLong_FromUnsignedLong(self->video.frame_ms);
+}
+
+
+static PyMethodDef PlzjPyVideo_methods[] = {
+  {"get_frame", (PyCFunction) (void (*) (void)) PlzjPyVideo_get_frame,
+   METH_VARARGS | METH_KEYWORDS,
+   PyDoc_STR(
+     "get_frame(i, out=None) -> Canvas\n\n"
+     "Reconstruct frame `i`, into the canvas `out` if given, reusing its "
+     "pixels.")},
+  {"cursor", (PyCFunction) PlzjPyVideo_cursor, METH_VARARGS,
+   PyDoc_STR(
+     "cursor(i) -> (x, y) | None\n\n"
+     "Top-left of the cursor at frame `i`, None if unknown.")},
+  {NULL}
+};
+
+static PyGetSetDef PlzjPyVideo_getset[] = {
+  {"frame_ms", (getter) PlzjPyVideo_get_frame_ms, NULL,
+   "Duration of each frame in milliseconds.", NULL},
+  {NULL}
+};
+
+static PySequenceMethods PlzjPyVideo_as_sequence = {
+  .sq_length = (lenfunc) PlzjPyVideo_length,
+  .sq_item = (ssizeargfunc) PlzjPyVideo_item,
+};
+
+static PyTypeObject PlzjPyVideo_Type = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "plzj.Video",
+  .tp_doc = PyDoc_STR(
+    "Frames of a section, a sequence of Canvas.\n\n"
+    "Frames are replayed from the nearest keyframe or recently decoded "
+    "frame, so iterating in order only applies the patches of each frame. "
+    "Decoding releases the GIL."),
+  .tp_basicsize = sizeof(PlzjPyVideo),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_dealloc = (destructor) PlzjPyVideo_dealloc,
+  .tp_as_sequence = &PlzjPyVideo_as_sequence,
+  .tp_methods = PlzjPyVideo_methods,
+  .tp_getset = PlzjPyVideo_getset,
+};
+
+
+/* module */
+
+static PyObject *plzjpy_set_log_level (PyObject *module, PyObject *args) {
+  (void) module;
+  unsigned int level;
+  return_if_fail (PyArg_ParseTuple(args, "I", &level)) NULL;
+  sc_log_level = level;
+  Py_RETURN_NONE;
+}
+
+
+static PyMethodDef plzjpy_methods[] = {
+  {"set_log_level", plzjpy_set_log_level, METH_VARARGS,
+   PyDoc_STR(
+     "set_log_level(level)\n\n"
+     "Set the level of messages printed to stderr, from 0 (emergency) to 8 "
+     "(verbose).")},
+  {NULL}
+};
+
+static struct PyModuleDef plzjpy_module = {
+  PyModuleDef_HEAD_INIT,
+  .m_name = "plzj",
+  .m_doc = PyDoc_STR("Reader of EXE / LXE screen recordings."),
+  .m_size = -1,
+  .m_methods = plzjpy_methods,
+};
+
+
+PyMODINIT_FUNC PyInit_plzj (void) {
+  PyTypeObject *types[] = {
+    &PlzjPyCanvas_Type, &PlzjPyFile_Type, &PlzjPySection_Type,
+    &PlzjPyVideo_Type,
+  };
+  for (size_t i = 0; i < arraysize(types); i++) {
+    return_if_fail (PyType_Ready(types[i]) == 0) NULL;
+  }
+
+  PyObject *module = PyModule_Create(&plzjpy_module);
+  return_if_fail (module != NULL) NULL;
+
+  PlzjPyError = PyErr_NewExceptionWithDoc(
+    "plzj.Error", "Error of the library, with args (code, message).",
+    PyExc_RuntimeError, NULL);
+  goto_if_fail (PlzjPyError != NULL) fail;
+  goto_if_fail (PyModule_AddObjectRef(module, "Error", PlzjPyError) == 0)
+    fail;
+
+  for (size_t i = 0; i < arraysize(types); i++) {
+    goto_if_fail (PyModule_AddObjectRef(
+      module, strchr(types[i]->tp_name, '.') + 1, (PyObject *) types[i]
+    ) == 0) fail;
+  }
+  return module;
+
+fail:
+  Py_DECREF(module);
+  return NULL;
+}
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# Build the `plzj` extension module from the library sources:
+#   pip install ./python
+
+import glob
+import os
+import shlex
+import subprocess
+import sys
+
+from setuptools import Extension, setup
+
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def pkg_config(*args: str) -> list[str]:
+    try:
+        out = subprocess.check_output(
+            ['pkg-config', *args, 'zlib', 'libpng'], text=True)
+    except (OSError, subprocess.CalledProcessError):
+        return []
+    return shlex.split(out)
+
+
+sources = [os.path.join(ROOT, 'python', 'plzjmodule.c')]
+sources += sorted(glob.glob(os.path.join(ROOT, 'lib', '*.c')))
+sources += sorted(glob.glob(os.path.join(ROOT, 'lib', 'platform', '*.c')))
+
+define_macros = [
+    ('_DEFAULT_SOURCE', None),
+    ('_FILE_OFFSET_BITS', '64'),
+    ('PLZJ_BUILDING_STATIC', None),
+]
+extra_compile_args = ['-std=c2x']
+extra_link_args = []
+libraries = []
+if sys.platform == 'win32':
+    define_macros += [('UNICODE', None), ('_UNICODE', None),
+                      ('SC_LOG_NO_COLOR', None)]
+else:
+    if sys.platform.startswith('linux'):
+        define_macros.append(('HAVE_PTHREAD_NAME', None))
+    extra_compile_args.append('-pthread')
+    extra_link_args.append('-pthread')
+    libraries.append('m')
+
+include_dirs = [ROOT]
+library_dirs = []
+for flag in pkg_config('--cflags-only-I'):
+    include_dirs.append(flag[2:])
+libs = pkg_config('--libs')
+for flag in libs:
+    if flag.startswith('-l'):
+        libraries.append(flag[2:])
+    elif flag.startswith('-L'):
+        library_dirs.append(flag[2:])
+if not libs:
+    libraries += ['png', 'z']
+
+
+setup(
+    name='plzj',
+    version='0.0.0',
+    description='Reader of EXE / LXE screen recordings',
+    python_requires='>=3.10',
+    ext_modules=[Extension(
+        'plzj', sources,
+        include_dirs=include_dirs,
+        define_macros=define_macros,
+        libraries=libraries,
+        library_dirs=library_dirs,
+        extra_compile_args=extra_compile_args,
+        extra_link_args=extra_link_args,
+    )],
+)
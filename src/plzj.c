@@ -1,6 +1,7 @@
 #include <getopt.h>
 #include <inttypes.h>
 #include <math.h>
+#include <stdatomic.h>
 #include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -8,13 +9,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <zlib.h>
 
 #include "lib/include/platform/endian.h"
 #include "lib/platform/nowide.h"
+#include "lib/platform/nproc.h"
 
 #include "lib/include/parser.h"
+#include "lib/include/video.h"
+#include "lib/threadpool.h"
 #include "lib/utils.h"
 #include "lib/macro.h"
 #include "lib/log.h"
@@ -32,6 +37,7 @@ struct PlzjOptions {
     bool extract_cursor : 1;
     bool extract_audio : 1;
     bool extract_txts : 1;
+    bool extract_thumbnails : 1;
   };
 
   struct {
@@ -41,13 +47,48 @@ struct PlzjOptions {
     bool do_register : 1;
   };
 
+  /// batch mode, all positional arguments are inputs
+  bool batch;
+  char **batch_inputs;
+  size_t batch_inputs_cnt;
+  char *batch_list;
+  char *output_dir;
+  char *json_path;
+  long jobs;
+
   float fps;
+  /// seconds between output frames in decimation mode, 0 for every frame
+  float interval;
+  /// output is n times smaller in both directions
+  long scale;
   long section_i;
+  bool all_sections;
   long frames_limit;
   long compression_level;
+  /// throughput targets of adaptive compression level
+  float target_fps;
+  float target_mbps;
   long nproc;
   bool use_subframes;
   bool with_cursor;
+  bool to_mkv;
+  /// write APNG without seeking back
+  bool stream;
+  /// save progress periodically and resume from it
+  bool checkpoint;
+  /// draw the cursor highlight of the player
+  bool highlight;
+  enum PlzjInterp interp;
+  /// thumbnail of every n-th keyframe
+  long thumbnails_every;
+  long thumbnail_width;
+  /// region of the screen to extract video from, whole screen if width is 0
+  int32_t crop_left;
+  int32_t crop_top;
+  uint32_t crop_width;
+  uint32_t crop_height;
+  /// modify the input file instead of a copy
+  bool in_place;
   bool force;
   bool verbose;
 };
@@ -74,6 +115,10 @@ Default output directory is '<video>.extracted'.\n\
   --cursor              extract cursor icons and traces\n\
   --audio               extract audio\n\
   --txts                extract auxiliary text files (mouse events)\n\
+  --thumbnails <n>      write thumbnails of every <n>-th keyframe and a contact\n\
+                        sheet of them, decoding keyframes only\n\
+  --thumb-width <px>    width of thumbnails at most, 0 for full size\n\
+                        (default: 160)\n\
   -r, --framerate <fps> target to <fps> frame per second as much as possible,\n\
                         smooth cursor movement by interpolation (ignored if '-x'\n\
                         specified) (default: 30)\n\
@@ -83,18 +128,55 @@ Default output directory is '<video>.extracted'.\n\
         Further reduce file size by additional transition frames, with their\n\
         delay times set to 1 ms. Some players might enforce a minimal delay time\n\
         for one frame (100 ms for example), but ffmpeg can process it correctly.\n\
+  --mkv                 write video as Matroska, with audio muxed in if it is\n\
+                        extracted, instead of separate APNG and audio files\n\
+  --stream              write APNG without seeking back, so '<output>/video.apng'\n\
+                        can be a named pipe (always on for non-seekable files);\n\
+                        frames are decoded twice, first to count them\n\
+  --checkpoint          save progress of APNG to '<output>/video.apng.ckpt'\n\
+                        every minute, and resume from it if present\n\
+  --highlight           draw the cursor highlight circle if the recording\n\
+                        enables it\n\
   -s, --section <n>     extract section <n> (required if file has multiple\n\
-                        sections) (default: 0)\n\
+                        sections) (default: 0); 'all' extracts every section\n\
+                        into '<output>/<n>' in parallel\n\
   -n, --frames <n>      only process first <n> frames\n\
+  --crop <WxH+X+Y>      only extract the <W>x<H> region of the screen at <X>,<Y>,\n\
+                        parts of frames outside it are not decoded\n\
+  --interval <sec>      only output one frame every <sec> seconds, without\n\
+                        decoding what is overwritten in between\n\
+  --scale <n>           shrink video <n> times in both directions (1 - 15)\n\
+                        (default: 1)\n\
   -c, --compression <n> specify zlib compression level (0 no compression - 9\n\
                         best compression) (default: 9)\n\
+  --target-fps <fps>    lower compression level of large frames when needed\n\
+                        to encode <fps> frames per second, '-c' sets the\n\
+                        highest level\n\
+  --target-rate <MB/s>  likewise, to encode <MB/s> of uncompressed frames per\n\
+                        second\n\
   -t, --threads <n>     use <n> threads (default: number of cores)\n\
+  --interp <kernel>     cursor interpolation kernel, 'linear', 'cubic' or\n\
+                        'lanczos' (default: cubic)\n\
+", stdout);
+  fputs("\
+\n\
+Batch options:\n\
+  -B, --batch           treat every positional argument as an input file, and\n\
+                        extract each into '<video>.extracted' (default: '-e')\n\
+  --batch-list <file>   read input files from <file> ('-' for stdin), one per\n\
+                        line, implies '-B'\n\
+  -O, --output-dir <dir>  put outputs of batch mode into <dir>\n\
+  -j, --jobs <n>        process <n> files at the same time, sharing threads of\n\
+                        '-t' (default: number of threads)\n\
+  --json <file>         write summary of batch mode as JSON to <file> ('-' for\n\
+                        stdout)\n\
 \n\
 Modify options:\n\
 Default output path is '<video>.modified.exe'.\n\
   -u, --unlock          remove edit lock or play lock (password required if play\n\
                         locked)\n\
   --set-key <password>  set password to <password>\n\
+  --in-place            modify <video.exe> itself instead of writing a copy\n\
 \n\
 General options:\n\
   -k, --key <password>  use <password> as password\n\
@@ -142,6 +224,41 @@ static inline char *get_extension (const char *path) {
 }
 
 
+static int batch_add_input (struct PlzjOptions *options, const char *path) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+  char **inputs = realloc(
+    options->batch_inputs,
+    sizeof(*inputs) * (options->batch_inputs_cnt + 1));
+  return_if_fail (inputs != NULL) -1;
+  options->batch_inputs = inputs;
+
+  inputs[options->batch_inputs_cnt] = strdup(path);
+  return_if_fail (inputs[options->batch_inputs_cnt] != NULL) -1;
+  options->batch_inputs_cnt++;
+  return 0;
+#pragma GCC diagnostic pop
+}
+
+
+static int set_batch (struct PlzjOptions *options) {
+  return_if_fail (!options->batch) 0;
+  options->batch = true;
+
+  // positional arguments before '-B' are inputs too
+  char *paths[] = {options->input_path, options->output_path};
+  for (unsigned int i = 0; i < 2; i++) {
+    if (paths[i] != NULL) {
+      return_if_fail (batch_add_input(options, paths[i]) == 0) -1;
+      free(paths[i]);
+    }
+  }
+  options->input_path = NULL;
+  options->output_path = NULL;
+  return 0;
+}
+
+
 static int get_options (struct PlzjOptions *options, int argc, char **argv) {
   *options = (struct PlzjOptions) {
     .fps = 30,
@@ -149,6 +266,9 @@ static int get_options (struct PlzjOptions *options, int argc, char **argv) {
     .frames_limit = -1,
     .compression_level = Z_BEST_COMPRESSION,
     .with_cursor = true,
+    .thumbnails_every = 1,
+    .thumbnail_width = 160,
+    .scale = 1,
   };
 
   static const struct option longopts[] = {
@@ -158,17 +278,36 @@ static int get_options (struct PlzjOptions *options, int argc, char **argv) {
     {"cursor", no_argument, NULL, 257},
     {"audio", no_argument, NULL, 258},
     {"txts", no_argument, NULL, 259},
+    {"thumbnails", required_argument, NULL, 270},
+    {"thumb-width", required_argument, NULL, 271},
+    {"crop", required_argument, NULL, 272},
+    {"interval", required_argument, NULL, 273},
+    {"scale", required_argument, NULL, 274},
 
     {"framerate", required_argument, NULL, 'r'},
     {"raw", no_argument, NULL, 'x'},
     {"modified", no_argument, NULL, 'm'},
+    {"mkv", no_argument, NULL, 261},
     {"section", required_argument, NULL, 's'},
     {"frames", required_argument, NULL, 'n'},
     {"compression", required_argument, NULL, 'c'},
     {"threads", required_argument, NULL, 't'},
+    {"interp", required_argument, NULL, 265},
+    {"stream", no_argument, NULL, 266},
+    {"target-fps", required_argument, NULL, 267},
+    {"target-rate", required_argument, NULL, 268},
+    {"checkpoint", no_argument, NULL, 269},
+    {"highlight", no_argument, NULL, 275},
+
+    {"batch", no_argument, NULL, 'B'},
+    {"batch-list", required_argument, NULL, 262},
+    {"output-dir", required_argument, NULL, 'O'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"json", required_argument, NULL, 263},
 
     {"unlock", no_argument, NULL, 'u'},
     {"set-key", required_argument, NULL, 260},
+    {"in-place", no_argument, NULL, 264},
 
     {"key", required_argument, NULL, 'k'},
     {"force", no_argument, NULL, 'f'},
@@ -181,9 +320,11 @@ static int get_options (struct PlzjOptions *options, int argc, char **argv) {
   };
 
   for (int option; (option = getopt_long(
-       argc, argv, "-ear:xms:n:c:t:uk:fvdh", longopts, NULL)) != -1;) {
+       argc, argv, "-ear:xms:n:c:t:BO:j:uk:fvdh", longopts, NULL)) != -1;) {
     if (option == 1) {
-      if (options->input_path == NULL) {
+      if (options->batch) {
+        return_if_fail (batch_add_input(options, optarg) == 0) -1;
+      } else if (options->input_path == NULL) {
         options->input_path = strdup(optarg);
         return_if_fail (options->input_path != NULL) -1;
       } else if (options->output_path == NULL) {
@@ -219,6 +360,104 @@ static int get_options (struct PlzjOptions *options, int argc, char **argv) {
           }
           options->set_password = true;
           break;
+        case 261:
+          options->to_mkv = true;
+          break;
+        case 262:
+          free(options->batch_list);
+          options->batch_list = strdup(optarg);
+          return_if_fail (options->batch_list != NULL) -1;
+          return_if_fail (set_batch(options) == 0) -1;
+          break;
+        case 263:
+          free(options->json_path);
+          options->json_path = strdup(optarg);
+          return_if_fail (options->json_path != NULL) -1;
+          break;
+        case 264:
+          options->in_place = true;
+          break;
+        case 265:
+          if (strcmp(optarg, "linear") == 0) {
+            options->interp = PLZJ_INTERP_LINEAR;
+          } else if (strcmp(optarg, "cubic") == 0) {
+            options->interp = PLZJ_INTERP_CUBIC;
+          } else if (strcmp(optarg, "lanczos") == 0) {
+            options->interp = PLZJ_INTERP_LANCZOS;
+          } else {
+            fputs("error: unknown interpolation kernel\n", stderr);
+            return -2;
+          }
+          break;
+        case 266:
+          options->stream = true;
+          break;
+        case 267:
+          if_fail (argtof(optarg, &options->target_fps, 0, 1e6) == 0) {
+            fputs(
+              "error: target framerate not a non-negative number\n", stderr);
+            return -2;
+          }
+          break;
+        case 268:
+          if_fail (argtof(optarg, &options->target_mbps, 0, 1e6) == 0) {
+            fputs("error: target rate not a non-negative number\n", stderr);
+            return -2;
+          }
+          break;
+        case 269:
+          options->checkpoint = true;
+          break;
+        case 270:
+          if_fail (argtol(
+              optarg, &options->thumbnails_every, 1, INT_MAX) == 0) {
+            fputs(
+              "error: keyframe interval not a positive integer\n", stderr);
+            return -2;
+          }
+          options->extract_thumbnails = true;
+          break;
+        case 271:
+          if_fail (argtol(
+              optarg, &options->thumbnail_width, 0, INT_MAX) == 0) {
+            fputs(
+              "error: thumbnail width not a non-negative integer\n", stderr);
+            return -2;
+          }
+          break;
+        case 272: {
+          int n;
+          if_fail (sscanf(
+              optarg, "%" SCNu32 "x%" SCNu32 "+%" SCNd32 "+%" SCNd32 "%n",
+              &options->crop_width, &options->crop_height,
+              &options->crop_left, &options->crop_top, &n) == 4 &&
+              optarg[n] == '\0' && options->crop_left >= 0 &&
+              options->crop_top >= 0 && options->crop_width > 0 &&
+              options->crop_height > 0 &&
+              options->crop_width <=
+                (uint32_t) (INT32_MAX - options->crop_left) &&
+              options->crop_height <=
+                (uint32_t) (INT32_MAX - options->crop_top)) {
+            fputs("error: crop region not in the form WxH+X+Y\n", stderr);
+            return -2;
+          }
+          break;
+        }
+        case 273:
+          if_fail (argtof(optarg, &options->interval, 0, 3600) == 0) {
+            fputs("error: interval not a non-negative number\n", stderr);
+            return -2;
+          }
+          break;
+        case 274:
+          if_fail (argtol(optarg, &options->scale, 1, 15) == 0) {
+            fputs("error: scale not an integer between 1 and 15\n", stderr);
+            return -2;
+          }
+          break;
+        case 275:
+          options->highlight = true;
+          break;
         default:
           return -2;
       }
@@ -235,6 +474,21 @@ static int get_options (struct PlzjOptions *options, int argc, char **argv) {
           options->extract_audio = true;
           break;
 
+        case 'B':
+          return_if_fail (set_batch(options) == 0) -1;
+          break;
+        case 'O':
+          free(options->output_dir);
+          options->output_dir = strdup(optarg);
+          return_if_fail (options->output_dir != NULL) -1;
+          break;
+        case 'j':
+          if_fail (argtol(optarg, &options->jobs, 1, INT_MAX) == 0) {
+            fputs("error: number of jobs not a positive integer\n", stderr);
+            return -2;
+          }
+          break;
+
         case 'r':
           if_fail (argtof(optarg, &options->fps, 0, 480) == 0) {
             fputs("error: framerate not a non-negative number\n", stderr);
@@ -248,6 +502,11 @@ static int get_options (struct PlzjOptions *options, int argc, char **argv) {
           options->use_subframes = true;
           break;
         case 's':
+          if (strcmp(optarg, "all") == 0) {
+            options->all_sections = true;
+            break;
+          }
+          options->all_sections = false;
           if_fail (argtol(optarg, &options->section_i, 0, INT_MAX) == 0) {
             fputs("error: section index not a non-negative integer\n", stderr);
             return -2;
@@ -324,6 +583,24 @@ static int get_options (struct PlzjOptions *options, int argc, char **argv) {
     }
   }
 
+  if (options->batch) {
+    if_fail (options->batch_inputs_cnt > 0 || options->batch_list != NULL) {
+      fputs("error: missing input file\n", stderr);
+      return -2;
+    }
+    if_fail (!options->set_password) {
+      fputs("error: batch mode only supports extract actions\n", stderr);
+      return -2;
+    }
+    if (!(options->extract_audio || options->extract_video ||
+          options->extract_cursor || options->extract_txts ||
+          options->extract_thumbnails)) {
+      options->extract_audio = true;
+      options->extract_video = true;
+    }
+    return 0;
+  }
+
   if_fail (options->input_path != NULL) {
     fputs("error: missing input file\n", stderr);
     return -2;
@@ -331,7 +608,8 @@ static int get_options (struct PlzjOptions *options, int argc, char **argv) {
 
   bool actions_extract =
     options->extract_audio || options->extract_video ||
-    options->extract_cursor || options->extract_txts;
+    options->extract_cursor || options->extract_txts ||
+    options->extract_thumbnails;
   bool actions_modify = options->set_password;
 
   if (actions_extract + actions_modify > 1) {
@@ -341,6 +619,20 @@ static int get_options (struct PlzjOptions *options, int argc, char **argv) {
     return -2;
   }
 
+  if (options->in_place) {
+    if_fail (actions_modify) {
+      fputs("error: '--in-place' requires a modify action\n", stderr);
+      return -2;
+    }
+    if_fail (options->output_path == NULL) {
+      fputs("error: '--in-place' does not take an output path\n", stderr);
+      return -2;
+    }
+    options->output_path = strdup(options->input_path);
+    return_if_fail (options->output_path != NULL) -1;
+    return 0;
+  }
+
   if (options->output_path != NULL) {
     if (!actions_extract && !actions_modify) {
       options->extract_audio = true;
@@ -432,6 +724,133 @@ static int set_password (
 }
 
 
+static unsigned int get_decimate (
+    const struct PlzjOptions *options, const struct Plzj *pl) {
+  uint32_t frame_ms = le32toh(pl->video.frame_ms);
+  return_if_fail (options->interval > 0 && frame_ms > 0) 1;
+  float decimate = roundf(options->interval * 1000 / frame_ms);
+  return decimate < 1 ? 1 : decimate > 0xffff ? 0xffff : decimate;
+}
+
+
+static unsigned int get_fps_ratio (
+    const struct PlzjOptions *options, const struct Plzj *pl, float *fpsp) {
+  uint32_t frame_ms = le32toh(pl->video.frame_ms);
+  float fps = 1000. / frame_ms;
+  unsigned int ratio = 1;
+  if (options->interval > 0) {
+    fps /= get_decimate(options, pl);
+  } else if (options->with_cursor) {
+    ratio = ((uint32_t) (options->fps * frame_ms) + 500) / 1000;
+    if (ratio < 1) {
+      ratio = 1;
+    }
+    fps *= ratio;
+  }
+  *fpsp = fps;
+  return ratio;
+}
+
+
+static void print_fps (const struct PlzjOptions *options, float fps) {
+  if ((options->with_cursor || options->interval > 0) &&
+      (options->verbose || fabs(fps - options->fps) > 0.01)) {
+    printf("Framerate set to %.2f.\n", fps);
+  }
+}
+
+
+static float get_extract_options (
+    const struct PlzjOptions *options, const struct Plzj *pl,
+    struct PlzjVideoExtractOptions *extract_options) {
+  float fps = 0;
+  unsigned int ratio = 1;
+  if (options->extract_video || options->extract_cursor) {
+    ratio = get_fps_ratio(options, pl, &fps);
+  }
+
+  *extract_options = (struct PlzjVideoExtractOptions) {
+    .frames_limit = options->frames_limit,
+    .video = {
+      .flags =
+        (options->with_cursor ? PLZJ_VIDEO_CURSOR :
+         options->use_subframes ? PLZJ_VIDEO_SUBFRAMES : 0) |
+        (options->to_mkv ? PLZJ_VIDEO_MKV : 0) |
+        (options->to_mkv && options->extract_audio ? PLZJ_VIDEO_MKV_AUDIO : 0) |
+        (options->stream ? PLZJ_VIDEO_STREAM : 0) |
+        (options->checkpoint ? PLZJ_VIDEO_CHECKPOINT : 0) |
+        (options->highlight ? PLZJ_VIDEO_HIGHLIGHT : 0),
+      .interp = options->interp,
+      .transitions_cnt = ratio - 1,
+      .decimate = get_decimate(options, pl),
+      .scale = options->scale,
+      .compression_level = options->compression_level,
+      .target_fps = options->target_fps,
+      .target_mbps = options->target_mbps,
+      .nproc = options->nproc,
+      .crop_left = options->crop_left,
+      .crop_top = options->crop_top,
+      .crop_width = options->crop_width,
+      .crop_height = options->crop_height,
+    },
+    .thumbnails_every = options->thumbnails_every,
+    .thumbnail_width = options->thumbnail_width,
+    .extract_video = options->extract_video,
+    .extract_cursor = options->extract_cursor,
+    .extract_audio = options->extract_audio,
+    .extract_txts = options->extract_txts,
+    .extract_thumbnails = options->extract_thumbnails,
+  };
+  return fps;
+}
+
+
+struct ExtractAuxJob {
+  const struct PlzjOptions *options;
+  const struct Plzj *pl;
+  const char *dir;
+
+  int audio_ret;
+  int txts_ret;
+  struct ScException exc;
+};
+
+
+static int extract_aux_worker (void *arg) {
+  struct ExtractAuxJob *job = arg;
+
+  // audio and txt files are pure I/O, use an independent file handle so they
+  // do not fight with video decoding over the file position
+  struct Plzj pl = *job->pl;
+  pl.file = mfopen(job->options->input_path, "rb");
+  if_fail (pl.file != NULL) {
+    job->audio_ret = job->txts_ret = ERR_STD(mfopen);
+    job->exc = sc_exc;
+    return 0;
+  }
+
+  if (job->options->extract_audio && pl.audio_offset != -1 &&
+      !(job->options->to_mkv && job->options->extract_video)) {
+    job->audio_ret = Plzj_extract_audio(&pl, job->dir);
+    if_fail (job->audio_ret >= 0) {
+      job->exc = sc_exc;
+      goto end;
+    }
+  }
+
+  if (job->options->extract_txts) {
+    job->txts_ret = Plzj_extract_txts(&pl, job->dir);
+    if_fail (job->txts_ret == 0) {
+      job->exc = sc_exc;
+    }
+  }
+
+end:
+  fclose(pl.file);
+  return 0;
+}
+
+
 static int do_extract (
     const struct PlzjOptions *options, struct PlzjFile *pf, int i) {
   if (i < 0) {
@@ -450,7 +869,8 @@ static int do_extract (
     return -1;
   }
 
-  if (options->extract_video || options->extract_cursor) {
+  if (options->extract_video || options->extract_cursor ||
+      options->extract_thumbnails) {
     return_if_fail (set_password(options, pf) >= 0) -1;
   }
 
@@ -475,38 +895,74 @@ static int do_extract (
   const char *what;
   float fps = 0;
 
-  if (options->extract_video || options->extract_cursor) {
-    uint32_t frame_ms = le32toh(pl->video.frame_ms);
-    fps = 1000. / frame_ms;
-    unsigned int ratio = 1;
-    if (options->with_cursor) {
-      ratio = ((uint32_t) (options->fps * frame_ms) + 500) / 1000;
-      if (ratio < 1) {
-        ratio = 1;
-      }
-      fps *= ratio;
-      if (options->verbose || fabs(fps - options->fps) > 0.01) {
-        printf("Framerate set to %.2f.\n", fps);
-      }
+  // run audio and txt files alongside the CPU-bound video encoding
+  struct ExtractAuxJob aux_job = {.options = options, .pl = pl, .dir = dir};
+  struct ThreadPool aux_pool;
+  bool aux_run = false;
+  // Matroska output carries the audio track itself
+  bool audio_muxed =
+    options->to_mkv && options->extract_video && options->extract_audio;
+  if ((options->extract_audio && !audio_muxed) || options->extract_txts) {
+    if_fail (ThreadPool_init(&aux_pool, 1, "audio") == 0) {
+      what = "audio";
+      goto fail;
+    }
+    if_fail (ThreadPool_run(&aux_pool, extract_aux_worker, &aux_job) == 0) {
+      ThreadPool_destroy(&aux_pool);
+      what = "audio";
+      goto fail;
     }
+    aux_run = true;
+  }
+
+  if (options->extract_video || options->extract_cursor) {
+    struct PlzjVideoExtractOptions extract_options;
+    fps = get_extract_options(options, pl, &extract_options);
+    print_fps(options, fps);
 
-    if_fail (Plzj_extract_video_or_cursor(
-        pl, dir, options->frames_limit,
-        options->with_cursor ? 2 : options->use_subframes ? 1 : 0, ratio - 1,
-        options->compression_level, options->nproc,
-        options->extract_video, options->extract_cursor) == 0) {
+    res = Plzj_extract_video_or_cursor(pl, dir, &extract_options);
+    if_fail (res >= 0) {
       what = "video / cursor";
       goto fail;
     }
+    if (res > 0) {
+      audio_muxed = false;
+    }
     fputs("Video / cursor extracted.\n", stdout);
   }
 
+  if (options->extract_thumbnails) {
+    res = Plzj_extract_thumbnails(
+      pl, dir, options->frames_limit, options->thumbnails_every,
+      options->thumbnail_width);
+    if_fail (res >= 0) {
+      what = "thumbnails";
+      goto fail;
+    }
+    fputs(res == 1 ? "File does not contain key frames.\n" :
+          res > 0 ? "Key frames do not contain full-frame images.\n" :
+          "Thumbnails extracted.\n", stdout);
+  }
+
+  if (aux_run) {
+    ThreadPool_destroy(&aux_pool);
+    aux_run = false;
+  }
+
   if (options->extract_audio) {
     if (pl->audio_offset == -1) {
       fputs("File does not contain audio.\n", stdout);
+    } else if (audio_muxed) {
+      fputs("Audio muxed into video.\n", stdout);
     } else {
-      res = Plzj_extract_audio(pl, dir);
+      if (options->to_mkv && options->extract_video) {
+        // muxing failed, write a separate file instead
+        aux_job.audio_ret = Plzj_extract_audio(pl, dir);
+        aux_job.exc = sc_exc;
+      }
+      res = aux_job.audio_ret;
       if_fail (res >= 0) {
+        sc_exc = aux_job.exc;
         what = "audio";
         goto fail;
       }
@@ -521,14 +977,15 @@ static int do_extract (
   }
 
   if (options->extract_txts) {
-    if_fail (Plzj_extract_txts(pl, dir) == 0) {
+    if_fail (aux_job.txts_ret == 0) {
+      sc_exc = aux_job.exc;
       what = "txt files";
       goto fail;
     }
     fputs("Mouse event and key frame txt files extracted.\n", stdout);
   }
 
-  if (options->extract_video) {
+  if (options->extract_video && !options->to_mkv) {
     fputs("\nConvert it with ffmpeg:\n  ffmpeg ", stdout);
     if (options->extract_audio && pl->audio_offset != -1) {
       const char *audio_fn = "audio.wav";
@@ -551,6 +1008,9 @@ static int do_extract (
   return 0;
 
 fail:
+  if (aux_run) {
+    ThreadPool_destroy(&aux_pool);
+  }
   fprintf(stderr, "error: failed to extract %s\n", what);
 fail_err:
   sc_print_err(stderr, "  ", "");
@@ -558,6 +1018,415 @@ fail_err:
 }
 
 
+static int do_extract_all (
+    const struct PlzjOptions *options, struct PlzjFile *pf) {
+  if (options->extract_video || options->extract_cursor ||
+      options->extract_thumbnails) {
+    return_if_fail (set_password(options, pf) >= 0) -1;
+  }
+
+  // sections of one file are recorded with the same settings
+  struct PlzjVideoExtractOptions extract_options;
+  float fps = get_extract_options(options, pf->sections, &extract_options);
+  if (options->extract_video || options->extract_cursor) {
+    print_fps(options, fps);
+  }
+
+  int *results = calloc(pf->sections_cnt, sizeof(*results));
+  if_fail (results != NULL) {
+    fputs("error: out of memory\n", stderr);
+    return -1;
+  }
+  int ret = PlzjFile_extract_sections(
+    pf, options->input_path, options->output_path, &extract_options, results);
+  if_fail (ret == 0) {
+    bool reported = false;
+    for (uint32_t i = 0; i < pf->sections_cnt; i++) {
+      if (results[i] != 0) {
+        reported = true;
+        fprintf(stderr, "error: failed to extract section %" PRIu32 "\n", i);
+      }
+    }
+    free(results);
+    if (!reported) {
+      fputs("error: failed to extract sections\n", stderr);
+    }
+    sc_print_err(stderr, "  ", "");
+    return -1;
+  }
+  free(results);
+
+  printf("%" PRIu32 " sections extracted.\n", pf->sections_cnt);
+  return 0;
+}
+
+
+struct BatchRun {
+  const struct PlzjOptions *options;
+  size_t total;
+  atomic_size_t done;
+};
+
+
+struct BatchJob {
+  struct BatchRun *run;
+  const char *input_path;
+  char *output_path;
+  unsigned int nproc;
+
+  int ret;
+  double seconds;
+  char error[256];
+};
+
+
+struct StrBuf {
+  char *str;
+  size_t size;
+  size_t len;
+};
+
+
+__attr_format((printf, 2, 3))
+static int strbuf_printf (void *data, const char *format, ...) {
+  struct StrBuf *buf = data;
+  return_if_fail (buf->len + 1 < buf->size) 0;
+
+  va_list arg;
+  va_start(arg, format);
+  int ret = vsnprintf(buf->str + buf->len, buf->size - buf->len, format, arg);
+  va_end(arg);
+  if (ret > 0) {
+    buf->len = min(buf->len + ret, buf->size - 1);
+  }
+  return ret;
+}
+
+
+static double timespec_diff (
+    const struct timespec *end, const struct timespec *begin) {
+  return (end->tv_sec - begin->tv_sec) +
+    (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+
+static char *batch_output_path (const char *input, const char *dir) {
+  const char *name = input;
+  if (dir != NULL) {
+    for (size_t i = strlen(input); i > 0; ) {
+      i--;
+      if (input[i] == '/' || input[i] == '\\') {
+        name = input + i + 1;
+        break;
+      }
+    }
+  }
+
+  size_t dir_len = dir == NULL ? 0 : strlen(dir);
+  size_t name_len = strlen(name);
+  char *path = malloc(dir_len + 1 + name_len + 16);
+  return_if_fail (path != NULL) NULL;
+
+  char *p = path;
+  if (dir != NULL) {
+    memcpy(p, dir, dir_len);
+    p += dir_len;
+    *p++ = DIR_SEP;
+  }
+  memcpy(p, name, name_len + 1);
+
+  char *ext = get_extension(p);
+  strcpy(ext == NULL ? p + name_len : ext - 1, ".extracted");
+  return path;
+}
+
+
+static int batch_worker (void *arg) {
+  struct BatchJob *job = arg;
+  struct BatchRun *run = job->run;
+  const struct PlzjOptions *options = run->options;
+
+  struct timespec begin;
+  timespec_get(&begin, TIME_UTC);
+
+  const char *what;
+  struct PlzjFile pf;
+  job->ret = PlzjFile_init_file(&pf, job->input_path, "rb");
+  if_fail (job->ret == 0) {
+    what = "load";
+    goto end;
+  }
+
+  if ((options->extract_video || options->extract_cursor ||
+       options->extract_thumbnails) && pf.sections[0].key_set < 0) {
+    if_fail (options->password != NULL && options->password[0] != '\0') {
+      job->ret = ERR_WHAT(PL_EKEY, "video is play locked, use -k");
+      what = "unlock";
+      goto fail;
+    }
+    int res = PlzjFile_set_password_iconv(
+      &pf, options->password, options->force);
+    if_fail (res >= 0) {
+      job->ret = res;
+      what = "unlock";
+      goto fail;
+    }
+  }
+
+  struct PlzjVideoExtractOptions extract_options;
+  get_extract_options(options, pf.sections, &extract_options);
+  extract_options.video.nproc = job->nproc;
+
+  what = "extract";
+  job->ret = pf.sections_cnt <= 1 ?
+    Plzj_extract(pf.sections, job->output_path, &extract_options) :
+    PlzjFile_extract_sections(
+      &pf, job->input_path, job->output_path, &extract_options, NULL);
+
+fail:
+  PlzjFile_destroy(&pf);
+end:
+  if (job->ret != 0) {
+    struct StrBuf buf = {job->error, sizeof(job->error), 0};
+    strbuf_printf(&buf, "failed to %s: ", what);
+    ScException_print(&sc_exc, strbuf_printf, &buf, NULL, NULL);
+    // keep the status on one line
+    for (size_t i = 0; i < buf.len; i++) {
+      if (job->error[i] == '\n') {
+        job->error[i] = ' ';
+      }
+    }
+    while (buf.len > 0 && job->error[buf.len - 1] == ' ') {
+      buf.len--;
+      job->error[buf.len] = '\0';
+    }
+  }
+
+  struct timespec end;
+  timespec_get(&end, TIME_UTC);
+  job->seconds = timespec_diff(&end, &begin);
+
+  size_t done = atomic_fetch_add(&run->done, 1) + 1;
+  if (job->ret == 0) {
+    fmprintf(
+      stdout, "[%" PRIuSIZE "/%" PRIuSIZE "] ok %s -> %s (%.2f s)\n",
+      done, run->total, job->input_path, job->output_path, job->seconds);
+  } else {
+    fmprintf(
+      stdout, "[%" PRIuSIZE "/%" PRIuSIZE "] FAIL %s: %s\n",
+      done, run->total, job->input_path, job->error);
+  }
+  return 0;
+}
+
+
+static void fput_json_str (const char *s, FILE *out) {
+  fputc('"', out);
+  for (; *s != '\0'; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      fputc('\\', out);
+      fputc(c, out);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+
+static int batch_write_json (
+    const char *path, const struct BatchJob *jobs, size_t jobs_cnt,
+    size_t failed, double seconds) {
+  bool to_stdout = strcmp(path, "-") == 0;
+  FILE *out = to_stdout ? stdout : mfopen(path, "w");
+  return_if_fail (out != NULL) ERR_STD(mfopen);
+
+  fprintf(
+    out, "{\"files\": %" PRIuSIZE ", \"ok\": %" PRIuSIZE ", \"failed\": %"
+    PRIuSIZE ", \"seconds\": %.3f, \"results\": [", jobs_cnt,
+    jobs_cnt - failed, failed, seconds);
+  for (size_t i = 0; i < jobs_cnt; i++) {
+    const struct BatchJob *job = jobs + i;
+    fputs(i == 0 ? "\n  {\"input\": " : ",\n  {\"input\": ", out);
+    fput_json_str(job->input_path, out);
+    fputs(", \"output\": ", out);
+    fput_json_str(job->output_path, out);
+    fprintf(
+      out, ", \"status\": \"%s\", \"seconds\": %.3f",
+      job->ret == 0 ? "ok" : "error", job->seconds);
+    if (job->ret != 0) {
+      fputs(", \"error\": ", out);
+      fput_json_str(job->error, out);
+    }
+    fputs("}", out);
+  }
+  fputs("\n]}\n", out);
+
+  int ret = 0;
+  if_fail (!ferror(out)) {
+    ret = ERR_STD(fprintf);
+  }
+  if (!to_stdout) {
+    fclose(out);
+  }
+  return ret;
+}
+
+
+static int batch_read_list (struct PlzjOptions *options) {
+  return_if_fail (options->batch_list != NULL) 0;
+
+  bool from_stdin = strcmp(options->batch_list, "-") == 0;
+  FILE *list = from_stdin ? stdin : mfopen(options->batch_list, "r");
+  if_fail (list != NULL) {
+    fmprintf(
+      stderr, "error: failed to open input list %s\n", options->batch_list);
+    (void) ERR_STD(mfopen);
+    sc_print_err(stderr, "  ", "");
+    return -1;
+  }
+
+  int ret = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), list) != NULL) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      len--;
+    }
+    line[len] = '\0';
+    if (len == 0 || line[0] == '#') {
+      continue;
+    }
+    if_fail (batch_add_input(options, line) == 0) {
+      fputs("error: out of memory\n", stderr);
+      ret = -1;
+      break;
+    }
+  }
+
+  if (!from_stdin) {
+    fclose(list);
+  }
+  return ret;
+}
+
+
+static int do_batch (struct PlzjOptions *options) {
+  return_if_fail (batch_read_list(options) == 0) -1;
+  size_t jobs_cnt = options->batch_inputs_cnt;
+  if_fail (jobs_cnt > 0) {
+    fputs("error: no input files\n", stderr);
+    return -1;
+  }
+
+  if (options->output_dir != NULL) {
+    struct stat statbuf;
+    if (mstat(options->output_dir, &statbuf) != 0) {
+      if_fail (mmkdir(options->output_dir, 0755) == 0) {
+        fmprintf(
+          stderr, "error: failed to create output dir %s\n",
+          options->output_dir);
+        (void) ERR_STD(mmkdir);
+        sc_print_err(stderr, "  ", "");
+        return -1;
+      }
+    }
+  }
+
+  // one pool for all files, so concurrent files do not oversubscribe cores
+  unsigned int nproc = options->nproc;
+  if (nproc == 0) {
+    int n = get_nproc();
+    nproc = n > 0 ? n : 1;
+  }
+  unsigned int workers = options->jobs > 0 ? options->jobs : nproc;
+  if (workers > jobs_cnt) {
+    workers = jobs_cnt;
+  }
+  unsigned int job_nproc = max(nproc / workers, 1);
+
+  // progress lines of concurrent files would interleave
+  if (sc_log_level == SC_LOG_NOTICE) {
+    sc_log_level = SC_LOG_WARNING;
+  }
+
+  struct BatchRun run = {.options = options, .total = jobs_cnt};
+  atomic_init(&run.done, 0);
+
+  int ret = -1;
+  struct BatchJob *jobs = calloc(jobs_cnt, sizeof(*jobs));
+  if_fail (jobs != NULL) {
+    fputs("error: out of memory\n", stderr);
+    return -1;
+  }
+  size_t i;
+  for (i = 0; i < jobs_cnt; i++) {
+    jobs[i].run = &run;
+    jobs[i].input_path = options->batch_inputs[i];
+    jobs[i].nproc = job_nproc;
+    jobs[i].output_path = batch_output_path(
+      options->batch_inputs[i], options->output_dir);
+    if_fail (jobs[i].output_path != NULL) {
+      fputs("error: out of memory\n", stderr);
+      goto fail;
+    }
+  }
+
+  struct timespec begin;
+  timespec_get(&begin, TIME_UTC);
+
+  struct ThreadPool pool;
+  if_fail (ThreadPool_init(&pool, workers, "batch") == 0) {
+    fputs("error: failed to start workers\n", stderr);
+    sc_print_err(stderr, "  ", "");
+    goto fail;
+  }
+  for (i = 0; i < jobs_cnt; i++) {
+    break_if_fail (ThreadPool_run(&pool, batch_worker, jobs + i) == 0);
+  }
+  ThreadPool_destroy(&pool);
+  if_fail (i == jobs_cnt) {
+    fputs("error: failed to schedule all files\n", stderr);
+    sc_print_err(stderr, "  ", "");
+    goto fail;
+  }
+
+  struct timespec end;
+  timespec_get(&end, TIME_UTC);
+  double seconds = timespec_diff(&end, &begin);
+
+  size_t failed = 0;
+  for (i = 0; i < jobs_cnt; i++) {
+    if (jobs[i].ret != 0) {
+      failed++;
+    }
+  }
+  printf(
+    "%" PRIuSIZE " files, %" PRIuSIZE " failed, %.2f s with %u jobs\n",
+    jobs_cnt, failed, seconds, workers);
+
+  if (options->json_path != NULL) {
+    if_fail (batch_write_json(
+        options->json_path, jobs, jobs_cnt, failed, seconds) == 0) {
+      fputs("error: failed to write JSON summary\n", stderr);
+      sc_print_err(stderr, "  ", "");
+      goto fail;
+    }
+  }
+
+  ret = failed == 0 ? 0 : -1;
+fail:
+  for (i = 0; i < jobs_cnt; i++) {
+    free(jobs[i].output_path);
+  }
+  free(jobs);
+  return ret;
+}
+
+
 static int do_modify (
     const struct PlzjOptions *options, const struct PlzjFile *pf) {
   if (options->set_password && (
@@ -577,23 +1446,26 @@ static int do_modify (
   const char *what = NULL;
   int ret;
 
-  FILE *file = mfopen(options->output_path, "w+b");
+  FILE *file = mfopen(
+    options->output_path, options->in_place ? "r+b" : "w+b");
   if_fail (file != NULL) {
     ret = ERR_STD(mfopen);
     what = "open";
     goto fail_open;
   }
 
-  if_fail (fseeko(pf->file, 0, SEEK_SET) == 0) {
-    ret = ERR_STD(fseeko);
-    what = "copy";
-    goto fail_file;
-  }
-  ret = copy(file, pf->file, pf->file_size, 0);
-  if_fail (ret == 0) {
-    ret = ERR_STD(fseeko);
-    what = "copy";
-    goto fail_file;
+  if (!options->in_place) {
+    if_fail (fseeko(pf->file, 0, SEEK_SET) == 0) {
+      ret = ERR_STD(fseeko);
+      what = "copy";
+      goto fail_file;
+    }
+    // only a few bytes per image change, share the rest with the input
+    ret = reflink(file, pf->file, pf->file_size, 0);
+    if_fail (ret == 0) {
+      what = "copy";
+      goto fail_file;
+    }
   }
 
   struct PlzjFile pf2;
@@ -639,7 +1511,9 @@ fail:
 fail_file:
     fclose(file);
   }
-  munlink(options->output_path);
+  if (!options->in_place) {
+    munlink(options->output_path);
+  }
 fail_open:
   if (what != NULL) {
     fprintf(stderr, "error: failed to %s video file\n", what);
@@ -669,6 +1543,13 @@ int main (int argc, char **argv) {
       goto fail_arg;
   }
 
+  if (options.batch) {
+    if (do_batch(&options) == 0) {
+      ret = EXIT_SUCCESS;
+    }
+    goto fail_arg;
+  }
+
   struct PlzjFile pf;
   if_fail (PlzjFile_init_file(&pf, options.input_path, "rb") == 0) {
     fmprintf(stderr, "error: failed to load input file \"%s\"\n",
@@ -680,8 +1561,13 @@ int main (int argc, char **argv) {
   if (options.output_path == NULL) {
     do_dump(&options, &pf, options.input_path);
   } else if (options.extract_video || options.extract_cursor ||
-             options.extract_audio || options.extract_txts) {
-    goto_if_fail (do_extract(&options, &pf, options.section_i) == 0) fail;
+             options.extract_audio || options.extract_txts ||
+             options.extract_thumbnails) {
+    if (options.all_sections) {
+      goto_if_fail (do_extract_all(&options, &pf) == 0) fail;
+    } else {
+      goto_if_fail (do_extract(&options, &pf, options.section_i) == 0) fail;
+    }
   } else {
     goto_if_fail (do_modify(&options, &pf) == 0) fail;
   }
@@ -699,6 +1585,13 @@ end_arg:
     ret = EXIT_SUCCESS;
   }
 fail_arg:
+  for (size_t i = 0; i < options.batch_inputs_cnt; i++) {
+    free(options.batch_inputs[i]);
+  }
+  free(options.batch_inputs);
+  free(options.batch_list);
+  free(options.output_dir);
+  free(options.json_path);
   free(options.new_password);
   free(options.password);
   free(options.output_path);